@@ -0,0 +1,287 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Homegear.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU Lesser General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+*/
+
+#include "AptPackageIndex.h"
+#include "GD.h"
+
+#include <algorithm>
+#include <cctype>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <lzma.h>
+#include <lz4frame.h>
+
+AptPackageIndex::AptPackageIndex(DpkgDatabase &dpkgDatabase, std::string listsPath) : _dpkgDatabase(dpkgDatabase), _listsPath(std::move(listsPath)) {
+  _upgradablePackages = std::make_shared<const std::vector<UpgradablePackage>>();
+}
+
+int32_t AptPackageIndex::compareVersionPart(const char *a, const char *b) {
+  //Algorithm of dpkg's verrevcmp(): Alternating non-digit and digit parts. "~" sorts before everything, even the end
+  //of the string, letters sort before other characters.
+  auto order = [](char c) -> int32_t {
+    if (std::isdigit((unsigned char)c)) return 0;
+    else if (std::isalpha((unsigned char)c)) return c;
+    else if (c == '~') return -1;
+    else if (c) return c + 256;
+    else return 0;
+  };
+
+  while (*a || *b) {
+    int32_t firstDifference = 0;
+    while ((*a && !std::isdigit((unsigned char)*a)) || (*b && !std::isdigit((unsigned char)*b))) {
+      auto orderA = order(*a);
+      auto orderB = order(*b);
+      if (orderA != orderB) return orderA - orderB;
+      a++;
+      b++;
+    }
+    while (*a == '0') a++;
+    while (*b == '0') b++;
+    while (std::isdigit((unsigned char)*a) && std::isdigit((unsigned char)*b)) {
+      if (!firstDifference) firstDifference = *a - *b;
+      a++;
+      b++;
+    }
+    if (std::isdigit((unsigned char)*a)) return 1;
+    if (std::isdigit((unsigned char)*b)) return -1;
+    if (firstDifference) return firstDifference;
+  }
+  return 0;
+}
+
+int32_t AptPackageIndex::compareVersions(const std::string &a, const std::string &b) {
+  //Format: [epoch:]upstream_version[-debian_revision]
+  auto split = [](const std::string &version, int64_t &epoch, std::string &upstream, std::string &revision) {
+    auto colon = version.find(':');
+    epoch = colon == std::string::npos ? 0 : BaseLib::Math::getNumber64(version.substr(0, colon));
+    auto start = colon == std::string::npos ? 0 : colon + 1;
+    auto hyphen = version.rfind('-');
+    if (hyphen == std::string::npos || hyphen < start) {
+      upstream = version.substr(start);
+      revision.clear();
+    } else {
+      upstream = version.substr(start, hyphen - start);
+      revision = version.substr(hyphen + 1);
+    }
+  };
+
+  int64_t epochA = 0;
+  int64_t epochB = 0;
+  std::string upstreamA, upstreamB, revisionA, revisionB;
+  split(a, epochA, upstreamA, revisionA);
+  split(b, epochB, upstreamB, revisionB);
+
+  if (epochA != epochB) return epochA < epochB ? -1 : 1;
+  auto result = compareVersionPart(upstreamA.c_str(), upstreamB.c_str());
+  if (result != 0) return result;
+  return compareVersionPart(revisionA.c_str(), revisionB.c_str());
+}
+
+bool AptPackageIndex::isPackagesFile(const std::string &filename) {
+  auto endsWith = [&](const std::string &suffix) {
+    return filename.size() >= suffix.size() && filename.compare(filename.size() - suffix.size(), suffix.size(), suffix) == 0;
+  };
+  if (endsWith("_Packages") || endsWith("_Packages.gz") || endsWith("_Packages.xz") || endsWith("_Packages.lz4")) return true;
+  //Depending on "Acquire::CompressionTypes" apt might keep compressed lists we can't read. Don't report "no updates" silently then.
+  if (endsWith("_Packages.bz2") || endsWith("_Packages.lzma") || endsWith("_Packages.zst")) {
+    GD::out.printWarning("Warning: Skipping package list " + filename + " with unsupported compression. Upgrades in it are not reported.");
+  }
+  return false;
+}
+
+std::string AptPackageIndex::readFile(const std::string &filename) {
+  std::string content;
+  int fileDescriptor = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fileDescriptor == -1) return content;
+
+  char buffer[65536];
+  ssize_t bytesRead = 0;
+  while ((bytesRead = read(fileDescriptor, buffer, sizeof(buffer))) != 0) {
+    if (bytesRead == -1) {
+      if (errno == EINTR) continue;
+      content.clear();
+      break;
+    }
+    content.append(buffer, (size_t)bytesRead);
+  }
+  close(fileDescriptor);
+  return content;
+}
+
+std::string AptPackageIndex::readXzFile(const std::string &filename) {
+  std::string content;
+  auto compressedContent = readFile(filename);
+  if (compressedContent.empty()) return content;
+
+  lzma_stream stream = LZMA_STREAM_INIT;
+  if (lzma_stream_decoder(&stream, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK) return content;
+  stream.next_in = (const uint8_t *)compressedContent.data();
+  stream.avail_in = compressedContent.size();
+
+  uint8_t buffer[65536];
+  while (true) {
+    stream.next_out = buffer;
+    stream.avail_out = sizeof(buffer);
+    auto result = lzma_code(&stream, LZMA_FINISH);
+    content.append((char *)buffer, sizeof(buffer) - stream.avail_out);
+    if (result == LZMA_STREAM_END) break;
+    if (result != LZMA_OK) {
+      GD::out.printWarning("Warning: Could not decompress " + filename + " (error " + std::to_string((int32_t)result) + ").");
+      content.clear();
+      break;
+    }
+  }
+  lzma_end(&stream);
+  return content;
+}
+
+std::string AptPackageIndex::readLz4File(const std::string &filename) {
+  std::string content;
+  auto compressedContent = readFile(filename);
+  if (compressedContent.empty()) return content;
+
+  LZ4F_dctx *context = nullptr;
+  if (LZ4F_isError(LZ4F_createDecompressionContext(&context, LZ4F_VERSION))) return content;
+
+  char buffer[65536];
+  size_t position = 0;
+  size_t result = 0;
+  while (true) {
+    size_t outputSize = sizeof(buffer);
+    size_t inputSize = compressedContent.size() - position;
+    result = LZ4F_decompress(context, buffer, &outputSize, compressedContent.data() + position, &inputSize, nullptr);
+    if (LZ4F_isError(result)) break;
+    content.append(buffer, outputSize);
+    position += inputSize;
+    //0 means the frame is complete. Further frames might follow.
+    if (result == 0 && position == compressedContent.size()) break;
+    //No progress, the input is truncated.
+    if (outputSize == 0 && inputSize == 0) break;
+  }
+  LZ4F_freeDecompressionContext(context);
+
+  if (result != 0) {
+    GD::out.printWarning("Warning: Could not decompress " + filename + (LZ4F_isError(result) ? ": " + std::string(LZ4F_getErrorName(result)) : std::string(": File is truncated.")));
+    content.clear();
+  }
+  return content;
+}
+
+std::string AptPackageIndex::readPackagesFile(const std::string &filename) {
+  if (filename.size() > 3 && filename.compare(filename.size() - 3, 3, ".xz") == 0) return readXzFile(filename);
+  if (filename.size() > 4 && filename.compare(filename.size() - 4, 4, ".lz4") == 0) return readLz4File(filename);
+
+  //Depending on "Acquire::GzipIndexes" the lists are stored uncompressed or gzip compressed. gzread() handles both.
+  std::string content;
+  gzFile file = gzopen(filename.c_str(), "rb");
+  if (!file) return content;
+
+  char buffer[65536];
+  int bytesRead = 0;
+  while ((bytesRead = gzread(file, buffer, sizeof(buffer))) > 0) {
+    content.append(buffer, (size_t)bytesRead);
+  }
+  gzclose(file);
+  return content;
+}
+
+AptPackageIndex::PUpgradablePackages AptPackageIndex::getUpgradablePackages() {
+  try {
+    std::lock_guard<std::mutex> indexGuard(_indexMutex);
+
+    //apt writes new lists to "partial/" and renames them, so the directory's modification time changes on every update.
+    struct stat statStruct{};
+    if (stat(_listsPath.c_str(), &statStruct) == -1) return _upgradablePackages;
+    auto listsModificationTime = (int64_t)statStruct.st_mtim.tv_sec * 1000000000 + statStruct.st_mtim.tv_nsec;
+    auto installedPackages = _dpkgDatabase.getInstalledPackages();
+    if (listsModificationTime == _listsModificationTime && installedPackages == _installedPackages) return _upgradablePackages;
+
+    //Only versions of installed packages are of interest. Everything else is skipped while parsing.
+    std::unordered_map<std::string, std::string> candidates;
+    for (auto &file: BaseLib::Io::getFiles(_listsPath, false)) {
+      if (!isPackagesFile(file)) continue;
+
+      auto content = readPackagesFile(_listsPath + file);
+      std::string name;
+      std::string version;
+      std::string architecture;
+      auto finishStanza = [&]() {
+        auto packageIterator = installedPackages->find(name);
+        if (packageIterator != installedPackages->end() && packageIterator->second.architecture == architecture) {
+          auto &candidate = candidates[name];
+          if (candidate.empty() || compareVersions(version, candidate) > 0) candidate = version;
+        }
+        name.clear();
+        version.clear();
+        architecture.clear();
+      };
+
+      size_t position = 0;
+      while (position < content.size()) {
+        auto lineEnd = content.find('\n', position);
+        if (lineEnd == std::string::npos) lineEnd = content.size();
+
+        if (lineEnd == position) finishStanza();
+        else if (content.compare(position, 9, "Package: ") == 0) name = content.substr(position + 9, lineEnd - position - 9);
+        else if (content.compare(position, 9, "Version: ") == 0) version = content.substr(position + 9, lineEnd - position - 9);
+        else if (content.compare(position, 14, "Architecture: ") == 0) architecture = content.substr(position + 14, lineEnd - position - 14);
+
+        position = lineEnd + 1;
+      }
+      finishStanza();
+    }
+
+    auto upgradablePackages = std::make_shared<std::vector<UpgradablePackage>>();
+    for (auto &candidate: candidates) {
+      auto &installedPackage = installedPackages->at(candidate.first);
+      if (compareVersions(candidate.second, installedPackage.version) <= 0) continue;
+
+      UpgradablePackage upgradablePackage;
+      upgradablePackage.name = candidate.first;
+      upgradablePackage.architecture = installedPackage.architecture;
+      upgradablePackage.installedVersion = installedPackage.version;
+      upgradablePackage.candidateVersion = candidate.second;
+      upgradablePackages->push_back(std::move(upgradablePackage));
+    }
+    std::sort(upgradablePackages->begin(), upgradablePackages->end(), [](const UpgradablePackage &a, const UpgradablePackage &b) { return a.name < b.name; });
+
+    _listsModificationTime = listsModificationTime;
+    _installedPackages = installedPackages;
+    _upgradablePackages = upgradablePackages;
+    return _upgradablePackages;
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return std::make_shared<const std::vector<UpgradablePackage>>();
+}
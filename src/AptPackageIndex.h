@@ -0,0 +1,89 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Homegear.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU Lesser General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+*/
+
+#ifndef APTPACKAGEINDEX_H_
+#define APTPACKAGEINDEX_H_
+
+#include "DpkgDatabase.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+
+/**
+ * Index of upgradable packages computed from the apt package lists ("*_Packages" in /var/lib/apt/lists/, uncompressed
+ * or compressed with gzip, xz or lz4) and the dpkg status database. It is rebuilt when the lists directory or the dpkg
+ * status changes, e.g. after "apt-get update" or after installing packages.
+ *
+ * The candidate version is the highest version available for the installed architecture. Pin priorities are not
+ * taken into account.
+ */
+class AptPackageIndex {
+ public:
+  struct UpgradablePackage {
+    std::string name;
+    std::string architecture;
+    std::string installedVersion;
+    std::string candidateVersion;
+  };
+  typedef std::shared_ptr<const std::vector<UpgradablePackage>> PUpgradablePackages;
+
+  explicit AptPackageIndex(DpkgDatabase &dpkgDatabase, std::string listsPath = "/var/lib/apt/lists/");
+  virtual ~AptPackageIndex() = default;
+
+  /**
+   * Returns the upgradable packages sorted by name.
+   */
+  PUpgradablePackages getUpgradablePackages();
+
+  /**
+   * Compares two Debian version strings like "dpkg --compare-versions".
+   *
+   * @return Returns a negative value when a < b, 0 when equal and a positive value when a > b.
+   */
+  static int32_t compareVersions(const std::string &a, const std::string &b);
+ private:
+  DpkgDatabase &_dpkgDatabase;
+  std::string _listsPath;
+  std::mutex _indexMutex;
+  int64_t _listsModificationTime = -1;
+  DpkgDatabase::PPackages _installedPackages;
+  PUpgradablePackages _upgradablePackages;
+
+  static int32_t compareVersionPart(const char *a, const char *b);
+  static bool isPackagesFile(const std::string &filename);
+  static std::string readFile(const std::string &filename);
+  static std::string readXzFile(const std::string &filename);
+  static std::string readLz4File(const std::string &filename);
+  static std::string readPackagesFile(const std::string &filename);
+};
+
+#endif
@@ -0,0 +1,210 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Homegear.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU Lesser General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+*/
+
+#include "AptTracker.h"
+#include "GD.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+
+AptTracker::AptTracker() {
+  //"lock-frontend" is taken by apt and dpkg frontends, "lock" by dpkg itself. "apt-get update" and downloads only take
+  //apt's own locks.
+  _lockFiles.resize(4);
+  _lockFiles.at(0).directory = "/var/lib/dpkg/";
+  _lockFiles.at(0).filename = "lock-frontend";
+  _lockFiles.at(1).directory = "/var/lib/dpkg/";
+  _lockFiles.at(1).filename = "lock";
+  _lockFiles.at(2).directory = "/var/lib/apt/lists/";
+  _lockFiles.at(2).filename = "lock";
+  _lockFiles.at(3).directory = "/var/cache/apt/archives/";
+  _lockFiles.at(3).filename = "lock";
+}
+
+AptTracker::~AptTracker() {
+  stop();
+}
+
+bool AptTracker::start() {
+  try {
+    stop();
+
+    _inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (_inotifyFd == -1) {
+      GD::out.printError("Error: Could not initialize inotify: " + std::string(strerror(errno)));
+    } else {
+      for (auto &lockFile: _lockFiles) {
+        //Watch descriptors are shared by all lock files in the same directory.
+        lockFile.watchDescriptor = inotify_add_watch(_inotifyFd,
+                                                     lockFile.directory.c_str(),
+                                                     IN_OPEN | IN_CLOSE | IN_CREATE | IN_DELETE | IN_MOVED_TO);
+        if (lockFile.watchDescriptor == -1) GD::out.printWarning("Warning: Could not watch " + lockFile.directory + ": " + std::string(strerror(errno)));
+      }
+    }
+
+    probe();
+
+    _stopThread = false;
+    _thread = std::thread(&AptTracker::trackerThread, this);
+    return _inotifyFd != -1;
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return false;
+}
+
+void AptTracker::stop() {
+  try {
+    _stopThread = true;
+    if (_thread.joinable()) _thread.join();
+
+    for (auto &lockFile: _lockFiles) {
+      if (lockFile.fd != -1) {
+        close(lockFile.fd);
+        lockFile.fd = -1;
+      }
+      lockFile.watchDescriptor = -1;
+    }
+    if (_inotifyFd != -1) {
+      close(_inotifyFd);
+      _inotifyFd = -1;
+    }
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+}
+
+void AptTracker::probe() {
+  bool busy = false;
+  pid_t owner = 0;
+
+  for (auto &lockFile: _lockFiles) {
+    if (lockFile.fd == -1) {
+      //A missing lock file is not locked. It is opened once it is created.
+      lockFile.fd = open((lockFile.directory + lockFile.filename).c_str(), O_RDONLY | O_CLOEXEC);
+      if (lockFile.fd == -1) continue;
+    }
+
+    struct flock lock{};
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+    if (fcntl(lockFile.fd, F_GETLK, &lock) == -1) {
+      GD::out.printError("Error: Could not call fcntl on " + lockFile.directory + lockFile.filename + ": " + std::string(strerror(errno)));
+      continue;
+    }
+
+    if (lock.l_type != F_UNLCK) {
+      busy = true;
+      if (owner == 0 && lock.l_pid > 0) owner = lock.l_pid;
+    }
+  }
+
+  _owner = owner;
+  if (busy != _busy) {
+    _busy = busy;
+    if (busy) GD::out.printInfo("Info: apt is running" + (owner > 0 ? " (PID " + std::to_string(owner) + ")." : std::string(".")));
+    else GD::out.printInfo("Info: apt has finished.");
+  }
+}
+
+void AptTracker::processEvents(bool &lockFileChanged, bool &lockFileOpened) {
+  alignas(struct inotify_event) char buffer[4096];
+  while (true) {
+    auto bytesRead = read(_inotifyFd, buffer, sizeof(buffer));
+    if (bytesRead <= 0) {
+      if (bytesRead == -1 && errno == EINTR) continue;
+      return;
+    }
+
+    for (char *position = buffer; position < buffer + bytesRead;) {
+      auto event = (struct inotify_event *)position;
+      position += sizeof(struct inotify_event) + event->len;
+      if (event->len == 0) continue;
+
+      std::string filename(event->name);
+      for (auto &lockFile: _lockFiles) {
+        if (lockFile.watchDescriptor != event->wd || lockFile.filename != filename) continue;
+        lockFileChanged = true;
+
+        if (event->mask & (IN_DELETE | IN_MOVED_TO)) {
+          //The file was replaced. Locks on the old inode don't matter anymore.
+          if (lockFile.fd != -1) {
+            close(lockFile.fd);
+            lockFile.fd = -1;
+          }
+        }
+        if (event->mask & (IN_OPEN | IN_CREATE)) lockFileOpened = true;
+      }
+    }
+  }
+}
+
+void AptTracker::trackerThread() {
+  int64_t recheckUntil = 0;
+
+  while (!_stopThread) {
+    try {
+      //Without inotify fall back to probing every second.
+      if (_inotifyFd == -1) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+        probe();
+        continue;
+      }
+
+      bool recheck = BaseLib::HelperFunctions::getTime() < recheckUntil;
+      pollfd pollFd{};
+      pollFd.fd = _inotifyFd;
+      pollFd.events = POLLIN;
+      auto result = poll(&pollFd, 1, recheck ? 100 : 1000);
+      if (result == -1) {
+        if (errno == EINTR) continue;
+        GD::out.printError("Error: Could not poll inotify file descriptor: " + std::string(strerror(errno)));
+        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+        continue;
+      }
+
+      if (result > 0) {
+        //The dpkg directory sees a lot of events during installations. Only events of the lock files are relevant.
+        bool lockFileChanged = false;
+        bool lockFileOpened = false;
+        processEvents(lockFileChanged, lockFileOpened);
+        //Our own open in "probe()" also generates an event, which only extends the recheck window once.
+        if (lockFileOpened) recheckUntil = BaseLib::HelperFunctions::getTime() + 2000;
+        if (lockFileChanged || recheck || _busy) probe();
+      } else if (recheck || _busy) probe();
+    }
+    catch (const std::exception &ex) {
+      GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+    }
+  }
+}
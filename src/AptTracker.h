@@ -0,0 +1,85 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Homegear.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU Lesser General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+*/
+
+#ifndef APTTRACKER_H_
+#define APTTRACKER_H_
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <sys/types.h>
+
+/**
+ * Tracks whether apt or dpkg is running by watching their lock files.
+ *
+ * The lock files are kept open read only, so probing them with F_GETLK needs neither a writable root file system nor
+ * a new file descriptor. The probes are triggered by inotify events of the lock files' directories. As a lock is
+ * taken shortly after the file was opened, the locks are probed again for a short time after every open.
+ */
+class AptTracker {
+ public:
+  AptTracker();
+  virtual ~AptTracker();
+
+  bool start();
+  void stop();
+
+  /**
+   * Returns true when one of the lock files is locked.
+   */
+  bool isBusy() const { return _busy; }
+
+  /**
+   * Returns the process ID holding the lock or 0 when apt is not running or the owner is unknown (e.g. for open file
+   * description locks).
+   */
+  pid_t getOwner() const { return _owner; }
+ private:
+  struct LockFile {
+    std::string directory;
+    std::string filename;
+    int fd = -1;
+    int watchDescriptor = -1;
+  };
+
+  std::vector<LockFile> _lockFiles;
+  int _inotifyFd = -1;
+  std::atomic_bool _busy{false};
+  std::atomic<pid_t> _owner{0};
+  std::atomic_bool _stopThread{true};
+  std::thread _thread;
+
+  void trackerThread();
+  void probe();
+  void processEvents(bool &lockFileChanged, bool &lockFileOpened);
+};
+
+#endif
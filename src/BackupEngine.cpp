@@ -0,0 +1,541 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Homegear.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU Lesser General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+*/
+
+#include "BackupEngine.h"
+#include "GD.h"
+
+#include <fcntl.h>
+#include <dirent.h>
+#include <grp.h>
+#include <pwd.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+BackupEngine::BackupEngine(std::vector<std::string> paths, uint32_t threads, Progress &progress) : _paths(std::move(paths)), _progress(progress) {
+  _threadCount = threads == 0 ? std::thread::hardware_concurrency() : threads;
+  if (_threadCount == 0) _threadCount = 1;
+  //Enough blocks to keep all threads busy while the writer waits for the oldest one.
+  _maxBlocks = _threadCount * 2 + 2;
+}
+
+BackupEngine::~BackupEngine() {
+  stopThreads();
+  if (_fd != -1) close(_fd);
+}
+
+void BackupEngine::lowerThreadPriority() {
+  //Backups must not slow down Homegear.
+  auto threadId = (id_t)syscall(SYS_gettid);
+  setpriority(PRIO_PROCESS, threadId, 10);
+  //IOPRIO_WHO_PROCESS, best effort class with the lowest priority.
+  syscall(SYS_ioprio_set, 1, threadId, (2 << 13) | 7);
+}
+
+bool BackupEngine::writeAll(int fd, const uint8_t *data, size_t size) {
+  while (size > 0) {
+    auto bytesWritten = write(fd, data, size);
+    if (bytesWritten == -1) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    data += bytesWritten;
+    size -= (size_t)bytesWritten;
+  }
+  return true;
+}
+
+void BackupEngine::stopThreads() {
+  {
+    std::lock_guard<std::mutex> blocksGuard(_blocksMutex);
+    _stopThreads = true;
+    _blocks.clear();
+    _uncompressedBlocks.clear();
+  }
+  _compressionConditionVariable.notify_all();
+  _blocksConditionVariable.notify_all();
+  for (auto &thread: _compressionThreads) {
+    if (thread.joinable()) thread.join();
+  }
+  _compressionThreads.clear();
+  if (_writerThread.joinable()) _writerThread.join();
+}
+
+void BackupEngine::compressionThread() {
+  lowerThreadPriority();
+  while (true) {
+    PBlock block;
+    {
+      std::unique_lock<std::mutex> blocksGuard(_blocksMutex);
+      _compressionConditionVariable.wait(blocksGuard, [&] { return _stopThreads || !_uncompressedBlocks.empty(); });
+      if (_stopThreads) return;
+      block = _uncompressedBlocks.front();
+      _uncompressedBlocks.pop_front();
+    }
+
+    block->crc = crc32(0, block->input.data(), (uInt)block->input.size());
+
+    z_stream stream{};
+    bool success = deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    if (success) {
+      if (!block->dictionary.empty()) deflateSetDictionary(&stream, block->dictionary.data(), (uInt)block->dictionary.size());
+      //Large enough for the whole block including the flush marker, so one call compresses everything.
+      block->output.resize(deflateBound(&stream, (uLong)block->input.size()) + 64);
+      stream.next_in = block->input.data();
+      stream.avail_in = (uInt)block->input.size();
+      stream.next_out = block->output.data();
+      stream.avail_out = (uInt)block->output.size();
+      //Blocks end on a byte boundary, so they can be concatenated. Only the last one ends the deflate stream.
+      auto result = deflate(&stream, block->last ? Z_FINISH : Z_SYNC_FLUSH);
+      success = block->last ? result == Z_STREAM_END : (result == Z_OK && stream.avail_in == 0 && stream.avail_out != 0);
+      block->output.resize(stream.total_out);
+      deflateEnd(&stream);
+    }
+
+    {
+      std::lock_guard<std::mutex> blocksGuard(_blocksMutex);
+      block->compressed = true;
+      block->error = !success;
+    }
+    _blocksConditionVariable.notify_all();
+  }
+}
+
+void BackupEngine::writerThread() {
+  lowerThreadPriority();
+  while (true) {
+    PBlock block;
+    {
+      std::unique_lock<std::mutex> blocksGuard(_blocksMutex);
+      _blocksConditionVariable.wait(blocksGuard, [&] { return _stopThreads || (!_blocks.empty() && _blocks.front()->compressed); });
+      if (_stopThreads) return;
+      block = _blocks.front();
+    }
+
+    std::string error;
+    if (block->error) error = "Could not compress the archive.";
+    else if (!writeAll(_fd, block->output.data(), block->output.size())) error = "Could not write the archive: " + std::string(strerror(errno));
+    else {
+      _crc = crc32_combine(_crc, block->crc, (z_off_t)block->input.size());
+      _length += block->input.size();
+      _progress.compressedBytes += block->output.size();
+    }
+
+    {
+      std::lock_guard<std::mutex> blocksGuard(_blocksMutex);
+      if (!_blocks.empty() && _blocks.front() == block) _blocks.pop_front();
+      if (!error.empty()) {
+        _writeError = true;
+        _writeErrorMessage = error;
+      }
+    }
+    _blocksConditionVariable.notify_all();
+    if (!error.empty()) return;
+  }
+}
+
+bool BackupEngine::submitBlock(bool last) {
+  auto block = std::move(_currentBlock);
+  block->last = last;
+
+  if (!last) {
+    _currentBlock = std::make_shared<Block>();
+    _currentBlock->input.reserve(blockSize);
+    auto dictionaryStart = block->input.size() > dictionarySize ? block->input.size() - dictionarySize : 0;
+    _currentBlock->dictionary.assign(block->input.begin() + dictionaryStart, block->input.end());
+  }
+
+  {
+    std::unique_lock<std::mutex> blocksGuard(_blocksMutex);
+    _blocksConditionVariable.wait(blocksGuard, [&] { return _blocks.size() < _maxBlocks || _writeError || _progress.cancel; });
+    if (_writeError || _progress.cancel) return false;
+    _blocks.push_back(block);
+    _uncompressedBlocks.push_back(block);
+  }
+  _compressionConditionVariable.notify_one();
+  return true;
+}
+
+bool BackupEngine::append(const void *data, size_t size) {
+  auto bytes = (const uint8_t *)data;
+  while (size > 0) {
+    auto &input = _currentBlock->input;
+    auto length = std::min(size, blockSize - input.size());
+    input.insert(input.end(), bytes, bytes + length);
+    bytes += length;
+    size -= length;
+    _archiveSize += length;
+    if (input.size() == blockSize && !submitBlock(false)) return false;
+  }
+  return true;
+}
+
+bool BackupEngine::appendZeros(uint64_t size) {
+  static const std::array<uint8_t, 512> zeros{};
+  while (size > 0) {
+    auto length = (size_t)std::min<uint64_t>(size, zeros.size());
+    if (!append(zeros.data(), length)) return false;
+    size -= length;
+  }
+  return true;
+}
+
+std::string BackupEngine::getUserName(uid_t uid) {
+  auto userIterator = _userNames.find(uid);
+  if (userIterator != _userNames.end()) return userIterator->second;
+
+  std::string name;
+  struct passwd passwdStruct{};
+  struct passwd *result = nullptr;
+  std::vector<char> buffer(16384);
+  if (getpwuid_r(uid, &passwdStruct, buffer.data(), buffer.size(), &result) == 0 && result) name = result->pw_name;
+  _userNames.emplace(uid, name);
+  return name;
+}
+
+std::string BackupEngine::getGroupName(gid_t gid) {
+  auto groupIterator = _groupNames.find(gid);
+  if (groupIterator != _groupNames.end()) return groupIterator->second;
+
+  std::string name;
+  struct group groupStruct{};
+  struct group *result = nullptr;
+  std::vector<char> buffer(16384);
+  if (getgrgid_r(gid, &groupStruct, buffer.data(), buffer.size(), &result) == 0 && result) name = result->gr_name;
+  _groupNames.emplace(gid, name);
+  return name;
+}
+
+void BackupEngine::setNumber(char *field, size_t size, uint64_t value) {
+  if (value < (1ull << (3 * (size - 1)))) {
+    //Octal digits terminated by NUL.
+    field[size - 1] = 0;
+    for (size_t i = size - 1; i > 0; i--) {
+      field[i - 1] = (char)('0' + (value & 7));
+      value >>= 3;
+    }
+  } else {
+    //GNU extension for values which don't fit into the field: Big endian binary with the highest bit of the first byte set.
+    for (size_t i = size - 1; i > 0; i--) {
+      field[i] = (char)(value & 0xFF);
+      value >>= 8;
+    }
+    field[0] = (char)0x80;
+  }
+}
+
+std::string BackupEngine::getPaxRecord(const std::string &key, const std::string &value) {
+  //"<length> <key>=<value>\n". The length includes its own digits.
+  auto record = " " + key + "=" + value + "\n";
+  auto digits = std::to_string(record.size()).size();
+  while (std::to_string(record.size() + digits).size() != digits) digits++;
+  return std::to_string(record.size() + digits) + record;
+}
+
+void BackupEngine::fillHeader(char *header,
+                              const std::string &name,
+                              const std::string &prefix,
+                              uint32_t mode,
+                              uint64_t uid,
+                              uint64_t gid,
+                              uint64_t size,
+                              int64_t mtime,
+                              char type,
+                              const std::string &linkName,
+                              const std::string &userName,
+                              const std::string &groupName) {
+  //POSIX ustar header. "header" needs to be 512 zeroed bytes. Text fields are truncated.
+  memcpy(header, name.data(), std::min<size_t>(name.size(), 100));
+  setNumber(header + 100, 8, mode);
+  setNumber(header + 108, 8, uid);
+  setNumber(header + 116, 8, gid);
+  setNumber(header + 124, 12, size);
+  setNumber(header + 136, 12, mtime < 0 ? 0 : (uint64_t)mtime);
+  header[156] = type;
+  memcpy(header + 157, linkName.data(), std::min<size_t>(linkName.size(), 100));
+  memcpy(header + 257, "ustar", 6);
+  memcpy(header + 263, "00", 2);
+  memcpy(header + 265, userName.data(), std::min<size_t>(userName.size(), 31));
+  memcpy(header + 297, groupName.data(), std::min<size_t>(groupName.size(), 31));
+  memcpy(header + 345, prefix.data(), std::min<size_t>(prefix.size(), 155));
+
+  //The checksum is calculated with the checksum field set to spaces.
+  memset(header + 148, ' ', 8);
+  uint32_t checksum = 0;
+  for (size_t i = 0; i < 512; i++) {
+    checksum += (uint8_t)header[i];
+  }
+  setNumber(header + 148, 7, checksum);
+}
+
+bool BackupEngine::writeHeader(const struct stat &statStruct, char type, const std::string &archiveName, const std::string &linkName) {
+  std::string name = type == '5' ? archiveName + "/" : archiveName;
+  std::string prefix;
+  std::string paxRecords;
+  if (name.size() > 100) {
+    //Split at a "/" into the prefix and the name field. Names which can't be split are stored in a pax header.
+    auto position = name.size() <= 256 ? name.find_last_of('/', std::min<size_t>(155, name.size() - 2)) : std::string::npos;
+    if (position != std::string::npos && position > 0 && name.size() - position - 1 <= 100) {
+      prefix = name.substr(0, position);
+      name = name.substr(position + 1);
+    } else paxRecords.append(getPaxRecord("path", name));
+  }
+  if (linkName.size() > 100) paxRecords.append(getPaxRecord("linkpath", linkName));
+
+  if (!paxRecords.empty()) {
+    std::array<char, 512> paxHeader{};
+    fillHeader(paxHeader.data(), "././@PaxHeader", "", 0644, 0, 0, paxRecords.size(), statStruct.st_mtime, 'x', "", "", "");
+    if (!append(paxHeader.data(), paxHeader.size()) || !append(paxRecords.data(), paxRecords.size())) return false;
+    if (!appendZeros((512 - paxRecords.size() % 512) % 512)) return false;
+  }
+
+  std::array<char, 512> header{};
+  fillHeader(header.data(),
+             name,
+             prefix,
+             statStruct.st_mode & 07777,
+             statStruct.st_uid,
+             statStruct.st_gid,
+             type == '0' ? (uint64_t)statStruct.st_size : 0,
+             statStruct.st_mtime,
+             type,
+             linkName,
+             getUserName(statStruct.st_uid),
+             getGroupName(statStruct.st_gid));
+  return append(header.data(), header.size());
+}
+
+bool BackupEngine::addFile(int fd, const std::string &archiveName, uint64_t size, std::string &output) {
+  uint64_t remaining = size;
+  while (remaining > 0) {
+    if (_progress.cancel) return false;
+
+    //Read directly into the current block to avoid another copy.
+    auto &input = _currentBlock->input;
+    auto offset = input.size();
+    auto length = (size_t)std::min<uint64_t>(remaining, blockSize - offset);
+    input.resize(offset + length);
+    ssize_t bytesRead = 0;
+    do {
+      bytesRead = read(fd, input.data() + offset, length);
+    } while (bytesRead == -1 && errno == EINTR);
+    if (bytesRead <= 0) {
+      input.resize(offset);
+      //The header already contains the size, so the missing data is replaced with zeros.
+      output.append("Warning: " + archiveName + ": " + (bytesRead == 0 ? std::string("File shrank while it was read.") : std::string(strerror(errno))) + "\n");
+      if (!appendZeros(remaining)) return false;
+      break;
+    }
+    input.resize(offset + (size_t)bytesRead);
+    remaining -= (uint64_t)bytesRead;
+    _archiveSize += (uint64_t)bytesRead;
+    _progress.bytes += (uint64_t)bytesRead;
+    if (input.size() == blockSize && !submitBlock(false)) return false;
+  }
+
+  struct stat statStruct{};
+  if (fstat(fd, &statStruct) == 0 && (uint64_t)statStruct.st_size != size) output.append("Warning: " + archiveName + ": File changed while it was read.\n");
+  //The data is not needed again. Don't push Homegear's files out of the page cache.
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+  return appendZeros((512 - size % 512) % 512);
+}
+
+bool BackupEngine::addEntry(int directoryFd, const std::string &name, const std::string &archiveName, std::string &output) {
+  if (_progress.cancel) return false;
+
+  struct stat statStruct{};
+  if (fstatat(directoryFd, name.c_str(), &statStruct, AT_SYMLINK_NOFOLLOW) == -1) {
+    //Files deleted while the backup is running are no error.
+    if (errno != ENOENT) output.append("Warning: Could not read " + archiveName + ": " + std::string(strerror(errno)) + "\n");
+    return true;
+  }
+
+  if (S_ISLNK(statStruct.st_mode)) {
+    std::vector<char> target((size_t)statStruct.st_size + 1);
+    auto length = readlinkat(directoryFd, name.c_str(), target.data(), target.size());
+    if (length == -1) {
+      output.append("Warning: Could not read link " + archiveName + ": " + std::string(strerror(errno)) + "\n");
+      return true;
+    }
+    _progress.files++;
+    return writeHeader(statStruct, '2', archiveName, std::string(target.data(), (size_t)length));
+  }
+
+  if (S_ISREG(statStruct.st_mode)) {
+    int fd = openat(directoryFd, name.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1) {
+      if (errno != ENOENT) output.append("Warning: Could not open " + archiveName + ": " + std::string(strerror(errno)) + "\n");
+      return true;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    bool success = writeHeader(statStruct, '0', archiveName, "") && addFile(fd, archiveName, (uint64_t)statStruct.st_size, output);
+    close(fd);
+    _progress.files++;
+    return success;
+  }
+
+  if (!S_ISDIR(statStruct.st_mode)) return true; //Sockets, FIFOs and devices are skipped.
+  if (statStruct.st_dev == _excludedDevice && statStruct.st_ino == _excludedInode) return true;
+
+  int fd = openat(directoryFd, name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (fd == -1) {
+    if (errno != ENOENT) output.append("Warning: Could not open directory " + archiveName + ": " + std::string(strerror(errno)) + "\n");
+    return true;
+  }
+  DIR *directory = fdopendir(fd);
+  if (!directory) {
+    output.append("Warning: Could not read directory " + archiveName + ": " + std::string(strerror(errno)) + "\n");
+    close(fd);
+    return true;
+  }
+  //Sorted, so backups of the same data are identical.
+  std::vector<std::string> entries;
+  while (dirent *entry = readdir(directory)) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+    entries.emplace_back(entry->d_name);
+  }
+  std::sort(entries.begin(), entries.end());
+
+  _progress.files++;
+  bool success = writeHeader(statStruct, '5', archiveName, "");
+  for (auto &entry: entries) {
+    if (!success) break;
+    success = addEntry(fd, entry, archiveName + "/" + entry, output);
+  }
+  closedir(directory); //Closes fd.
+  return success;
+}
+
+bool BackupEngine::create(const std::string &file, std::string &output) {
+  auto slashPosition = file.find_last_of('/');
+  std::string directory = slashPosition == std::string::npos ? "." : (slashPosition == 0 ? "/" : file.substr(0, slashPosition));
+  struct stat directoryStat{};
+  if (stat(directory.c_str(), &directoryStat) == -1) {
+    output.append("Error: Could not read " + directory + ": " + std::string(strerror(errno)) + "\n");
+    return false;
+  }
+  //Don't include earlier backups.
+  _excludedDevice = directoryStat.st_dev;
+  _excludedInode = directoryStat.st_ino;
+
+  auto tempFile = file + ".part";
+  _fd = open(tempFile.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP);
+  if (_fd == -1) {
+    output.append("Error: Could not create " + tempFile + ": " + std::string(strerror(errno)) + "\n");
+    return false;
+  }
+  //Readable by the owner of the backup directory.
+  fchown(_fd, directoryStat.st_uid, directoryStat.st_gid);
+
+  //The calling thread is reused for other commands, so its priority is restored afterwards.
+  auto threadId = (id_t)syscall(SYS_gettid);
+  errno = 0;
+  auto nice = getpriority(PRIO_PROCESS, threadId);
+  bool restoreNice = errno == 0;
+  auto ioPriority = syscall(SYS_ioprio_get, 1, threadId);
+  lowerThreadPriority();
+
+  _stopThreads = false;
+  _currentBlock = std::make_shared<Block>();
+  _currentBlock->input.reserve(blockSize);
+  for (size_t i = 0; i < _threadCount; i++) {
+    _compressionThreads.emplace_back(&BackupEngine::compressionThread, this);
+  }
+  _writerThread = std::thread(&BackupEngine::writerThread, this);
+
+  //gzip header without file name and modification time. The operating system is Unix.
+  const std::array<uint8_t, 10> gzipHeader{0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 3};
+  bool success = writeAll(_fd, gzipHeader.data(), gzipHeader.size());
+  if (!success) output.append("Error: Could not write the archive: " + std::string(strerror(errno)) + "\n");
+
+  for (auto &path: _paths) {
+    if (!success) break;
+    std::string archiveName = path;
+    while (!archiveName.empty() && archiveName.front() == '/') archiveName.erase(0, 1);
+    while (!archiveName.empty() && archiveName.back() == '/') archiveName.pop_back();
+    if (archiveName.empty()) continue;
+    success = addEntry(AT_FDCWD, path, archiveName, output);
+  }
+
+  //Two empty blocks end the archive. Like GNU tar, the archive is padded to a multiple of 10 KiB.
+  if (success) success = appendZeros(1024) && appendZeros((10240 - _archiveSize % 10240) % 10240) && submitBlock(true);
+  if (success) {
+    std::unique_lock<std::mutex> blocksGuard(_blocksMutex);
+    _blocksConditionVariable.wait(blocksGuard, [&] { return _blocks.empty() || _writeError; });
+  }
+  stopThreads();
+
+  if (restoreNice) setpriority(PRIO_PROCESS, threadId, nice);
+  if (ioPriority != -1) syscall(SYS_ioprio_set, 1, threadId, ioPriority);
+
+  if (_writeError) {
+    success = false;
+    output.append("Error: " + _writeErrorMessage + "\n");
+  } else if (_progress.cancel) {
+    success = false;
+    output.append("Error: The backup was cancelled.\n");
+  }
+
+  if (success) {
+    //gzip trailer: CRC-32 and size modulo 2^32 of the uncompressed data, little endian.
+    std::array<uint8_t, 8> gzipTrailer{};
+    for (size_t i = 0; i < 4; i++) {
+      gzipTrailer[i] = (uint8_t)(_crc >> (i * 8));
+      gzipTrailer[i + 4] = (uint8_t)(_length >> (i * 8));
+    }
+    success = writeAll(_fd, gzipTrailer.data(), gzipTrailer.size()) && fsync(_fd) == 0;
+    if (!success) output.append("Error: Could not write the archive: " + std::string(strerror(errno)) + "\n");
+  }
+  close(_fd);
+  _fd = -1;
+
+  if (success && rename(tempFile.c_str(), file.c_str()) == -1) {
+    output.append("Error: Could not rename " + tempFile + " to " + file + ": " + std::string(strerror(errno)) + "\n");
+    success = false;
+  }
+  if (!success) {
+    unlink(tempFile.c_str());
+    return false;
+  }
+
+  int directoryFd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (directoryFd != -1) {
+    fsync(directoryFd);
+    close(directoryFd);
+  }
+  return true;
+}
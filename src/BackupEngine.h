@@ -0,0 +1,138 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Homegear.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU Lesser General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+*/
+
+#ifndef BACKUPENGINE_H_
+#define BACKUPENGINE_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+
+/**
+ * Creates gzip compressed tar archives in process. The archive is produced in blocks of 256 KiB which are compressed in
+ * parallel and written in order, like pigz does: Every block is a raw deflate stream primed with the last 32 KiB of the
+ * previous block, so the result is a single standard gzip member. The number of blocks in flight is limited, so memory
+ * usage doesn't depend on the size of the backup.
+ */
+class BackupEngine {
+ public:
+  /**
+   * Shared between the backup and readers of its progress. Set "cancel" to abort the backup.
+   */
+  struct Progress {
+    std::atomic<uint64_t> files{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> compressedBytes{0};
+    std::atomic_bool cancel{false};
+  };
+
+  /**
+   * @param paths The files and directories to back up.
+   * @param threads The number of compression threads. "0" starts one thread per CPU core.
+   */
+  BackupEngine(std::vector<std::string> paths, uint32_t threads, Progress &progress);
+  ~BackupEngine();
+
+  /**
+   * Writes the archive to "file". Entry names are the paths without the leading "/", like "tar -czf" creates them. The
+   * directory of "file" is not included in the archive. The archive is written to a temporary name and renamed when
+   * complete.
+   *
+   * @param[out] output Warnings about skipped or changed files and, when false is returned, the error.
+   */
+  bool create(const std::string &file, std::string &output);
+ private:
+  struct Block {
+    std::vector<uint8_t> input;
+    std::vector<uint8_t> dictionary; //The last 32 KiB of the previous block.
+    std::vector<uint8_t> output;
+    uint32_t crc = 0;
+    bool last = false;
+    bool compressed = false;
+    bool error = false;
+  };
+  typedef std::shared_ptr<Block> PBlock;
+
+  static constexpr size_t blockSize = 262144;
+  static constexpr size_t dictionarySize = 32768;
+
+  std::vector<std::string> _paths;
+  size_t _threadCount = 1;
+  size_t _maxBlocks = 4;
+  Progress &_progress;
+
+  int _fd = -1;
+  dev_t _excludedDevice = 0;
+  ino_t _excludedInode = 0;
+  PBlock _currentBlock;
+  std::map<uid_t, std::string> _userNames;
+  std::map<gid_t, std::string> _groupNames;
+
+  std::mutex _blocksMutex;
+  std::condition_variable _compressionConditionVariable;
+  std::condition_variable _blocksConditionVariable;
+  std::deque<PBlock> _blocks; //All blocks not written yet, in archive order.
+  std::deque<PBlock> _uncompressedBlocks;
+  bool _stopThreads = false;
+  bool _writeError = false; //Protected by _blocksMutex.
+  std::string _writeErrorMessage;
+  uint64_t _archiveSize = 0; //Size of the uncompressed archive.
+  uint32_t _crc = 0; //Only accessed by the writer thread until it is joined.
+  uint64_t _length = 0;
+  std::vector<std::thread> _compressionThreads;
+  std::thread _writerThread;
+
+  void compressionThread();
+  void writerThread();
+  void stopThreads();
+  static void lowerThreadPriority();
+  static bool writeAll(int fd, const uint8_t *data, size_t size);
+
+  bool append(const void *data, size_t size);
+  bool appendZeros(uint64_t size);
+  bool submitBlock(bool last);
+  bool addEntry(int directoryFd, const std::string &name, const std::string &archiveName, std::string &output);
+  bool addFile(int fd, const std::string &archiveName, uint64_t size, std::string &output);
+  bool writeHeader(const struct stat &statStruct, char type, const std::string &archiveName, const std::string &linkName);
+  std::string getUserName(uid_t uid);
+  std::string getGroupName(gid_t gid);
+  static void fillHeader(char *header, const std::string &name, const std::string &prefix, uint32_t mode, uint64_t uid, uint64_t gid, uint64_t size, int64_t mtime, char type, const std::string &linkName, const std::string &userName, const std::string &groupName);
+  static void setNumber(char *field, size_t size, uint64_t value);
+  static std::string getPaxRecord(const std::string &key, const std::string &value);
+};
+
+#endif
@@ -0,0 +1,440 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Homegear.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU Lesser General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+*/
+
+#include "CertificateAuthority.h"
+#include "GD.h"
+
+#include <gnutls/gnutls.h>
+#include <gnutls/x509.h>
+#include <gnutls/abstract.h>
+#include <gnutls/crypto.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace {
+
+struct GnutlsDatum {
+  gnutls_datum_t datum{nullptr, 0};
+
+  ~GnutlsDatum() { if (datum.data) gnutls_free(datum.data); }
+  std::string toString() const { return std::string((char *)datum.data, datum.size); }
+};
+
+struct PrivateKey {
+  gnutls_x509_privkey_t key = nullptr;
+
+  PrivateKey() { gnutls_x509_privkey_init(&key); }
+  ~PrivateKey() { if (key) gnutls_x509_privkey_deinit(key); }
+};
+
+struct Certificate {
+  gnutls_x509_crt_t certificate = nullptr;
+
+  Certificate() { gnutls_x509_crt_init(&certificate); }
+  ~Certificate() { if (certificate) gnutls_x509_crt_deinit(certificate); }
+};
+
+struct SigningKey {
+  gnutls_privkey_t key = nullptr;
+
+  SigningKey() { gnutls_privkey_init(&key); }
+  ~SigningKey() { if (key) gnutls_privkey_deinit(key); }
+};
+
+/**
+ * Fills a certificate with the subject "/C=HG/ST=HG/L=HG/O=HG/CN=<commonName>" and the extensions "openssl ca" adds
+ * with the default configuration ("v3_ca" or "usr_cert") and signs it. Without issuer the certificate is self-signed.
+ */
+bool signCertificate(Certificate &certificate,
+                     PrivateKey &subjectKey,
+                     const std::string &commonName,
+                     const std::vector<uint8_t> &serial,
+                     int64_t activationTime,
+                     int64_t expirationTime,
+                     bool isCa,
+                     Certificate *issuer,
+                     PrivateKey &issuerKey,
+                     std::string &error) {
+  int result = gnutls_x509_crt_set_version(certificate.certificate, 3);
+  if (result == GNUTLS_E_SUCCESS) result = gnutls_x509_crt_set_serial(certificate.certificate, serial.data(), serial.size());
+  if (result == GNUTLS_E_SUCCESS) result = gnutls_x509_crt_set_activation_time(certificate.certificate, (time_t)activationTime);
+  if (result == GNUTLS_E_SUCCESS) result = gnutls_x509_crt_set_expiration_time(certificate.certificate, (time_t)expirationTime);
+  const std::pair<const char *, std::string> subject[] = {{GNUTLS_OID_X520_COUNTRY_NAME, "HG"},
+                                                           {GNUTLS_OID_X520_STATE_OR_PROVINCE_NAME, "HG"},
+                                                           {GNUTLS_OID_X520_LOCALITY_NAME, "HG"},
+                                                           {GNUTLS_OID_X520_ORGANIZATION_NAME, "HG"},
+                                                           {GNUTLS_OID_X520_COMMON_NAME, commonName}};
+  for (auto &element: subject) {
+    if (result == GNUTLS_E_SUCCESS) result = gnutls_x509_crt_set_dn_by_oid(certificate.certificate, element.first, 0, element.second.data(), element.second.size());
+  }
+  if (result == GNUTLS_E_SUCCESS) result = gnutls_x509_crt_set_key(certificate.certificate, subjectKey.key);
+  if (result == GNUTLS_E_SUCCESS) result = gnutls_x509_crt_set_basic_constraints(certificate.certificate, isCa ? 1 : 0, -1);
+  if (result == GNUTLS_E_SUCCESS && isCa) result = gnutls_x509_crt_set_key_usage(certificate.certificate, GNUTLS_KEY_KEY_CERT_SIGN | GNUTLS_KEY_CRL_SIGN);
+  if (result != GNUTLS_E_SUCCESS) {
+    error = "Could not fill certificate: " + std::string(gnutls_strerror(result));
+    return false;
+  }
+
+  unsigned char keyId[64];
+  size_t keyIdSize = sizeof(keyId);
+  result = gnutls_x509_crt_get_key_id(certificate.certificate, 0, keyId, &keyIdSize);
+  if (result == GNUTLS_E_SUCCESS) result = gnutls_x509_crt_set_subject_key_id(certificate.certificate, keyId, keyIdSize);
+  if (result == GNUTLS_E_SUCCESS) {
+    if (issuer) {
+      unsigned int critical = 0;
+      keyIdSize = sizeof(keyId);
+      result = gnutls_x509_crt_get_subject_key_id(issuer->certificate, keyId, &keyIdSize, &critical);
+    }
+    if (result == GNUTLS_E_SUCCESS) result = gnutls_x509_crt_set_authority_key_id(certificate.certificate, keyId, keyIdSize);
+  }
+  if (result != GNUTLS_E_SUCCESS) {
+    error = "Could not set key identifiers: " + std::string(gnutls_strerror(result));
+    return false;
+  }
+
+  SigningKey signingKey;
+  result = gnutls_privkey_import_x509(signingKey.key, issuerKey.key, 0);
+  if (result == GNUTLS_E_SUCCESS) {
+    result = gnutls_x509_crt_privkey_sign(certificate.certificate, issuer ? issuer->certificate : certificate.certificate, signingKey.key, GNUTLS_DIG_SHA256, 0);
+  }
+  if (result != GNUTLS_E_SUCCESS) {
+    error = "Could not sign certificate: " + std::string(gnutls_strerror(result));
+    return false;
+  }
+  return true;
+}
+
+bool generateKey(PrivateKey &key, unsigned int bits, std::string &error) {
+  int result = gnutls_x509_privkey_generate(key.key, GNUTLS_PK_RSA, bits, 0);
+  if (result != GNUTLS_E_SUCCESS) {
+    error = "Could not generate key: " + std::string(gnutls_strerror(result));
+    return false;
+  }
+  return true;
+}
+
+std::string getSerialHex(uint64_t serial) {
+  //Like "openssl ca": uppercase with an even number of digits.
+  char buffer[24];
+  snprintf(buffer, sizeof(buffer), "%llX", (unsigned long long)serial);
+  std::string serialHex(buffer);
+  if (serialHex.size() % 2 != 0) serialHex.insert(serialHex.begin(), '0');
+  return serialHex;
+}
+
+bool importFile(const std::string &filename, GnutlsDatum &data, std::string &error) {
+  int result = gnutls_load_file(filename.c_str(), &data.datum);
+  if (result != GNUTLS_E_SUCCESS) {
+    error = "Could not read " + filename + ": " + std::string(gnutls_strerror(result));
+    return false;
+  }
+  return true;
+}
+
+}
+
+CertificateAuthority::CertificateAuthority(std::string path, CertificateKeyPool &keyPool) : _path(std::move(path)), _keyPool(keyPool) {
+}
+
+bool CertificateAuthority::exists() {
+  return BaseLib::Io::directoryExists(_path) && BaseLib::Io::fileExists(_path + "private/cakey.pem");
+}
+
+std::string CertificateAuthority::getCommonName(const std::string &indexLine) {
+  //Format: <status>\t<expiration time>\t<revocation time>\t<serial>\t<file name>\t<subject>
+  auto position = indexLine.rfind("/CN=");
+  if (position == std::string::npos) return "";
+  return indexLine.substr(position + 4);
+}
+
+std::string CertificateAuthority::getIndexTime(int64_t time) {
+  //Like ASN.1: UTCTime until 2049, GeneralizedTime after that.
+  time_t timeValue = (time_t)time;
+  struct tm timeStruct{};
+  gmtime_r(&timeValue, &timeStruct);
+  char buffer[32];
+  if (timeStruct.tm_year + 1900 < 2050) strftime(buffer, sizeof(buffer), "%y%m%d%H%M%SZ", &timeStruct);
+  else strftime(buffer, sizeof(buffer), "%Y%m%d%H%M%SZ", &timeStruct);
+  return buffer;
+}
+
+void CertificateAuthority::loadIndex() {
+  auto filename = _path + "index.txt";
+  struct stat statStruct{};
+  if (stat(filename.c_str(), &statStruct) == -1) {
+    _commonNames.clear();
+    _indexInode = 0;
+    _indexModificationTime = -1;
+    return;
+  }
+  int64_t modificationTime = (int64_t)statStruct.st_mtim.tv_sec * 1000000000 + statStruct.st_mtim.tv_nsec;
+  if (statStruct.st_ino == _indexInode && modificationTime == _indexModificationTime) return;
+
+  _commonNames.clear();
+  auto lines = BaseLib::HelperFunctions::splitAll(BaseLib::Io::getFileContent(filename), '\n');
+  for (auto &line: lines) {
+    auto commonName = getCommonName(line);
+    if (!commonName.empty()) _commonNames.emplace(std::move(commonName));
+  }
+  _indexInode = statStruct.st_ino;
+  _indexModificationTime = modificationTime;
+}
+
+bool CertificateAuthority::writeFile(const std::string &filename, const std::string &content, mode_t mode, std::string &error) {
+  auto tempFilename = filename + ".tmp";
+  int fd = open(tempFilename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+  if (fd == -1) {
+    error = "Could not create " + tempFilename + ": " + std::string(strerror(errno));
+    return false;
+  }
+  //The mode passed to open() is subject to the umask.
+  fchmod(fd, mode);
+
+  size_t bytesWritten = 0;
+  while (bytesWritten < content.size()) {
+    auto result = write(fd, content.data() + bytesWritten, content.size() - bytesWritten);
+    if (result == -1) {
+      if (errno == EINTR) continue;
+      error = "Could not write " + tempFilename + ": " + std::string(strerror(errno));
+      close(fd);
+      unlink(tempFilename.c_str());
+      return false;
+    }
+    bytesWritten += (size_t)result;
+  }
+  if (fsync(fd) == -1 || close(fd) == -1 || rename(tempFilename.c_str(), filename.c_str()) == -1) {
+    error = "Could not write " + filename + ": " + std::string(strerror(errno));
+    unlink(tempFilename.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool CertificateAuthority::create(const std::string &commonName, std::string &error) {
+  try {
+    std::lock_guard<std::mutex> caGuard(_mutex);
+    if (exists()) {
+      error = "CA already exists.";
+      return false;
+    }
+
+    for (auto &directory: {std::string(), std::string("newcerts"), std::string("certs"), std::string("crl"), std::string("private"), std::string("requests")}) {
+      if (mkdir((_path + directory).c_str(), 0755) == -1 && errno != EEXIST) {
+        error = "Could not create directory " + _path + directory + ": " + std::string(strerror(errno));
+        return false;
+      }
+    }
+    if (!BaseLib::Io::fileExists(_path + "index.txt") && !writeFile(_path + "index.txt", "", 0644, error)) return false;
+    if (!writeFile(_path + "serial", "1000\n", 0644, error)) return false;
+
+    PrivateKey key;
+    if (!generateKey(key, caKeyBits, error)) return false;
+
+    Certificate certificate;
+    int64_t now = BaseLib::HelperFunctions::getTimeSeconds();
+    //Like "openssl req -x509": a random positive serial number for the CA certificate.
+    std::vector<uint8_t> serial(8);
+    gnutls_rnd(GNUTLS_RND_NONCE, serial.data(), serial.size());
+    serial.front() = (serial.front() & 0x7F) | 0x01;
+    if (!signCertificate(certificate, key, commonName, serial, now, now + validityDays * 86400, true, nullptr, key, error)) return false;
+
+    GnutlsDatum keyPem;
+    GnutlsDatum certificatePem;
+    int result = gnutls_x509_privkey_export2(key.key, GNUTLS_X509_FMT_PEM, &keyPem.datum);
+    if (result == GNUTLS_E_SUCCESS) result = gnutls_x509_crt_export2(certificate.certificate, GNUTLS_X509_FMT_PEM, &certificatePem.datum);
+    if (result != GNUTLS_E_SUCCESS) {
+      error = "Could not export CA: " + std::string(gnutls_strerror(result));
+      return false;
+    }
+
+    //The certificate is written first, so "exists()" is only true when both files are there.
+    if (!writeFile(_path + "cacert.pem", certificatePem.toString(), 0644, error)) return false;
+    if (!writeFile(_path + "private/cakey.pem", keyPem.toString(), 0400, error)) return false;
+    if (chown((_path + "private/cakey.pem").c_str(), 0, 0) == -1) GD::out.printWarning("Warning: Could not change owner of CA key: " + std::string(strerror(errno)));
+    return true;
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+    error = ex.what();
+  }
+  return false;
+}
+
+bool CertificateAuthority::commonNameExists(const std::string &commonName) {
+  std::lock_guard<std::mutex> caGuard(_mutex);
+  loadIndex();
+  return _commonNames.find(commonName) != _commonNames.end();
+}
+
+bool CertificateAuthority::createCertificate(const std::string &commonName, const std::string &filename, const std::string &keyOwner, CertificateKeyPool::KeyType keyType, std::string &error) {
+  try {
+    std::lock_guard<std::mutex> caGuard(_mutex);
+    loadIndex();
+    if (_commonNames.find(commonName) != _commonNames.end()) {
+      error = "A certificate with this common name already exists.";
+      return false;
+    }
+
+    Certificate caCertificate;
+    PrivateKey caKey;
+    {
+      GnutlsDatum data;
+      if (!importFile(_path + "cacert.pem", data, error)) return false;
+      int result = gnutls_x509_crt_import(caCertificate.certificate, &data.datum, GNUTLS_X509_FMT_PEM);
+      if (result != GNUTLS_E_SUCCESS) {
+        error = "Could not import CA certificate: " + std::string(gnutls_strerror(result));
+        return false;
+      }
+    }
+    {
+      GnutlsDatum data;
+      if (!importFile(_path + "private/cakey.pem", data, error)) return false;
+      //Accepts PKCS #1 ("openssl genrsa" before OpenSSL 3) and PKCS #8.
+      int result = gnutls_x509_privkey_import2(caKey.key, &data.datum, GNUTLS_X509_FMT_PEM, nullptr, GNUTLS_PKCS_PLAIN);
+      if (result != GNUTLS_E_SUCCESS) {
+        error = "Could not import CA key: " + std::string(gnutls_strerror(result));
+        return false;
+      }
+    }
+
+    //The serial file contains the next serial number in hexadecimal.
+    std::string serialHex = BaseLib::Io::getFileContent(_path + "serial");
+    BaseLib::HelperFunctions::trim(serialHex);
+    if (serialHex.empty() || serialHex.size() > 15 || serialHex.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos) {
+      error = "Invalid serial file.";
+      return false;
+    }
+    uint64_t serial = std::stoull(serialHex, nullptr, 16);
+    serialHex = getSerialHex(serial);
+    std::vector<uint8_t> serialBytes;
+    for (uint64_t value = serial; value > 0; value >>= 8) {
+      serialBytes.insert(serialBytes.begin(), (uint8_t)(value & 0xFF));
+    }
+    //Serial numbers are positive integers in DER.
+    if (serialBytes.empty() || (serialBytes.front() & 0x80)) serialBytes.insert(serialBytes.begin(), 0);
+
+    std::string keyPem;
+    if (!_keyPool.take(keyType, keyPem) && !CertificateKeyPool::generateKey(keyType, keyPem, error)) return false;
+    PrivateKey key;
+    {
+      gnutls_datum_t data{(unsigned char *)&keyPem[0], (unsigned int)keyPem.size()};
+      int result = gnutls_x509_privkey_import2(key.key, &data, GNUTLS_X509_FMT_PEM, nullptr, GNUTLS_PKCS_PLAIN);
+      if (result != GNUTLS_E_SUCCESS) {
+        error = "Could not import key: " + std::string(gnutls_strerror(result));
+        return false;
+      }
+    }
+
+    Certificate certificate;
+    int64_t now = BaseLib::HelperFunctions::getTimeSeconds();
+    int64_t expirationTime = now + validityDays * 86400;
+    if (!signCertificate(certificate, key, commonName, serialBytes, now, expirationTime, false, &caCertificate, caKey, error)) return false;
+
+    GnutlsDatum certificatePem;
+    int result = gnutls_x509_crt_export2(certificate.certificate, GNUTLS_X509_FMT_PEM, &certificatePem.datum);
+    if (result != GNUTLS_E_SUCCESS) {
+      error = "Could not export certificate: " + std::string(gnutls_strerror(result));
+      return false;
+    }
+
+    auto keyFilename = _path + "private/" + filename + ".key";
+    if (!writeFile(keyFilename, keyPem, 0440, error)) return false;
+    auto userId = GD::bl->hf.userId(keyOwner);
+    auto groupId = GD::bl->hf.groupId(keyOwner);
+    if ((int32_t)userId != -1 && (int32_t)groupId != -1 && chown(keyFilename.c_str(), userId, groupId) == -1) {
+      GD::out.printWarning("Warning: Could not change owner of " + keyFilename + ": " + std::string(strerror(errno)));
+    }
+    if (!writeFile(_path + "newcerts/" + serialHex + ".pem", certificatePem.toString(), 0644, error)) return false;
+    if (!writeFile(_path + "certs/" + filename + ".crt", certificatePem.toString(), 0644, error)) return false;
+
+    if (!writeFile(_path + "serial", getSerialHex(serial + 1) + "\n", 0644, error)) return false;
+
+    auto indexLine = "V\t" + getIndexTime(expirationTime) + "\t\t" + serialHex + "\tunknown\t/C=HG/ST=HG/L=HG/O=HG/CN=" + commonName + "\n";
+    if (!writeFile(_path + "index.txt", BaseLib::Io::getFileContent(_path + "index.txt") + indexLine, 0644, error)) return false;
+    _commonNames.emplace(commonName);
+    //Our own change doesn't need to be read again.
+    struct stat statStruct{};
+    if (stat((_path + "index.txt").c_str(), &statStruct) == 0) {
+      _indexInode = statStruct.st_ino;
+      _indexModificationTime = (int64_t)statStruct.st_mtim.tv_sec * 1000000000 + statStruct.st_mtim.tv_nsec;
+    }
+    return true;
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+    error = ex.what();
+  }
+  return false;
+}
+
+int32_t CertificateAuthority::deleteCertificate(const std::string &commonName, const std::string &filename) {
+  try {
+    std::lock_guard<std::mutex> caGuard(_mutex);
+    loadIndex();
+
+    auto certificateFilename = _path + "certs/" + filename + ".crt";
+    auto keyFilename = _path + "private/" + filename + ".key";
+    bool inIndex = _commonNames.find(commonName) != _commonNames.end();
+    if (!inIndex && !BaseLib::Io::fileExists(certificateFilename) && !BaseLib::Io::fileExists(keyFilename)) return 1;
+
+    if (inIndex) {
+      std::string content;
+      auto lines = BaseLib::HelperFunctions::splitAll(BaseLib::Io::getFileContent(_path + "index.txt"), '\n');
+      for (auto &line: lines) {
+        if (line.empty() || getCommonName(line) == commonName) continue;
+        content.append(line);
+        content.push_back('\n');
+      }
+      std::string error;
+      if (!writeFile(_path + "index.txt", content, 0644, error)) {
+        GD::out.printError("Error: " + error);
+        return -1;
+      }
+      _commonNames.erase(commonName);
+      struct stat statStruct{};
+      if (stat((_path + "index.txt").c_str(), &statStruct) == 0) {
+        _indexInode = statStruct.st_ino;
+        _indexModificationTime = (int64_t)statStruct.st_mtim.tv_sec * 1000000000 + statStruct.st_mtim.tv_nsec;
+      }
+    }
+
+    unlink(certificateFilename.c_str());
+    unlink(keyFilename.c_str());
+    sync();
+
+    return BaseLib::Io::fileExists(certificateFilename) || BaseLib::Io::fileExists(keyFilename) ? -1 : 0;
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return -1;
+}
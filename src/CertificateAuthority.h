@@ -0,0 +1,96 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Homegear.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU Lesser General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+*/
+
+#ifndef CERTIFICATEAUTHORITY_H_
+#define CERTIFICATEAUTHORITY_H_
+
+#include <string>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+#include <sys/types.h>
+
+#include "CertificateKeyPool.h"
+
+/**
+ * Certificate authority in the directory layout of "openssl ca" (index.txt, serial, certs/, private/, newcerts/).
+ * Keys and certificates are created with GnuTLS, which needs to be initialized before. The common names in
+ * index.txt are kept in memory and only read again when the file was changed by someone else.
+ */
+class CertificateAuthority {
+ public:
+  CertificateAuthority(std::string path, CertificateKeyPool &keyPool);
+  virtual ~CertificateAuthority() = default;
+
+  bool exists();
+
+  /**
+   * Creates the directory structure, the CA key and the self-signed CA certificate.
+   *
+   * @param commonName The common name of the CA certificate.
+   * @param[out] error Set to a description of the error when false is returned.
+   */
+  bool create(const std::string &commonName, std::string &error);
+
+  bool commonNameExists(const std::string &commonName);
+
+  /**
+   * Creates a key in "private/<filename>.key" and a certificate signed by the CA in "certs/<filename>.crt". The key
+   * is taken from the key pool when it contains one of the requested type.
+   *
+   * @param keyOwner User the key file is given to. The key is readable by this user and its group only.
+   * @param[out] error Set to a description of the error when false is returned.
+   */
+  bool createCertificate(const std::string &commonName, const std::string &filename, const std::string &keyOwner, CertificateKeyPool::KeyType keyType, std::string &error);
+
+  /**
+   * Removes the certificate from index.txt and deletes its certificate and key files.
+   *
+   * @return Returns 1 when there is nothing to delete, 0 on success and -1 on error.
+   */
+  int32_t deleteCertificate(const std::string &commonName, const std::string &filename);
+ private:
+  static constexpr unsigned int caKeyBits = 4096;
+  static constexpr int64_t validityDays = 100000;
+
+  std::string _path;
+  CertificateKeyPool &_keyPool;
+  std::mutex _mutex;
+  std::unordered_set<std::string> _commonNames;
+  ino_t _indexInode = 0;
+  int64_t _indexModificationTime = -1;
+
+  void loadIndex();
+  bool writeFile(const std::string &filename, const std::string &content, mode_t mode, std::string &error);
+  static std::string getCommonName(const std::string &indexLine);
+  static std::string getIndexTime(int64_t time);
+};
+
+#endif
@@ -0,0 +1,318 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Homegear.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU Lesser General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+*/
+
+#include "CertificateKeyPool.h"
+#include "GD.h"
+
+#include <gnutls/gnutls.h>
+#include <gnutls/x509.h>
+#include <gnutls/crypto.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+namespace {
+
+constexpr size_t nonceSize = 12;
+constexpr size_t tagSize = 16;
+
+}
+
+bool CertificateKeyPool::getKeyType(const std::string &name, KeyType &type) {
+  if (name == "rsa4096") type = KeyType::rsa4096;
+  else if (name == "ecp256") type = KeyType::ecp256;
+  else if (name == "ed25519") type = KeyType::ed25519;
+  else return false;
+  return true;
+}
+
+std::string CertificateKeyPool::getKeyTypeName(KeyType type) {
+  switch (type) {
+    case KeyType::rsa4096: return "rsa4096";
+    case KeyType::ecp256: return "ecp256";
+    case KeyType::ed25519: return "ed25519";
+  }
+  return "";
+}
+
+bool CertificateKeyPool::generateKey(KeyType type, std::string &pem, std::string &error) {
+  gnutls_x509_privkey_t key = nullptr;
+  int result = gnutls_x509_privkey_init(&key);
+  if (result == GNUTLS_E_SUCCESS) {
+    switch (type) {
+      case KeyType::rsa4096: result = gnutls_x509_privkey_generate(key, GNUTLS_PK_RSA, 4096, 0);
+        break;
+      case KeyType::ecp256: result = gnutls_x509_privkey_generate(key, GNUTLS_PK_ECDSA, GNUTLS_CURVE_TO_BITS(GNUTLS_ECC_CURVE_SECP256R1), 0);
+        break;
+      case KeyType::ed25519: result = gnutls_x509_privkey_generate(key, GNUTLS_PK_EDDSA_ED25519, GNUTLS_CURVE_TO_BITS(GNUTLS_ECC_CURVE_ED25519), 0);
+        break;
+    }
+  }
+  gnutls_datum_t data{nullptr, 0};
+  //PKCS #8, the traditional formats don't exist for all key types.
+  if (result == GNUTLS_E_SUCCESS) result = gnutls_x509_privkey_export2_pkcs8(key, GNUTLS_X509_FMT_PEM, nullptr, GNUTLS_PKCS_PLAIN, &data);
+  if (key) gnutls_x509_privkey_deinit(key);
+  if (result != GNUTLS_E_SUCCESS) {
+    error = "Could not generate key: " + std::string(gnutls_strerror(result));
+    return false;
+  }
+  pem.assign((char *)data.data, data.size);
+  gnutls_free(data.data);
+  return true;
+}
+
+CertificateKeyPool::CertificateKeyPool(std::string caPath) : _caPath(std::move(caPath)) {
+  _poolPath = _caPath + "private/pool/";
+}
+
+CertificateKeyPool::~CertificateKeyPool() {
+  stop();
+}
+
+bool CertificateKeyPool::start(std::function<void(bool readOnly)> setRootReadOnly) {
+  try {
+    stop();
+    _setRootReadOnly = std::move(setRootReadOnly);
+    _stopThread = false;
+    _notified = true;
+    _thread = std::thread(&CertificateKeyPool::poolThread, this);
+    return true;
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return false;
+}
+
+void CertificateKeyPool::stop() {
+  {
+    std::lock_guard<std::mutex> threadGuard(_threadMutex);
+    _stopThread = true;
+  }
+  _conditionVariable.notify_all();
+  if (_thread.joinable()) _thread.join();
+}
+
+void CertificateKeyPool::notify() {
+  {
+    std::lock_guard<std::mutex> threadGuard(_threadMutex);
+    _notified = true;
+  }
+  _conditionVariable.notify_all();
+}
+
+std::vector<std::string> CertificateKeyPool::getPoolFiles(KeyType type) {
+  std::vector<std::string> poolFiles;
+  if (!BaseLib::Io::directoryExists(_poolPath)) return poolFiles;
+  auto prefix = getKeyTypeName(type) + "-";
+  for (auto &file: BaseLib::Io::getFiles(_poolPath, false)) {
+    if (file.compare(0, prefix.size(), prefix) == 0 && file.size() > 4 && file.compare(file.size() - 4, 4, ".key") == 0) poolFiles.push_back(file);
+  }
+  return poolFiles;
+}
+
+void CertificateKeyPool::removeOtherKeyTypes(KeyType type) {
+  std::lock_guard<std::mutex> fileGuard(_fileMutex);
+  if (!BaseLib::Io::directoryExists(_poolPath)) return;
+  auto prefix = getKeyTypeName(type) + "-";
+  std::vector<std::string> files;
+  for (auto &file: BaseLib::Io::getFiles(_poolPath, false)) {
+    if (file.compare(0, prefix.size(), prefix) != 0) files.push_back(file);
+  }
+  if (files.empty()) return;
+
+  _setRootReadOnly(false);
+  for (auto &file: files) {
+    if (unlink((_poolPath + file).c_str()) == -1) GD::out.printWarning("Warning: Could not delete " + _poolPath + file + ": " + std::string(strerror(errno)));
+  }
+  _setRootReadOnly(true);
+}
+
+bool CertificateKeyPool::getEncryptionKey(std::vector<uint8_t> &encryptionKey) {
+  auto caKey = BaseLib::Io::getFileContent(_caPath + "private/cakey.pem");
+  if (caKey.empty()) return false;
+  static const std::string label = "homegear-management certificate key pool";
+  encryptionKey.resize(32);
+  return gnutls_hmac_fast(GNUTLS_MAC_SHA256, caKey.data(), caKey.size(), label.data(), label.size(), encryptionKey.data()) == GNUTLS_E_SUCCESS;
+}
+
+bool CertificateKeyPool::encrypt(KeyType type, const std::string &pem, std::string &encryptedKey) {
+  std::vector<uint8_t> encryptionKey;
+  if (!getEncryptionKey(encryptionKey)) return false;
+  gnutls_datum_t keyDatum{encryptionKey.data(), (unsigned int)encryptionKey.size()};
+  gnutls_aead_cipher_hd_t handle = nullptr;
+  if (gnutls_aead_cipher_init(&handle, GNUTLS_CIPHER_AES_256_GCM, &keyDatum) != GNUTLS_E_SUCCESS) return false;
+
+  //Format: <nonce><ciphertext><tag>. The key type is authenticated, so a key can't be used as a different type.
+  auto typeName = getKeyTypeName(type);
+  encryptedKey.resize(nonceSize + pem.size() + tagSize);
+  gnutls_rnd(GNUTLS_RND_NONCE, &encryptedKey[0], nonceSize);
+  size_t encryptedSize = encryptedKey.size() - nonceSize;
+  int result = gnutls_aead_cipher_encrypt(handle, &encryptedKey[0], nonceSize, typeName.data(), typeName.size(), tagSize, pem.data(), pem.size(), &encryptedKey[nonceSize], &encryptedSize);
+  gnutls_aead_cipher_deinit(handle);
+  return result == GNUTLS_E_SUCCESS;
+}
+
+bool CertificateKeyPool::decrypt(KeyType type, const std::string &encryptedKey, std::string &pem) {
+  if (encryptedKey.size() <= nonceSize + tagSize) return false;
+  std::vector<uint8_t> encryptionKey;
+  if (!getEncryptionKey(encryptionKey)) return false;
+  gnutls_datum_t keyDatum{encryptionKey.data(), (unsigned int)encryptionKey.size()};
+  gnutls_aead_cipher_hd_t handle = nullptr;
+  if (gnutls_aead_cipher_init(&handle, GNUTLS_CIPHER_AES_256_GCM, &keyDatum) != GNUTLS_E_SUCCESS) return false;
+
+  auto typeName = getKeyTypeName(type);
+  pem.resize(encryptedKey.size() - nonceSize - tagSize);
+  size_t pemSize = pem.size();
+  int result = gnutls_aead_cipher_decrypt(handle, encryptedKey.data(), nonceSize, typeName.data(), typeName.size(), tagSize, encryptedKey.data() + nonceSize, encryptedKey.size() - nonceSize, &pem[0], &pemSize);
+  gnutls_aead_cipher_deinit(handle);
+  if (result != GNUTLS_E_SUCCESS) {
+    pem.clear();
+    return false;
+  }
+  pem.resize(pemSize);
+  return true;
+}
+
+bool CertificateKeyPool::writeFile(const std::string &filename, const std::string &content) {
+  auto tempFilename = filename + ".tmp";
+  int fd = open(tempFilename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0400);
+  if (fd == -1) {
+    GD::out.printError("Error: Could not create " + tempFilename + ": " + std::string(strerror(errno)));
+    return false;
+  }
+
+  size_t bytesWritten = 0;
+  while (bytesWritten < content.size()) {
+    auto result = write(fd, content.data() + bytesWritten, content.size() - bytesWritten);
+    if (result == -1) {
+      if (errno == EINTR) continue;
+      GD::out.printError("Error: Could not write " + tempFilename + ": " + std::string(strerror(errno)));
+      close(fd);
+      unlink(tempFilename.c_str());
+      return false;
+    }
+    bytesWritten += (size_t)result;
+  }
+  if (fsync(fd) == -1 || close(fd) == -1 || rename(tempFilename.c_str(), filename.c_str()) == -1) {
+    GD::out.printError("Error: Could not write " + filename + ": " + std::string(strerror(errno)));
+    unlink(tempFilename.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool CertificateKeyPool::take(KeyType type, std::string &pem) {
+  try {
+    std::lock_guard<std::mutex> fileGuard(_fileMutex);
+    bool found = false;
+    for (auto &file: getPoolFiles(type)) {
+      auto encryptedKey = BaseLib::Io::getFileContent(_poolPath + file);
+      //Keys which can't be decrypted belong to a replaced CA and are removed, too.
+      found = decrypt(type, encryptedKey, pem);
+      unlink((_poolPath + file).c_str());
+      if (found) break;
+    }
+    notify();
+    return found;
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return false;
+}
+
+void CertificateKeyPool::poolThread() {
+  //Lowest priority, but not SCHED_IDLE: A starved thread would block the shutdown in the middle of a key generation,
+  //which can't be interrupted.
+  setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 19);
+
+  while (true) {
+    {
+      std::unique_lock<std::mutex> threadGuard(_threadMutex);
+      _conditionVariable.wait_for(threadGuard, std::chrono::seconds(60), [&] { return _stopThread || _notified; });
+      if (_stopThread) return;
+      _notified = false;
+    }
+
+    try {
+      auto settings = GD::settings.snapshot();
+      KeyType type = KeyType::rsa4096;
+      if (settings->certificateKeyPoolSize == 0 || !getKeyType(settings->certificateKeyType, type)) continue;
+      removeOtherKeyTypes(type);
+      if (!BaseLib::Io::fileExists(_caPath + "private/cakey.pem")) continue;
+
+      size_t keyCount = 0;
+      {
+        std::lock_guard<std::mutex> fileGuard(_fileMutex);
+        keyCount = getPoolFiles(type).size();
+      }
+
+      while (keyCount < settings->certificateKeyPoolSize) {
+        {
+          std::lock_guard<std::mutex> threadGuard(_threadMutex);
+          if (_stopThread) return;
+        }
+
+        std::string pem;
+        std::string error;
+        if (!generateKey(type, pem, error)) {
+          GD::out.printError("Error: " + error);
+          break;
+        }
+        std::string encryptedKey;
+        if (!encrypt(type, pem, encryptedKey)) {
+          GD::out.printError("Error: Could not encrypt pooled key.");
+          break;
+        }
+
+        std::vector<uint8_t> nameBytes(8);
+        gnutls_rnd(GNUTLS_RND_NONCE, nameBytes.data(), nameBytes.size());
+        bool written = false;
+        {
+          std::lock_guard<std::mutex> fileGuard(_fileMutex);
+          _setRootReadOnly(false);
+          if (mkdir(_poolPath.c_str(), 0700) == -1 && errno != EEXIST) {
+            GD::out.printError("Error: Could not create directory " + _poolPath + ": " + std::string(strerror(errno)));
+          } else written = writeFile(_poolPath + getKeyTypeName(type) + "-" + BaseLib::HelperFunctions::getHexString(nameBytes) + ".key", encryptedKey);
+          _setRootReadOnly(true);
+        }
+        if (!written) break;
+        keyCount++;
+      }
+    }
+    catch (const std::exception &ex) {
+      GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+    }
+  }
+}
@@ -0,0 +1,120 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Homegear.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU Lesser General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+*/
+
+#ifndef CERTIFICATEKEYPOOL_H_
+#define CERTIFICATEKEYPOOL_H_
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+
+/**
+ * Generates private keys for certificates in the background, so issuing a certificate only needs to sign. The thread
+ * runs at nice 19 and fills the pool up to "certificateKeyPoolSize" keys of type "certificateKeyType".
+ *
+ * Pooled keys are stored in "<CA path>private/pool/", encrypted with AES-256-GCM. The encryption key is derived from
+ * the CA key, so the pool is invalidated when the CA is replaced.
+ */
+class CertificateKeyPool {
+ public:
+  enum class KeyType {
+    rsa4096,
+    ecp256,
+    ed25519
+  };
+
+  /**
+   * @param name One of "rsa4096", "ecp256" or "ed25519".
+   * @return Returns false when the name is unknown.
+   */
+  static bool getKeyType(const std::string &name, KeyType &type);
+  static std::string getKeyTypeName(KeyType type);
+
+  /**
+   * Generates a key in the calling thread.
+   *
+   * @param[out] pem The unencrypted key in PEM format.
+   * @param[out] error Set to a description of the error when false is returned.
+   */
+  static bool generateKey(KeyType type, std::string &pem, std::string &error);
+
+  explicit CertificateKeyPool(std::string caPath);
+  virtual ~CertificateKeyPool();
+
+  /**
+   * @param setRootReadOnly Called around writes to the pool directory.
+   */
+  bool start(std::function<void(bool readOnly)> setRootReadOnly);
+
+  /**
+   * Waits for a running key generation to finish.
+   */
+  void stop();
+
+  /**
+   * Wakes the thread, e. g. after the CA was created.
+   */
+  void notify();
+
+  /**
+   * Removes a key of the given type from the pool. The root file system needs to be writable.
+   *
+   * @param[out] pem The unencrypted key in PEM format.
+   * @return Returns false when the pool contains no usable key of this type.
+   */
+  bool take(KeyType type, std::string &pem);
+ private:
+  std::string _caPath;
+  std::string _poolPath;
+  std::function<void(bool readOnly)> _setRootReadOnly;
+  std::mutex _fileMutex; //Serializes access to the pool directory.
+  std::mutex _threadMutex;
+  std::condition_variable _conditionVariable;
+  bool _stopThread = true;
+  bool _notified = false;
+  std::thread _thread;
+
+  void poolThread();
+  std::vector<std::string> getPoolFiles(KeyType type);
+
+  /**
+   * Deletes pooled keys of other types, e. g. after "certificateKeyType" was changed.
+   */
+  void removeOtherKeyTypes(KeyType type);
+  bool getEncryptionKey(std::vector<uint8_t> &encryptionKey);
+  bool encrypt(KeyType type, const std::string &pem, std::string &encryptedKey);
+  bool decrypt(KeyType type, const std::string &encryptedKey, std::string &pem);
+  bool writeFile(const std::string &filename, const std::string &content);
+};
+
+#endif
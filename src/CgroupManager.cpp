@@ -0,0 +1,281 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Homegear.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU Lesser General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+*/
+
+#include "CgroupManager.h"
+#include "GD.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+bool CgroupManager::init() {
+  try {
+    _enabled = false;
+    if (!GD::settings.enableCgroups()) return false;
+
+    if (!BaseLib::Io::fileExists("/sys/fs/cgroup/cgroup.controllers")) {
+      GD::out.printInfo("Info: cgroup v2 is not available. Commands are executed without resource limits.");
+      return false;
+    }
+
+    std::string ownCgroup;
+    {
+      //Format is "0::/system.slice/homegear-management.service" for cgroup v2.
+      auto lines = BaseLib::HelperFunctions::splitAll(readFile("/proc/self/cgroup"), '\n');
+      for (auto &line: lines) {
+        if (line.compare(0, 3, "0::") == 0) {
+          ownCgroup = "/sys/fs/cgroup" + line.substr(3);
+          break;
+        }
+      }
+      while (!ownCgroup.empty() && ownCgroup.back() == '/') ownCgroup.pop_back();
+    }
+
+    _path = GD::settings.cgroupPath().empty() ? ownCgroup : GD::settings.cgroupPath();
+    if (_path.empty() || _path == "/sys/fs/cgroup") {
+      GD::out.printInfo("Info: No cgroup to place commands in. Commands are executed without resource limits.");
+      return false;
+    }
+
+    if (!BaseLib::Io::directoryExists(_path) && mkdir(_path.c_str(), 0755) == -1) {
+      GD::out.printWarning("Warning: Could not create cgroup " + _path + ": " + std::string(strerror(errno)));
+      return false;
+    }
+
+    //cgroup v2 only allows processes in leaves, so move everything in our cgroup to a leaf before enabling controllers.
+    auto managementCgroup = _path + "/management";
+    if (!BaseLib::Io::directoryExists(managementCgroup) && mkdir(managementCgroup.c_str(), 0755) == -1) {
+      GD::out.printWarning("Warning: Could not create cgroup " + managementCgroup + ": " + std::string(strerror(errno)));
+      return false;
+    }
+    auto pids = BaseLib::HelperFunctions::splitAll(readFile(_path + "/cgroup.procs"), '\n');
+    for (auto &pid: pids) {
+      BaseLib::HelperFunctions::trim(pid);
+      if (pid.empty()) continue;
+      if (!writeFile(managementCgroup + "/cgroup.procs", pid)) {
+        GD::out.printWarning("Warning: Could not move process " + pid + " to cgroup " + managementCgroup + ". Is the cgroup delegated?");
+        return false;
+      }
+    }
+
+    auto availableControllers = BaseLib::HelperFunctions::splitAll(readFile(_path + "/cgroup.controllers"), ' ');
+    _controllers.clear();
+    for (auto &controller: availableControllers) {
+      BaseLib::HelperFunctions::trim(controller);
+      if (controller == "cpu" || controller == "memory" || controller == "io") _controllers.append((_controllers.empty() ? "+" : " +") + controller);
+    }
+    if (!_controllers.empty() && !writeFile(_path + "/cgroup.subtree_control", _controllers)) {
+      GD::out.printWarning("Warning: Could not enable cgroup controllers in " + _path + ". Only CPU time is accounted for.");
+      _controllers.clear();
+    }
+
+    {
+      std::lock_guard<std::mutex> cgroupsGuard(_cgroupsMutex);
+      _classCgroups.clear();
+      _staleCgroups.clear();
+
+      //Collect command cgroups left over from a previous run.
+      for (auto &commandClass: BaseLib::Io::getDirectories(_path + "/", false)) {
+        while (!commandClass.empty() && commandClass.back() == '/') commandClass.pop_back();
+        if (commandClass == "management") continue;
+        for (auto &command: BaseLib::Io::getDirectories(_path + "/" + commandClass + "/", false)) {
+          while (!command.empty() && command.back() == '/') command.pop_back();
+          if (command.compare(0, 8, "command-") == 0) _staleCgroups.emplace(_path + "/" + commandClass + "/" + command);
+        }
+      }
+    }
+    cleanUp();
+
+    _enabled = true;
+    GD::out.printInfo("Info: Executing commands in cgroups below " + _path + ".");
+    return true;
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return false;
+}
+
+std::string CgroupManager::readFile(const std::string &filename) {
+  int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) return "";
+
+  std::string content;
+  char buffer[4096];
+  while (true) {
+    auto bytesRead = read(fd, buffer, sizeof(buffer));
+    if (bytesRead == -1 && errno == EINTR) continue;
+    if (bytesRead <= 0) break;
+    content.append(buffer, (size_t)bytesRead);
+  }
+  close(fd);
+  return content;
+}
+
+bool CgroupManager::writeFile(const std::string &filename, const std::string &content) {
+  int fd = open(filename.c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd == -1) return false;
+
+  ssize_t bytesWritten;
+  do {
+    bytesWritten = write(fd, content.data(), content.size());
+  } while (bytesWritten == -1 && errno == EINTR);
+  close(fd);
+  return bytesWritten == (ssize_t)content.size();
+}
+
+bool CgroupManager::createClassCgroup(const std::string &commandClass) {
+  //Called with _cgroupsMutex locked.
+  if (_classCgroups.find(commandClass) != _classCgroups.end()) return true;
+
+  auto path = _path + "/" + commandClass;
+  if (mkdir(path.c_str(), 0755) == -1 && errno != EEXIST) {
+    GD::out.printWarning("Warning: Could not create cgroup " + path + ": " + std::string(strerror(errno)));
+    return false;
+  }
+
+  //The command leaves need the controllers as well for accounting of memory and IO.
+  if (!_controllers.empty() && !writeFile(path + "/cgroup.subtree_control", _controllers)) {
+    GD::out.printWarning("Warning: Could not enable cgroup controllers in " + path + ".");
+  }
+
+  auto snapshot = GD::settings.snapshot();
+  auto &commandCgroups = snapshot->commandCgroups;
+  auto limitsIterator = commandCgroups.find(commandClass);
+  if (limitsIterator != commandCgroups.end()) {
+    auto &limits = limitsIterator->second;
+    if (limits.cpuWeight > 0 && !writeFile(path + "/cpu.weight", std::to_string(limits.cpuWeight))) {
+      GD::out.printWarning("Warning: Could not set cpu.weight of cgroup " + path + ".");
+    }
+    if (!writeFile(path + "/memory.max", limits.memoryMax > 0 ? std::to_string(limits.memoryMax) : "max") && limits.memoryMax > 0) {
+      GD::out.printWarning("Warning: Could not set memory.max of cgroup " + path + ".");
+    }
+    if (limits.ioWeight > 0 && !writeFile(path + "/io.weight", "default " + std::to_string(limits.ioWeight))) {
+      GD::out.printWarning("Warning: Could not set io.weight of cgroup " + path + ".");
+    }
+  }
+
+  _classCgroups.emplace(commandClass);
+  return true;
+}
+
+std::string CgroupManager::createCommandCgroup(const std::string &commandClass, int32_t commandId) {
+  try {
+    if (!_enabled) return "";
+
+    std::lock_guard<std::mutex> cgroupsGuard(_cgroupsMutex);
+    if (!createClassCgroup(commandClass)) return "";
+
+    auto path = _path + "/" + commandClass + "/command-" + std::to_string(commandId);
+    if (mkdir(path.c_str(), 0755) == -1 && errno != EEXIST) {
+      GD::out.printWarning("Warning: Could not create cgroup " + path + ": " + std::string(strerror(errno)));
+      return "";
+    }
+    _staleCgroups.erase(path);
+    return path;
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return "";
+}
+
+int CgroupManager::openProcs(const std::string &cgroupPath) {
+  if (cgroupPath.empty()) return -1;
+  int fd = open((cgroupPath + "/cgroup.procs").c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd == -1) GD::out.printWarning("Warning: Could not open " + cgroupPath + "/cgroup.procs: " + std::string(strerror(errno)));
+  return fd;
+}
+
+CgroupManager::ResourceUsage CgroupManager::getResourceUsage(const std::string &cgroupPath) {
+  ResourceUsage resourceUsage;
+  try {
+    if (cgroupPath.empty()) return resourceUsage;
+
+    //Format: "usage_usec 1234\nuser_usec 1000\n..."
+    auto lines = BaseLib::HelperFunctions::splitAll(readFile(cgroupPath + "/cpu.stat"), '\n');
+    for (auto &line: lines) {
+      auto pair = BaseLib::HelperFunctions::splitFirst(line, ' ');
+      if (pair.first == "usage_usec") {
+        resourceUsage.cpuTime = BaseLib::Math::getNumber64(pair.second);
+        break;
+      }
+    }
+
+    //Available since Linux 5.19.
+    auto peakMemory = readFile(cgroupPath + "/memory.peak");
+    if (!peakMemory.empty()) resourceUsage.peakMemory = BaseLib::Math::getNumber64(BaseLib::HelperFunctions::trim(peakMemory));
+
+    //Format: "8:0 rbytes=1234 wbytes=5678 rios=1 wios=2 dbytes=0 dios=0" per device.
+    if (BaseLib::Io::fileExists(cgroupPath + "/io.stat")) {
+      resourceUsage.ioReadBytes = 0;
+      resourceUsage.ioWriteBytes = 0;
+      lines = BaseLib::HelperFunctions::splitAll(readFile(cgroupPath + "/io.stat"), '\n');
+      for (auto &line: lines) {
+        auto fields = BaseLib::HelperFunctions::splitAll(line, ' ');
+        for (auto &field: fields) {
+          auto pair = BaseLib::HelperFunctions::splitFirst(field, '=');
+          if (pair.first == "rbytes") resourceUsage.ioReadBytes += BaseLib::Math::getNumber64(pair.second);
+          else if (pair.first == "wbytes") resourceUsage.ioWriteBytes += BaseLib::Math::getNumber64(pair.second);
+        }
+      }
+    }
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return resourceUsage;
+}
+
+void CgroupManager::removeCommandCgroup(const std::string &cgroupPath) {
+  try {
+    if (cgroupPath.empty()) return;
+    if (rmdir(cgroupPath.c_str()) == 0 || errno == ENOENT) return;
+
+    //Still populated, e.g. by a background process started by the command.
+    std::lock_guard<std::mutex> cgroupsGuard(_cgroupsMutex);
+    _staleCgroups.emplace(cgroupPath);
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+}
+
+void CgroupManager::cleanUp() {
+  try {
+    std::lock_guard<std::mutex> cgroupsGuard(_cgroupsMutex);
+    for (auto cgroupIterator = _staleCgroups.begin(); cgroupIterator != _staleCgroups.end();) {
+      if (rmdir(cgroupIterator->c_str()) == 0 || errno == ENOENT) cgroupIterator = _staleCgroups.erase(cgroupIterator);
+      else ++cgroupIterator;
+    }
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+}
@@ -0,0 +1,104 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Homegear.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU Lesser General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+*/
+
+#ifndef CGROUPMANAGER_H_
+#define CGROUPMANAGER_H_
+
+#include <string>
+#include <mutex>
+#include <unordered_set>
+
+/**
+ * Places commands in cgroup v2 leaves below a delegated cgroup, so their CPU, memory and IO usage can be limited and
+ * accounted for per command class. The hierarchy looks like this:
+ *
+ *   <cgroupPath>/management          Homegear Management itself
+ *   <cgroupPath>/<class>             Limits from "commandCgroup" in management.conf
+ *   <cgroupPath>/<class>/command-<id>  One leaf per command
+ */
+class CgroupManager {
+ public:
+  struct ResourceUsage {
+    int64_t cpuTime = -1; //In microseconds.
+    int64_t peakMemory = -1;
+    int64_t ioReadBytes = -1;
+    int64_t ioWriteBytes = -1;
+  };
+
+  CgroupManager() = default;
+  virtual ~CgroupManager() = default;
+
+  /**
+   * Sets up the hierarchy. When this fails, commands run without cgroups.
+   */
+  bool init();
+
+  bool enabled() const { return _enabled; }
+
+  /**
+   * Creates the leaf cgroup for a command.
+   *
+   * @return Returns the path of the cgroup or an empty string on error.
+   */
+  std::string createCommandCgroup(const std::string &commandClass, int32_t commandId);
+
+  /**
+   * Opens "cgroup.procs" of a cgroup for writing. A child process joins the cgroup by writing "0" to the returned file
+   * descriptor before calling exec().
+   *
+   * @return Returns the file descriptor or -1 on error.
+   */
+  static int openProcs(const std::string &cgroupPath);
+
+  static ResourceUsage getResourceUsage(const std::string &cgroupPath);
+
+  /**
+   * Removes a command cgroup. Cgroups still containing processes are removed by a later call to cleanUp().
+   */
+  void removeCommandCgroup(const std::string &cgroupPath);
+
+  /**
+   * Removes command cgroups which couldn't be removed before.
+   */
+  void cleanUp();
+ private:
+  bool _enabled = false;
+  std::string _path;
+  std::string _controllers;
+  std::mutex _cgroupsMutex;
+  std::unordered_set<std::string> _classCgroups;
+  std::unordered_set<std::string> _staleCgroups;
+
+  static std::string readFile(const std::string &filename);
+  static bool writeFile(const std::string &filename, const std::string &content);
+  bool createClassCgroup(const std::string &commandClass);
+};
+
+#endif
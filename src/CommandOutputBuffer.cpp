@@ -0,0 +1,136 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Homegear.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU Lesser General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+*/
+
+#include "CommandOutputBuffer.h"
+
+#include <cstring>
+#include <algorithm>
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+CommandOutputBuffer::CommandOutputBuffer(size_t capacity) : _capacity(capacity) {
+}
+
+CommandOutputBuffer::~CommandOutputBuffer() {
+  if (_spillFileDescriptor != -1) close(_spillFileDescriptor);
+  if (!_spillFile.empty()) unlink(_spillFile.c_str());
+}
+
+void CommandOutputBuffer::append(const char *data, size_t size) {
+  if (size == 0 || spilled()) return;
+  if (_capacity == 0) {
+    _end += size;
+    return;
+  }
+
+  if (size > _capacity) {
+    //Only the last "_capacity" bytes can be retained.
+    data += size - _capacity;
+    _end += size - _capacity;
+    size = _capacity;
+  }
+
+  //The buffer grows on demand, so short outputs don't allocate the full capacity.
+  if (_buffer.size() < _capacity && _end + size > _buffer.size()) {
+    _buffer.resize((size_t)std::min((uint64_t)_capacity, std::max((uint64_t)_buffer.size() * 2, _end + size)));
+  }
+
+  auto position = (size_t)(_end % _capacity);
+  auto firstPart = std::min(size, _capacity - position);
+  std::memcpy(_buffer.data() + position, data, firstPart);
+  if (firstPart < size) std::memcpy(_buffer.data(), data + firstPart, size - firstPart);
+  _end += size;
+}
+
+std::string CommandOutputBuffer::read(uint64_t cursor, uint64_t &nextCursor, bool &truncated) const {
+  nextCursor = _end;
+  truncated = cursor < begin();
+  if (truncated) cursor = begin();
+  if (cursor >= _end) return "";
+
+  auto size = (size_t)(_end - cursor);
+
+  if (spilled()) {
+    //The file contains the retained output starting at begin().
+    std::string output(size, 0);
+    size_t bytesRead = 0;
+    while (bytesRead < size) {
+      auto result = pread(_spillFileDescriptor, &output[bytesRead], size - bytesRead, (off_t)(cursor - begin() + bytesRead));
+      if (result == -1 && errno == EINTR) continue;
+      if (result <= 0) break;
+      bytesRead += (size_t)result;
+    }
+    output.resize(bytesRead);
+    return output;
+  }
+
+  auto position = (size_t)(cursor % _capacity);
+  auto firstPart = std::min(size, _capacity - position);
+
+  std::string output;
+  output.reserve(size);
+  output.append(_buffer.data() + position, firstPart);
+  if (firstPart < size) output.append(_buffer.data(), size - firstPart);
+  return output;
+}
+
+std::string CommandOutputBuffer::read() const {
+  uint64_t nextCursor = 0;
+  bool truncated = false;
+  return read(begin(), nextCursor, truncated);
+}
+
+bool CommandOutputBuffer::spill(const std::string &filename) {
+  if (spilled() || _capacity == 0) return false;
+
+  int fileDescriptor = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+  if (fileDescriptor == -1) return false;
+
+  auto output = read();
+  size_t bytesWritten = 0;
+  while (bytesWritten < output.size()) {
+    auto result = write(fileDescriptor, output.data() + bytesWritten, output.size() - bytesWritten);
+    if (result == -1 && errno == EINTR) continue;
+    if (result <= 0) {
+      close(fileDescriptor);
+      unlink(filename.c_str());
+      return false;
+    }
+    bytesWritten += (size_t)result;
+  }
+
+  _spillFile = filename;
+  _spillFileDescriptor = fileDescriptor;
+  std::vector<char>().swap(_buffer);
+  return true;
+}
@@ -0,0 +1,107 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Homegear.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU Lesser General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+*/
+
+#ifndef COMMANDOUTPUTBUFFER_H_
+#define COMMANDOUTPUTBUFFER_H_
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/**
+ * Ring buffer holding the most recent output of a command. Positions are absolute byte offsets since the command
+ * started, so clients can continue reading where they stopped even when older output has been overwritten.
+ *
+ * The class is not thread safe. Access is synchronized by CommandInfo::outputMutex.
+ */
+class CommandOutputBuffer {
+ public:
+  explicit CommandOutputBuffer(size_t capacity);
+  CommandOutputBuffer(const CommandOutputBuffer &) = delete;
+  CommandOutputBuffer &operator=(const CommandOutputBuffer &) = delete;
+  virtual ~CommandOutputBuffer();
+
+  void append(const char *data, size_t size);
+
+  /**
+   * Returns the retained output starting at the absolute offset "cursor".
+   *
+   * @param cursor The absolute offset to start reading at. When this data has already been overwritten, reading
+   * starts at the oldest retained byte.
+   * @param[out] nextCursor The cursor to pass to the next call to only get new output.
+   * @param[out] truncated Set to true when output between "cursor" and the returned data was overwritten.
+   */
+  std::string read(uint64_t cursor, uint64_t &nextCursor, bool &truncated) const;
+
+  /**
+   * Returns all retained output.
+   */
+  std::string read() const;
+
+  /**
+   * The absolute offset after the last byte written.
+   */
+  uint64_t end() const { return _end; }
+
+  /**
+   * The absolute offset of the oldest retained byte.
+   */
+  uint64_t begin() const { return _end - retained(); }
+
+  /**
+   * The number of retained bytes.
+   */
+  size_t size() const { return retained(); }
+
+  /**
+   * The number of bytes currently allocated in memory.
+   */
+  size_t memoryUsage() const { return _buffer.capacity(); }
+
+  /**
+   * Moves the retained output to "filename" and frees the memory. Subsequent reads are served from the file, which is
+   * deleted together with the buffer. Must only be called after the last call to append().
+   *
+   * @return Returns true on success. On failure the output stays in memory.
+   */
+  bool spill(const std::string &filename);
+
+  bool spilled() const { return !_spillFile.empty(); }
+ private:
+  size_t _capacity = 0;
+  uint64_t _end = 0;
+  std::vector<char> _buffer;
+  std::string _spillFile;
+  int _spillFileDescriptor = -1;
+
+  size_t retained() const { return _end < _capacity ? (size_t)_end : _capacity; }
+};
+
+#endif
@@ -0,0 +1,213 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Homegear.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU Lesser General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+*/
+
+#include "ConfigurationFiles.h"
+#include "GD.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+ConfigurationFiles::ConfigurationFiles(std::string path) : _path(std::move(path)) {
+}
+
+void ConfigurationFiles::getStamp(const struct stat &statStruct, FileStamp &stamp) {
+  stamp.inode = statStruct.st_ino;
+  stamp.size = statStruct.st_size;
+  stamp.modificationTime = (int64_t)statStruct.st_mtim.tv_sec * 1000000000 + statStruct.st_mtim.tv_nsec;
+}
+
+std::string ConfigurationFiles::getKey(const std::string &line) {
+  //Entries have the format "key = value". Comments and sections ("[...]") have no key.
+  size_t keyEnd = 0;
+  while (keyEnd < line.size() && line[keyEnd] != ' ' && line[keyEnd] != '\t' && line[keyEnd] != '=') keyEnd++;
+  if (keyEnd == 0 || keyEnd == line.size() || line[0] == '#' || line[0] == ';' || line[0] == '[') return "";
+  return line.substr(0, keyEnd);
+}
+
+std::string ConfigurationFiles::getValue(const std::string &line) {
+  auto separator = line.find('=');
+  if (separator == std::string::npos) return "";
+  std::string value = line.substr(separator + 1);
+  BaseLib::HelperFunctions::trim(value);
+  return value;
+}
+
+ConfigurationFiles::PParsedFile ConfigurationFiles::getFile(const std::string &filename) {
+  int fd = open((_path + filename).c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) return PParsedFile();
+
+  struct stat statStruct{};
+  if (fstat(fd, &statStruct) == -1 || !S_ISREG(statStruct.st_mode)) {
+    close(fd);
+    return PParsedFile();
+  }
+  FileStamp stamp;
+  getStamp(statStruct, stamp);
+
+  {
+    std::lock_guard<std::mutex> cacheGuard(_cacheMutex);
+    auto cacheIterator = _cache.find(filename);
+    if (cacheIterator != _cache.end() && cacheIterator->second.stamp == stamp) {
+      close(fd);
+      return cacheIterator->second.file;
+    }
+  }
+
+  std::string content;
+  content.reserve((size_t)statStruct.st_size);
+  char buffer[16384];
+  while (true) {
+    auto bytesRead = read(fd, buffer, sizeof(buffer));
+    if (bytesRead == -1 && errno == EINTR) continue;
+    if (bytesRead <= 0) break;
+    content.append(buffer, (size_t)bytesRead);
+  }
+  close(fd);
+
+  auto file = std::make_shared<ParsedFile>();
+  file->lines = BaseLib::HelperFunctions::splitAll(content, '\n');
+  //A trailing new line doesn't start another line.
+  if (!file->lines.empty() && file->lines.back().empty()) file->lines.pop_back();
+  for (size_t i = 0; i < file->lines.size(); i++) {
+    auto key = getKey(file->lines[i]);
+    if (!key.empty()) file->entries.emplace(key, i);
+  }
+
+  std::lock_guard<std::mutex> cacheGuard(_cacheMutex);
+  auto &cachedFile = _cache[filename];
+  cachedFile.stamp = stamp;
+  cachedFile.file = file;
+  return file;
+}
+
+ConfigurationFiles::Result ConfigurationFiles::get(const std::string &filename, const std::string &key, std::string &value) {
+  std::unordered_map<std::string, std::string> values;
+  auto result = get(filename, std::vector<std::string>{key}, values);
+  auto valueIterator = values.find(key);
+  if (valueIterator == values.end()) {
+    value.clear();
+    return result == Result::ok ? Result::entryNotFound : result;
+  }
+  value = valueIterator->second;
+  return result;
+}
+
+ConfigurationFiles::Result ConfigurationFiles::set(const std::string &filename, const std::string &key, const std::string &value) {
+  return set(filename, std::unordered_map<std::string, std::string>{{key, value}});
+}
+
+ConfigurationFiles::Result ConfigurationFiles::get(const std::string &filename, const std::vector<std::string> &keys, std::unordered_map<std::string, std::string> &values) {
+  try {
+    auto file = getFile(filename);
+    if (!file) return Result::fileNotFound;
+
+    for (auto &key: keys) {
+      auto entryIterator = file->entries.find(key);
+      if (entryIterator != file->entries.end()) values[key] = getValue(file->lines.at(entryIterator->second));
+    }
+    return Result::ok;
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return Result::error;
+}
+
+ConfigurationFiles::Result ConfigurationFiles::set(const std::string &filename, const std::unordered_map<std::string, std::string> &values) {
+  std::string tempFilename;
+  try {
+    std::lock_guard<std::mutex> writeGuard(_writeMutex);
+
+    auto file = getFile(filename);
+    if (!file) return Result::fileNotFound;
+    bool entryFound = false;
+    for (auto &value: values) {
+      if (file->entries.find(value.first) != file->entries.end()) {
+        entryFound = true;
+        break;
+      }
+    }
+    if (!entryFound) return Result::entryNotFound;
+
+    std::string content;
+    for (auto &line: file->lines) {
+      auto valueIterator = values.find(getKey(line));
+      if (valueIterator != values.end()) content.append(valueIterator->first + " = " + valueIterator->second);
+      else content.append(line);
+      content.push_back('\n');
+    }
+
+    auto fullPath = _path + filename;
+    struct stat statStruct{};
+    if (stat(fullPath.c_str(), &statStruct) == -1) return Result::fileNotFound;
+
+    tempFilename = fullPath + ".tmp" + std::to_string(getpid());
+    int fd = open(tempFilename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, statStruct.st_mode & 07777);
+    if (fd == -1) {
+      GD::out.printError("Error: Could not create " + tempFilename + ": " + std::string(strerror(errno)));
+      return Result::error;
+    }
+    //Keep owner and permissions of the original file. The mode passed to "open()" is subject to the umask.
+    if (fchown(fd, statStruct.st_uid, statStruct.st_gid) == -1 || fchmod(fd, statStruct.st_mode & 07777) == -1) {
+      GD::out.printWarning("Warning: Could not set owner or permissions of " + tempFilename + ": " + std::string(strerror(errno)));
+    }
+
+    size_t bytesWritten = 0;
+    while (bytesWritten < content.size()) {
+      auto result = write(fd, content.data() + bytesWritten, content.size() - bytesWritten);
+      if (result == -1) {
+        if (errno == EINTR) continue;
+        GD::out.printError("Error: Could not write " + tempFilename + ": " + std::string(strerror(errno)));
+        close(fd);
+        unlink(tempFilename.c_str());
+        return Result::error;
+      }
+      bytesWritten += (size_t)result;
+    }
+    if (fsync(fd) == -1 || close(fd) == -1) {
+      GD::out.printError("Error: Could not write " + tempFilename + ": " + std::string(strerror(errno)));
+      unlink(tempFilename.c_str());
+      return Result::error;
+    }
+
+    if (rename(tempFilename.c_str(), fullPath.c_str()) == -1) {
+      GD::out.printError("Error: Could not rename " + tempFilename + " to " + fullPath + ": " + std::string(strerror(errno)));
+      unlink(tempFilename.c_str());
+      return Result::error;
+    }
+    return Result::ok;
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  if (!tempFilename.empty()) unlink(tempFilename.c_str());
+  return Result::error;
+}
@@ -0,0 +1,110 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Homegear.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU Lesser General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+*/
+
+#ifndef CONFIGURATIONFILES_H_
+#define CONFIGURATIONFILES_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <sys/types.h>
+
+/**
+ * Reads and writes "key = value" entries of the configuration files in a directory (e.g. /etc/homegear/). Parsed files
+ * are cached until their inode, size or modification time changes. Files are written to a temporary file which is then
+ * renamed, so readers never see partially written files.
+ */
+class ConfigurationFiles {
+ public:
+  enum class Result {
+    ok,
+    fileNotFound,
+    entryNotFound,
+    error
+  };
+
+  explicit ConfigurationFiles(std::string path);
+  virtual ~ConfigurationFiles() = default;
+
+  /**
+   * Gets the value of the first entry "key" in "filename".
+   */
+  Result get(const std::string &filename, const std::string &key, std::string &value);
+
+  /**
+   * Sets all entries "key" in "filename" to "value". Entries which don't exist are not added.
+   */
+  Result set(const std::string &filename, const std::string &key, const std::string &value);
+
+  /**
+   * Gets the values of multiple entries in "filename" with a single lookup of the file. Entries which don't exist are
+   * not added to "values".
+   */
+  Result get(const std::string &filename, const std::vector<std::string> &keys, std::unordered_map<std::string, std::string> &values);
+
+  /**
+   * Sets multiple entries in "filename" and writes the file once. Entries which don't exist are not added. Returns
+   * "entryNotFound" without writing the file when none of the entries exist.
+   */
+  Result set(const std::string &filename, const std::unordered_map<std::string, std::string> &values);
+ private:
+  struct FileStamp {
+    ino_t inode = 0;
+    off_t size = -1;
+    int64_t modificationTime = 0;
+
+    bool operator==(const FileStamp &other) const { return inode == other.inode && size == other.size && modificationTime == other.modificationTime; }
+  };
+
+  struct ParsedFile {
+    std::vector<std::string> lines;
+    std::unordered_map<std::string, size_t> entries; //Key => index of the first line with this key.
+  };
+  typedef std::shared_ptr<const ParsedFile> PParsedFile;
+
+  struct CachedFile {
+    FileStamp stamp;
+    PParsedFile file;
+  };
+
+  std::string _path;
+  std::mutex _cacheMutex;
+  std::unordered_map<std::string, CachedFile> _cache;
+  std::mutex _writeMutex;
+
+  PParsedFile getFile(const std::string &filename);
+  static void getStamp(const struct stat &statStruct, FileStamp &stamp);
+  static std::string getKey(const std::string &line);
+  static std::string getValue(const std::string &line);
+};
+
+#endif
@@ -0,0 +1,168 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Homegear.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU Lesser General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+*/
+
+#include "DpkgDatabase.h"
+#include "GD.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+DpkgDatabase::DpkgDatabase(std::string path) : _path(std::move(path)) {
+  _packages = std::make_shared<const Packages>();
+}
+
+bool DpkgDatabase::getStamp(const std::string &filename, FileStamp &stamp) {
+  struct stat statStruct{};
+  if (stat(filename.c_str(), &statStruct) == -1) return false;
+  stamp.inode = statStruct.st_ino;
+  stamp.size = statStruct.st_size;
+  stamp.modificationTime = (int64_t)statStruct.st_mtim.tv_sec * 1000000000 + statStruct.st_mtim.tv_nsec;
+  return true;
+}
+
+std::string DpkgDatabase::readFile(const std::string &filename) {
+  std::string content;
+  int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) return content;
+
+  struct stat statStruct{};
+  if (fstat(fd, &statStruct) == 0 && statStruct.st_size > 0) content.reserve((size_t)statStruct.st_size);
+  char buffer[65536];
+  while (true) {
+    auto bytesRead = read(fd, buffer, sizeof(buffer));
+    if (bytesRead == -1 && errno == EINTR) continue;
+    if (bytesRead <= 0) break;
+    content.append(buffer, (size_t)bytesRead);
+  }
+  close(fd);
+  return content;
+}
+
+DpkgDatabase::Packages DpkgDatabase::parseStatus(const std::string &content) {
+  //Stanzas of "Field: value" lines separated by empty lines. Lines starting with a space continue the previous field.
+  Packages packages;
+  Package package;
+  std::string status;
+
+  auto finishStanza = [&]() {
+    //Status is "<want> <error flag> <status>". "dpkg -l" shows "install ok installed" as "ii".
+    auto firstSpace = status.find(' ');
+    auto lastSpace = status.rfind(' ');
+    package.installed = firstSpace != std::string::npos && status.compare(0, firstSpace, "install") == 0 && status.compare(lastSpace + 1, std::string::npos, "installed") == 0;
+    if (!package.name.empty() && package.installed) packages.emplace(package.name, package);
+    package = Package();
+    status.clear();
+  };
+
+  size_t position = 0;
+  while (position < content.size()) {
+    auto lineEnd = content.find('\n', position);
+    if (lineEnd == std::string::npos) lineEnd = content.size();
+    auto lineLength = lineEnd - position;
+
+    if (lineLength == 0) finishStanza();
+    else if (content[position] != ' ' && content[position] != '\t') {
+      auto colon = content.find(':', position);
+      if (colon != std::string::npos && colon < lineEnd) {
+        auto valueStart = colon + 1;
+        while (valueStart < lineEnd && content[valueStart] == ' ') valueStart++;
+        auto valueEnd = lineEnd;
+        while (valueEnd > valueStart && (content[valueEnd - 1] == ' ' || content[valueEnd - 1] == '\r')) valueEnd--;
+
+        auto fieldLength = colon - position;
+        if (fieldLength == 7 && content.compare(position, fieldLength, "Package") == 0) package.name = content.substr(valueStart, valueEnd - valueStart);
+        else if (fieldLength == 6 && content.compare(position, fieldLength, "Status") == 0) status = content.substr(valueStart, valueEnd - valueStart);
+        else if (fieldLength == 7 && content.compare(position, fieldLength, "Version") == 0) package.version = content.substr(valueStart, valueEnd - valueStart);
+        else if (fieldLength == 12 && content.compare(position, fieldLength, "Architecture") == 0) package.architecture = content.substr(valueStart, valueEnd - valueStart);
+      }
+    }
+
+    position = lineEnd + 1;
+  }
+  finishStanza();
+
+  return packages;
+}
+
+DpkgDatabase::PPackages DpkgDatabase::getInstalledPackages() {
+  try {
+    std::lock_guard<std::mutex> statusGuard(_statusMutex);
+    FileStamp stamp;
+    if (!getStamp(_path + "status", stamp)) return _packages;
+    if (stamp == _statusStamp) return _packages;
+
+    _packages = std::make_shared<const Packages>(parseStatus(readFile(_path + "status")));
+    _statusStamp = stamp;
+    return _packages;
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return std::make_shared<const Packages>();
+}
+
+bool DpkgDatabase::isInstalled(const std::string &name) {
+  auto packages = getInstalledPackages();
+  return packages->find(name) != packages->end();
+}
+
+DpkgDatabase::PFiles DpkgDatabase::getFiles(const std::string &name) {
+  try {
+    auto packages = getInstalledPackages();
+    auto packageIterator = packages->find(name);
+    if (packageIterator == packages->end()) return std::make_shared<const std::vector<std::string>>();
+
+    //Packages with "Multi-Arch: same" have their architecture in the file name.
+    FileStamp stamp;
+    auto filename = _path + "info/" + name + ":" + packageIterator->second.architecture + ".list";
+    if (!getStamp(filename, stamp)) {
+      filename = _path + "info/" + name + ".list";
+      if (!getStamp(filename, stamp)) return std::make_shared<const std::vector<std::string>>();
+    }
+
+    std::lock_guard<std::mutex> fileListsGuard(_fileListsMutex);
+    auto &fileList = _fileLists[filename];
+    if (fileList.files && fileList.stamp == stamp) return fileList.files;
+
+    auto files = std::make_shared<std::vector<std::string>>();
+    auto lines = BaseLib::HelperFunctions::splitAll(readFile(filename), '\n');
+    files->reserve(lines.size());
+    for (auto &line: lines) {
+      if (!line.empty()) files->push_back(std::move(line));
+    }
+    fileList.stamp = stamp;
+    fileList.files = files;
+    return fileList.files;
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return std::make_shared<const std::vector<std::string>>();
+}
@@ -0,0 +1,103 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Homegear.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU Lesser General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+*/
+
+#ifndef DPKGDATABASE_H_
+#define DPKGDATABASE_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <sys/stat.h>
+
+/**
+ * In-process reader for the dpkg status database (/var/lib/dpkg/status) and the package file lists
+ * (/var/lib/dpkg/info/<package>.list). Parsed data is cached and only read again when the file changed.
+ */
+class DpkgDatabase {
+ public:
+  struct Package {
+    std::string name;
+    std::string architecture;
+    std::string version;
+    bool installed = false; //"install ok installed", equals "ii" in "dpkg -l".
+  };
+
+  /**
+   * Installed packages by name without architecture qualifier. For packages installed for multiple architectures the
+   * first entry in the status file wins.
+   */
+  typedef std::unordered_map<std::string, Package> Packages;
+  typedef std::shared_ptr<const Packages> PPackages;
+  typedef std::shared_ptr<const std::vector<std::string>> PFiles;
+
+  explicit DpkgDatabase(std::string path = "/var/lib/dpkg/");
+  virtual ~DpkgDatabase() = default;
+
+  /**
+   * Returns all installed packages. The returned map is immutable and stays valid when the database is reread.
+   */
+  PPackages getInstalledPackages();
+
+  bool isInstalled(const std::string &name);
+
+  /**
+   * Returns the files installed by a package or an empty list when the package is not installed.
+   */
+  PFiles getFiles(const std::string &name);
+
+  static Packages parseStatus(const std::string &content);
+ private:
+  struct FileStamp {
+    ino_t inode = 0;
+    off_t size = -1;
+    int64_t modificationTime = 0;
+
+    bool operator==(const FileStamp &other) const { return inode == other.inode && size == other.size && modificationTime == other.modificationTime; }
+  };
+
+  struct FileList {
+    FileStamp stamp;
+    PFiles files;
+  };
+
+  std::string _path;
+  std::mutex _statusMutex;
+  FileStamp _statusStamp;
+  PPackages _packages;
+  std::mutex _fileListsMutex;
+  std::unordered_map<std::string, FileList> _fileLists;
+
+  static bool getStamp(const std::string &filename, FileStamp &stamp);
+  static std::string readFile(const std::string &filename);
+};
+
+#endif
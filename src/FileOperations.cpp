@@ -0,0 +1,310 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Homegear.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU Lesser General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+*/
+
+#include "FileOperations.h"
+#include "GD.h"
+
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+#include <cstring>
+#include <vector>
+
+std::string FileOperations::getTempName(const std::string &path) {
+  //In the directory of "path", so it can be renamed to "path".
+  std::string tempPath = path;
+  while (tempPath.size() > 1 && tempPath.back() == '/') tempPath.pop_back();
+  return tempPath + ".tmp-" + BaseLib::HelperFunctions::getHexString(BaseLib::HelperFunctions::getRandomBytes(8));
+}
+
+std::string FileOperations::getParentDirectory(const std::string &path) {
+  auto position = path.find_last_of('/', path.size() > 1 ? path.size() - 2 : std::string::npos);
+  if (position == std::string::npos) return ".";
+  return position == 0 ? "/" : path.substr(0, position);
+}
+
+void FileOperations::syncDirectory(const std::string &path) {
+  //Makes a rename in the directory durable.
+  int fd = open(getParentDirectory(path).c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1) return;
+  fsync(fd);
+  close(fd);
+}
+
+bool FileOperations::copyData(int sourceFd, int destinationFd, uint64_t size, std::string &error) {
+  bool useCopyFileRange = true;
+  bool useSendfile = true;
+  std::vector<char> buffer;
+  uint64_t bytesCopied = 0;
+  while (bytesCopied < size) {
+    //Limit the size per call, so the kernel doesn't block for too long.
+    size_t chunkSize = (size_t)std::min<uint64_t>(size - bytesCopied, 1073741824);
+    ssize_t result = 0;
+    if (useCopyFileRange) {
+      result = copy_file_range(sourceFd, nullptr, destinationFd, nullptr, chunkSize, 0);
+      //Not supported by the kernel or between these file systems. The file offsets are unchanged on error.
+      if (result == -1 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)) {
+        useCopyFileRange = false;
+        continue;
+      }
+    } else if (useSendfile) {
+      result = sendfile(destinationFd, sourceFd, nullptr, chunkSize);
+      if (result == -1 && (errno == ENOSYS || errno == EINVAL)) {
+        useSendfile = false;
+        continue;
+      }
+    } else {
+      if (buffer.empty()) buffer.resize(65536);
+      result = read(sourceFd, buffer.data(), std::min(buffer.size(), chunkSize));
+      if (result > 0) {
+        ssize_t bytesWritten = 0;
+        while (bytesWritten < result) {
+          auto writeResult = write(destinationFd, buffer.data() + bytesWritten, (size_t)(result - bytesWritten));
+          if (writeResult == -1) {
+            if (errno == EINTR) continue;
+            error = "Could not write: " + std::string(strerror(errno));
+            return false;
+          }
+          bytesWritten += writeResult;
+        }
+      }
+    }
+
+    if (result == -1) {
+      if (errno == EINTR) continue;
+      error = "Could not copy: " + std::string(strerror(errno));
+      return false;
+    }
+    if (result == 0) break; //The source was truncated.
+    bytesCopied += (uint64_t)result;
+  }
+  return true;
+}
+
+bool FileOperations::copyFile(const std::string &source, const std::string &destination, mode_t mode, std::string &error) {
+  int sourceFd = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+  if (sourceFd == -1) {
+    error = "Could not open " + source + ": " + std::string(strerror(errno));
+    return false;
+  }
+  struct stat statStruct{};
+  if (fstat(sourceFd, &statStruct) == -1 || !S_ISREG(statStruct.st_mode)) {
+    error = source + " is not a regular file.";
+    close(sourceFd);
+    return false;
+  }
+  posix_fadvise(sourceFd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  auto tempName = getTempName(destination);
+  int destinationFd = open(tempName.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR);
+  if (destinationFd == -1) {
+    error = "Could not create " + tempName + ": " + std::string(strerror(errno));
+    close(sourceFd);
+    return false;
+  }
+
+  bool success = copyData(sourceFd, destinationFd, (uint64_t)statStruct.st_size, error);
+  close(sourceFd);
+  if (success && (fchmod(destinationFd, mode) == -1 || fsync(destinationFd) == -1)) {
+    error = "Could not write " + tempName + ": " + std::string(strerror(errno));
+    success = false;
+  }
+  if (close(destinationFd) == -1 && success) {
+    error = "Could not write " + tempName + ": " + std::string(strerror(errno));
+    success = false;
+  }
+  if (success && rename(tempName.c_str(), destination.c_str()) == -1) {
+    error = "Could not rename " + tempName + " to " + destination + ": " + std::string(strerror(errno));
+    success = false;
+  }
+  if (!success) {
+    unlink(tempName.c_str());
+    return false;
+  }
+  syncDirectory(destination);
+  return true;
+}
+
+bool FileOperations::copyTree(int sourceDirectoryFd, const std::string &sourceName, int destinationDirectoryFd, const std::string &destinationName, std::string &error) {
+  struct stat statStruct{};
+  if (fstatat(sourceDirectoryFd, sourceName.c_str(), &statStruct, AT_SYMLINK_NOFOLLOW) == -1) {
+    error = "Could not read " + sourceName + ": " + std::string(strerror(errno));
+    return false;
+  }
+  const struct timespec times[2] = {statStruct.st_atim, statStruct.st_mtim};
+
+  if (S_ISLNK(statStruct.st_mode)) {
+    std::vector<char> target((size_t)statStruct.st_size + 1);
+    auto length = readlinkat(sourceDirectoryFd, sourceName.c_str(), target.data(), target.size());
+    if (length == -1 || symlinkat(std::string(target.data(), (size_t)length).c_str(), destinationDirectoryFd, destinationName.c_str()) == -1) {
+      error = "Could not copy link " + sourceName + ": " + std::string(strerror(errno));
+      return false;
+    }
+    fchownat(destinationDirectoryFd, destinationName.c_str(), statStruct.st_uid, statStruct.st_gid, AT_SYMLINK_NOFOLLOW);
+    utimensat(destinationDirectoryFd, destinationName.c_str(), times, AT_SYMLINK_NOFOLLOW);
+    return true;
+  }
+
+  if (S_ISREG(statStruct.st_mode)) {
+    int sourceFd = openat(sourceDirectoryFd, sourceName.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (sourceFd == -1) {
+      error = "Could not open " + sourceName + ": " + std::string(strerror(errno));
+      return false;
+    }
+    int destinationFd = openat(destinationDirectoryFd, destinationName.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (destinationFd == -1) {
+      error = "Could not create " + destinationName + ": " + std::string(strerror(errno));
+      close(sourceFd);
+      return false;
+    }
+    posix_fadvise(sourceFd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    bool success = copyData(sourceFd, destinationFd, (uint64_t)statStruct.st_size, error);
+    close(sourceFd);
+    //Owner first, as chown clears the set-user-ID and set-group-ID bits.
+    fchown(destinationFd, statStruct.st_uid, statStruct.st_gid);
+    fchmod(destinationFd, statStruct.st_mode & 07777);
+    futimens(destinationFd, times);
+    close(destinationFd);
+    return success;
+  }
+
+  if (!S_ISDIR(statStruct.st_mode)) return true; //Sockets, FIFOs and devices are skipped.
+
+  if (mkdirat(destinationDirectoryFd, destinationName.c_str(), S_IRWXU) == -1) {
+    error = "Could not create directory " + destinationName + ": " + std::string(strerror(errno));
+    return false;
+  }
+  int sourceFd = openat(sourceDirectoryFd, sourceName.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  int destinationFd = openat(destinationDirectoryFd, destinationName.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (sourceFd == -1 || destinationFd == -1) {
+    error = "Could not open directory " + sourceName + ": " + std::string(strerror(errno));
+    if (sourceFd != -1) close(sourceFd);
+    if (destinationFd != -1) close(destinationFd);
+    return false;
+  }
+
+  DIR *directory = fdopendir(sourceFd);
+  if (!directory) {
+    error = "Could not read directory " + sourceName + ": " + std::string(strerror(errno));
+    close(sourceFd);
+    close(destinationFd);
+    return false;
+  }
+  bool success = true;
+  while (dirent *entry = readdir(directory)) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+    if (!copyTree(sourceFd, entry->d_name, destinationFd, entry->d_name, error)) {
+      success = false;
+      break;
+    }
+  }
+  closedir(directory); //Closes sourceFd.
+
+  fchown(destinationFd, statStruct.st_uid, statStruct.st_gid);
+  fchmod(destinationFd, statStruct.st_mode & 07777);
+  //After the content, as creating entries changes the modification time.
+  futimens(destinationFd, times);
+  close(destinationFd);
+  return success;
+}
+
+bool FileOperations::move(const std::string &source, const std::string &destination, std::string &error) {
+  if (rename(source.c_str(), destination.c_str()) == 0) return true;
+  if (errno != EXDEV) {
+    error = "Could not move " + source + " to " + destination + ": " + std::string(strerror(errno));
+    return false;
+  }
+
+  //Different file systems. Copy to a temporary name and sync once before making the copy visible.
+  auto tempName = getTempName(destination);
+  if (!copyTree(AT_FDCWD, source, AT_FDCWD, tempName, error)) {
+    std::string removeError;
+    remove(tempName, removeError);
+    return false;
+  }
+  int fd = open(getParentDirectory(tempName).c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd != -1) {
+    syncfs(fd);
+    close(fd);
+  }
+  if (rename(tempName.c_str(), destination.c_str()) == -1) {
+    error = "Could not rename " + tempName + " to " + destination + ": " + std::string(strerror(errno));
+    std::string removeError;
+    remove(tempName, removeError);
+    return false;
+  }
+  syncDirectory(destination);
+  return remove(source, error);
+}
+
+bool FileOperations::removeTree(int directoryFd, const std::string &name, std::string &error) {
+  if (unlinkat(directoryFd, name.c_str(), 0) == 0 || errno == ENOENT) return true;
+  if (errno != EISDIR && errno != EPERM) {
+    error = "Could not delete " + name + ": " + std::string(strerror(errno));
+    return false;
+  }
+
+  int fd = openat(directoryFd, name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (fd == -1) {
+    error = "Could not open directory " + name + ": " + std::string(strerror(errno));
+    return false;
+  }
+  DIR *directory = fdopendir(fd);
+  if (!directory) {
+    error = "Could not read directory " + name + ": " + std::string(strerror(errno));
+    close(fd);
+    return false;
+  }
+  bool success = true;
+  while (dirent *entry = readdir(directory)) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+    if (!removeTree(fd, entry->d_name, error)) success = false;
+  }
+  closedir(directory);
+
+  if (success && unlinkat(directoryFd, name.c_str(), AT_REMOVEDIR) == -1 && errno != ENOENT) {
+    error = "Could not delete directory " + name + ": " + std::string(strerror(errno));
+    success = false;
+  }
+  return success;
+}
+
+bool FileOperations::remove(const std::string &path, std::string &error) {
+  std::string normalizedPath = path;
+  while (normalizedPath.size() > 1 && normalizedPath.back() == '/') normalizedPath.pop_back();
+  if (normalizedPath.empty() || normalizedPath == "/") {
+    error = "Refusing to delete \"" + path + "\".";
+    return false;
+  }
+  return removeTree(AT_FDCWD, normalizedPath, error);
+}
@@ -0,0 +1,78 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Homegear.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU Lesser General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+*/
+
+#ifndef FILEOPERATIONS_H_
+#define FILEOPERATIONS_H_
+
+#include <string>
+#include <sys/types.h>
+
+/**
+ * File copies, moves and deletions without external processes. Data is copied in the kernel with copy_file_range(2),
+ * falling back to sendfile(2) and then to read/write. Copies are written to a temporary name and renamed, so the
+ * destination never is partially written.
+ */
+class FileOperations {
+ public:
+  FileOperations() = delete;
+
+  /**
+   * Copies a regular file. An existing destination is replaced.
+   *
+   * @param mode The file mode of the destination.
+   * @param[out] error Set to a description of the error when false is returned.
+   */
+  static bool copyFile(const std::string &source, const std::string &destination, mode_t mode, std::string &error);
+
+  /**
+   * Like "mv": Renames a file or a directory. Across file systems, the source is copied with owner, mode and times
+   * and deleted afterwards. Directories are synced once with syncfs(2) instead of calling fsync(2) per file.
+   *
+   * @param[out] error Set to a description of the error when false is returned.
+   */
+  static bool move(const std::string &source, const std::string &destination, std::string &error);
+
+  /**
+   * Like "rm -Rf": Deletes a file, a symbolic link or a directory with all of its content. Symbolic links are not
+   * followed. A path which doesn't exist is no error.
+   *
+   * @param[out] error Set to a description of the error when false is returned.
+   */
+  static bool remove(const std::string &path, std::string &error);
+ private:
+  static bool copyData(int sourceFd, int destinationFd, uint64_t size, std::string &error);
+  static bool copyTree(int sourceDirectoryFd, const std::string &sourceName, int destinationDirectoryFd, const std::string &destinationName, std::string &error);
+  static bool removeTree(int directoryFd, const std::string &name, std::string &error);
+  static std::string getTempName(const std::string &path);
+  static std::string getParentDirectory(const std::string &path);
+  static void syncDirectory(const std::string &path);
+};
+
+#endif
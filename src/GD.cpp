@@ -41,4 +41,5 @@ std::string GD::executablePath = "";
 std::string GD::executableFile = "";
 int64_t GD::startingTime = BaseLib::HelperFunctions::getTime();
 Settings GD::settings;
+SystemInfo GD::systemInfo;
 std::unique_ptr<IpcClient> GD::ipcClient;
\ No newline at end of file
@@ -32,6 +32,7 @@
 #define GD_H_
 
 #include "Settings.h"
+#include "SystemInfo.h"
 #include "IpcClient.h"
 #include <homegear-base/BaseLib.h>
 
@@ -49,6 +50,7 @@ public:
 	static std::string executableFile;
 	static int64_t startingTime;
 	static Settings settings;
+	static SystemInfo systemInfo;
     static std::unique_ptr<IpcClient> ipcClient;
 
 	virtual ~GD() = default;
@@ -30,44 +30,42 @@
 
 #include "IpcClient.h"
 #include "GD.h"
+#include "MountInfo.h"
+#include "FileOperations.h"
 #include <homegear-base/Managers/ProcessManager.h>
 
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/mount.h>
+#include <sys/statvfs.h>
 #include <fcntl.h>
+#include <poll.h>
+
+#include <limits>
 
 IpcClient::IpcClient(std::string socketPath) : IIpcClient(socketPath) {
   _disposing = false;
+  _rootIsReadOnly = false;
 
-  {
-    _rootIsReadOnly = GD::settings.rootIsReadOnly();
-    if (!_rootIsReadOnly) {
-      std::string output;
-      BaseLib::ProcessManager::exec("grep '/dev/root' /proc/mounts | grep -c '\\sro[\\s,]'",
-                                    GD::bl->fileDescriptorManager.getMax(),
-                                    output);
-      BaseLib::HelperFunctions::trim(output);
-      if (output.empty() || BaseLib::Math::getNumber(output) == 0) {
-        BaseLib::ProcessManager::exec("grep '/dev/mmcblk0p1' /proc/mounts | grep -c '\\sro[\\s,]'",
-                                      GD::bl->fileDescriptorManager.getMax(),
-                                      output);
-        BaseLib::HelperFunctions::trim(output);
-        if (output.empty() || BaseLib::Math::getNumber(output) == 0) {
-          BaseLib::ProcessManager::exec("grep '/dev/emmc' /proc/mounts | grep -c '\\sro[\\s,]'",
-                                        GD::bl->fileDescriptorManager.getMax(),
-                                        output);
-          BaseLib::HelperFunctions::trim(output);
-          if (output.empty() || BaseLib::Math::getNumber(output) == 0) {
-            BaseLib::ProcessManager::exec("cat /proc/mounts | grep ' / ' | grep -c '\\sro[\\s,]'",
-                                          GD::bl->fileDescriptorManager.getMax(),
-                                          output);
-            BaseLib::HelperFunctions::trim(output);
-          }
-        }
-      }
-      _rootIsReadOnly = BaseLib::Math::getNumber(output) == 1;
-    }
+  GD::systemInfo.load(_dpkgDatabase);
+
+  _mountInfoFd = open("/proc/self/mountinfo", O_RDONLY | O_CLOEXEC);
+  if (_mountInfoFd == -1) GD::out.printError("Error: Could not open /proc/self/mountinfo: " + std::string(strerror(errno)));
+  updateRootIsReadOnly();
+  _mountWatcherThread = std::thread(&IpcClient::mountWatcherThread, this);
+  _remountThread = std::thread(&IpcClient::remountThread, this);
+
+  if (!_processSupervisor.start()) GD::out.printCritical("Critical: Could not start process supervisor.");
+  _cgroupManager.init();
+  if (!_aptTracker.start()) GD::out.printError("Error: Could not start watching apt lock files. Falling back to polling.");
+  _commandEventThread = std::thread(&IpcClient::commandEventThread, this);
+  _certificateKeyPool.start([this](bool readOnly) { setRootReadOnly(readOnly); });
+
+  //Remove output files left over from a previous run.
+  for (auto &file: BaseLib::Io::getFiles(GD::settings.logfilePath(), false)) {
+    if (file.compare(0, 28, "homegear-management-command-") == 0) BaseLib::Io::deleteFile(GD::settings.logfilePath() + file);
   }
+  _commandReaperThread = std::thread(&IpcClient::commandReaperThread, this);
 
   _localRpcMethods.emplace("managementSleep", std::bind(&IpcClient::sleep, this, std::placeholders::_1));
   _localRpcMethods.emplace("managementDpkgPackageInstalled",
@@ -76,10 +74,22 @@ IpcClient::IpcClient(std::string socketPath) : IIpcClient(socketPath) {
                            std::bind(&IpcClient::getSystemInfo, this, std::placeholders::_1));
   _localRpcMethods.emplace("managementGetCommandStatus",
                            std::bind(&IpcClient::getCommandStatus, this, std::placeholders::_1));
+  _localRpcMethods.emplace("managementGetCommandQueueStatus",
+                           std::bind(&IpcClient::getCommandQueueStatus, this, std::placeholders::_1));
+  _localRpcMethods.emplace("managementCancelCommand",
+                           std::bind(&IpcClient::cancelCommand, this, std::placeholders::_1));
+  _localRpcMethods.emplace("managementSubscribeCommand",
+                           std::bind(&IpcClient::subscribeCommand, this, std::placeholders::_1));
+  _localRpcMethods.emplace("managementUnsubscribeCommand",
+                           std::bind(&IpcClient::unsubscribeCommand, this, std::placeholders::_1));
   _localRpcMethods.emplace("managementGetConfigurationEntry",
                            std::bind(&IpcClient::getConfigurationEntry, this, std::placeholders::_1));
   _localRpcMethods.emplace("managementSetConfigurationEntry",
                            std::bind(&IpcClient::setConfigurationEntry, this, std::placeholders::_1));
+  _localRpcMethods.emplace("managementGetConfigurationEntries",
+                           std::bind(&IpcClient::getConfigurationEntries, this, std::placeholders::_1));
+  _localRpcMethods.emplace("managementSetConfigurationEntries",
+                           std::bind(&IpcClient::setConfigurationEntries, this, std::placeholders::_1));
   _localRpcMethods.emplace("managementReboot", std::bind(&IpcClient::reboot, this, std::placeholders::_1));
   _localRpcMethods.emplace("managementShutdown", std::bind(&IpcClient::shutdown, this, std::placeholders::_1));
   _localRpcMethods.emplace("managementServiceCommand",
@@ -112,6 +122,8 @@ IpcClient::IpcClient(std::string socketPath) : IIpcClient(socketPath) {
                            std::bind(&IpcClient::homegearUpdateAvailable, this, std::placeholders::_1));
   _localRpcMethods.emplace("managementSystemUpdateAvailable",
                            std::bind(&IpcClient::systemUpdateAvailable, this, std::placeholders::_1));
+  _localRpcMethods.emplace("managementGetUpgradablePackages",
+                           std::bind(&IpcClient::getUpgradablePackages, this, std::placeholders::_1));
   _localRpcMethods.emplace("managementAptFullUpgrade",
                            std::bind(&IpcClient::aptFullUpgrade, this, std::placeholders::_1));
   // }}}
@@ -152,6 +164,13 @@ IpcClient::IpcClient(std::string socketPath) : IIpcClient(socketPath) {
                            std::bind(&IpcClient::uploadDeviceDescriptionFile, this, std::placeholders::_1));
   // }}}
 
+  // {{{ Uploads
+  _localRpcMethods.emplace("managementBeginUpload", std::bind(&IpcClient::beginUpload, this, std::placeholders::_1));
+  _localRpcMethods.emplace("managementAppendUpload", std::bind(&IpcClient::appendUpload, this, std::placeholders::_1));
+  _localRpcMethods.emplace("managementCommitUpload", std::bind(&IpcClient::commitUpload, this, std::placeholders::_1));
+  _localRpcMethods.emplace("managementAbortUpload", std::bind(&IpcClient::abortUpload, this, std::placeholders::_1));
+  // }}}
+
   // {{{ Internal
   _localRpcMethods.emplace("managementInternalSetReadOnlyTrue",
                            std::bind(&IpcClient::internalSetRootReadOnlyTrue, this, std::placeholders::_1));
@@ -161,16 +180,74 @@ IpcClient::IpcClient(std::string socketPath) : IIpcClient(socketPath) {
 IpcClient::~IpcClient() {
   _disposing = true;
 
-  std::unordered_map<int32_t, PCommandInfo> commandInfoCopy;
+  //Running backups would delay the shutdown for minutes, as running commands are waited for below.
+  for (auto &commandInfo: *getCommandRegistry()) {
+    if (commandInfo.second->backupProgress) commandInfo.second->backupProgress->cancel = true;
+  }
 
   {
-    std::lock_guard<std::mutex> commandInfoGuard(_commandInfoMutex);
-    commandInfoCopy = _commandInfo;
-    _commandInfo.clear();
+    std::unique_lock<std::mutex> commandQueueGuard(_commandQueueMutex);
+    for (auto &commandQueue: _commandQueues) {
+      for (auto &commandInfo: commandQueue) {
+        auto state = std::make_shared<CommandState>(*commandInfo->getState());
+        state->queued = false;
+        state->finished = true;
+        state->endTime = BaseLib::HelperFunctions::getTime();
+        commandInfo->setState(state);
+      }
+      commandQueue.clear();
+    }
+
+    //Wait for running commands, so the root file system is set back to read only.
+    _commandQueueConditionVariable.wait(commandQueueGuard, [&] { return _runningCommands == 0; });
+  }
+
+  _certificateKeyPool.stop();
+  _uploadSessions.abortAll();
+  _processSupervisor.stop();
+  _aptTracker.stop();
+
+  {
+    std::lock_guard<std::mutex> commandEventGuard(_commandEventMutex);
+    _stopCommandEventThread = true;
+  }
+  _commandEventConditionVariable.notify_all();
+  if (_commandEventThread.joinable()) _commandEventThread.join();
+
+  {
+    std::lock_guard<std::mutex> internalCommandGuard(_internalCommandMutex);
+    _stopInternalCommandThreads = true;
+  }
+  _internalCommandConditionVariable.notify_all();
+  for (auto &thread: _internalCommandThreads) {
+    if (thread.joinable()) thread.join();
+  }
+
+  //Flushes a pending read only remount.
+  {
+    std::lock_guard<std::mutex> readOnlyCountGuard(_readOnlyCountMutex);
+    _stopRemountThread = true;
+  }
+  _remountConditionVariable.notify_all();
+  if (_remountThread.joinable()) _remountThread.join();
+
+  _stopMountWatcherThread = true;
+  if (_mountWatcherThread.joinable()) _mountWatcherThread.join();
+  if (_mountInfoFd != -1) {
+    close(_mountInfoFd);
+    _mountInfoFd = -1;
   }
 
-  for (auto &commandInfo: commandInfoCopy) {
-    if (commandInfo.second->thread.joinable()) commandInfo.second->thread.join();
+  {
+    std::lock_guard<std::mutex> commandReaperGuard(_commandReaperMutex);
+    _stopCommandReaperThread = true;
+  }
+  _commandReaperConditionVariable.notify_all();
+  if (_commandReaperThread.joinable()) _commandReaperThread.join();
+
+  {
+    std::lock_guard<std::mutex> commandInfoGuard(_commandInfoMutex);
+    std::atomic_store(&_commandInfo, std::make_shared<const CommandRegistry>());
   }
 
   if (_lifetickThread.joinable()) {
@@ -211,6 +288,128 @@ void IpcClient::lifetickThread() {
   }
 }
 
+void IpcClient::queueCommandEvent(const PCommandInfo &commandInfo) {
+  try {
+    if (!commandInfo->subscribed) return;
+
+    {
+      std::lock_guard<std::mutex> commandEventGuard(_commandEventMutex);
+      for (auto &pendingCommandInfo: _pendingCommandEvents) {
+        if (pendingCommandInfo == commandInfo) return;
+      }
+      _pendingCommandEvents.push_back(commandInfo);
+    }
+    _commandEventConditionVariable.notify_one();
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+}
+
+void IpcClient::commandEventThread() {
+  while (true) {
+    try {
+      std::deque<PCommandInfo> pendingCommandEvents;
+
+      {
+        std::unique_lock<std::mutex> commandEventGuard(_commandEventMutex);
+        _commandEventConditionVariable.wait(commandEventGuard, [&] { return _stopCommandEventThread || !_pendingCommandEvents.empty(); });
+        if (_stopCommandEventThread) return;
+        pendingCommandEvents.swap(_pendingCommandEvents);
+      }
+
+      for (auto &commandInfo: pendingCommandEvents) {
+        auto event = std::make_shared<Ipc::Variable>(Ipc::VariableType::tStruct);
+        bool finished = false;
+
+        {
+          std::lock_guard<std::mutex> outputGuard(commandInfo->outputMutex);
+          auto state = commandInfo->getState();
+          finished = state->finished;
+          event->structValue->emplace("finished", std::make_shared<Ipc::Variable>(finished));
+          event->structValue->emplace("queued", std::make_shared<Ipc::Variable>(state->queued));
+          if (finished) {
+            event->structValue->emplace("endTime", std::make_shared<Ipc::Variable>(state->endTime));
+            event->structValue->emplace("exitCode", std::make_shared<Ipc::Variable>(state->exitCode));
+            event->structValue->emplace("cancelled", std::make_shared<Ipc::Variable>(state->cancelled));
+            event->structValue->emplace("timedOut", std::make_shared<Ipc::Variable>(state->timedOut));
+          }
+
+          uint64_t nextCursor = 0;
+          bool truncated = false;
+          auto output = commandInfo->output.read(commandInfo->eventCursor, nextCursor, truncated);
+          commandInfo->eventCursor = nextCursor;
+          if (!output.empty() || truncated) {
+            event->structValue->emplace("output", std::make_shared<Ipc::Variable>(output));
+            event->structValue->emplace("outputTruncated", std::make_shared<Ipc::Variable>(truncated));
+          }
+          event->structValue->emplace("cursor", std::make_shared<Ipc::Variable>((int64_t)nextCursor));
+        }
+
+        //Subscriptions end with the final event.
+        if (finished) commandInfo->subscribed = false;
+
+        auto eventParameters = std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray);
+        eventParameters->arrayValue->reserve(2);
+        eventParameters->arrayValue->push_back(std::make_shared<Ipc::Variable>(commandInfo->id));
+        eventParameters->arrayValue->push_back(event);
+
+        auto parameters = std::make_shared<Ipc::Array>();
+        parameters->reserve(2);
+        parameters->push_back(std::make_shared<Ipc::Variable>("managementCommandEvent"));
+        parameters->push_back(eventParameters);
+        auto result = invoke("triggerRpcEvent", parameters);
+        if (result->errorStruct) {
+          GD::out.printWarning("Warning: Could not send event for command " + std::to_string(commandInfo->id) + ": " + result->structValue->at("faultString")->stringValue);
+        }
+      }
+
+      //Collect output for a short time, so chatty commands don't cause one event per pipe read.
+      std::unique_lock<std::mutex> commandEventGuard(_commandEventMutex);
+      _commandEventConditionVariable.wait_for(commandEventGuard, std::chrono::milliseconds(100), [&] { return _stopCommandEventThread; });
+    }
+    catch (const std::exception &ex) {
+      GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+    }
+  }
+}
+
+void IpcClient::internalCommandThread() {
+  while (true) {
+    PCommandInfo commandInfo;
+
+    {
+      std::unique_lock<std::mutex> internalCommandGuard(_internalCommandMutex);
+      _idleInternalCommandThreads++;
+      _internalCommandConditionVariable.wait(internalCommandGuard, [&] { return _stopInternalCommandThreads || !_internalCommands.empty(); });
+      _idleInternalCommandThreads--;
+      if (_internalCommands.empty()) return;
+      commandInfo = _internalCommands.front();
+      _internalCommands.pop_front();
+    }
+
+    int32_t exitCode = -1;
+    try {
+      std::string output;
+      exitCode = commandInfo->function(output);
+      if (!output.empty()) {
+        {
+          std::lock_guard<std::mutex> outputGuard(commandInfo->outputMutex);
+          commandInfo->output.append(output.data(), output.size());
+        }
+        queueCommandEvent(commandInfo);
+      }
+    }
+    catch (const std::exception &ex) {
+      GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+    }
+
+    setRootReadOnly(true);
+    commandFinished(commandInfo, exitCode);
+    dispatchCommands();
+  }
+}
+
 void IpcClient::onConnect() {
   try {
     Ipc::PArray parameters = std::make_shared<Ipc::Array>();
@@ -220,6 +419,24 @@ void IpcClient::onConnect() {
     Ipc::PVariable signature = std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray); //Inner array (= signature)
     signature->arrayValue->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray)); //Return value
     parameters->back()->arrayValue->push_back(signature);
+    signature = std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray); //Inner array (= signature)
+    signature->arrayValue->reserve(3);
+    signature->arrayValue->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tStruct)); //Return value
+    signature->arrayValue->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tInteger)); //Command ID
+    signature->arrayValue->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tInteger64)); //Output cursor
+    parameters->back()->arrayValue->push_back(signature);
+    signature = std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray); //Inner array (= signature)
+    signature->arrayValue->reserve(2);
+    signature->arrayValue->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray)); //Return value
+    signature->arrayValue->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray)); //Fields
+    parameters->back()->arrayValue->push_back(signature);
+    signature = std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray); //Inner array (= signature)
+    signature->arrayValue->reserve(4);
+    signature->arrayValue->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tStruct)); //Return value
+    signature->arrayValue->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tInteger)); //Command ID
+    signature->arrayValue->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tInteger64)); //Output cursor
+    signature->arrayValue->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray)); //Fields
+    parameters->back()->arrayValue->push_back(signature);
     Ipc::PVariable result = invoke("registerRpcMethod", parameters);
     if (result->errorStruct) {
       Ipc::Output::printCritical("Critical: Could not register RPC method managementGetCommandStatus: "
@@ -227,6 +444,68 @@ void IpcClient::onConnect() {
       return;
     }
 
+    parameters = std::make_shared<Ipc::Array>();
+    parameters->reserve(2);
+    parameters->push_back(std::make_shared<Ipc::Variable>("managementGetCommandQueueStatus"));
+    parameters->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray)); //Outer array
+    signature = std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray); //Inner array (= signature)
+    signature->arrayValue->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tStruct)); //Return value
+    parameters->back()->arrayValue->push_back(signature);
+    result = invoke("registerRpcMethod", parameters);
+    if (result->errorStruct) {
+      Ipc::Output::printCritical("Critical: Could not register RPC method managementGetCommandQueueStatus: "
+                                     + result->structValue->at("faultString")->stringValue);
+      return;
+    }
+
+    parameters = std::make_shared<Ipc::Array>();
+    parameters->reserve(2);
+    parameters->push_back(std::make_shared<Ipc::Variable>("managementCancelCommand"));
+    parameters->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray)); //Outer array
+    signature = std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray); //Inner array (= signature)
+    signature->arrayValue->reserve(2);
+    signature->arrayValue->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tVoid)); //Return value
+    signature->arrayValue->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tInteger)); //Command ID
+    parameters->back()->arrayValue->push_back(signature);
+    result = invoke("registerRpcMethod", parameters);
+    if (result->errorStruct) {
+      Ipc::Output::printCritical("Critical: Could not register RPC method managementCancelCommand: "
+                                     + result->structValue->at("faultString")->stringValue);
+      return;
+    }
+
+    parameters = std::make_shared<Ipc::Array>();
+    parameters->reserve(2);
+    parameters->push_back(std::make_shared<Ipc::Variable>("managementSubscribeCommand"));
+    parameters->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray)); //Outer array
+    signature = std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray); //Inner array (= signature)
+    signature->arrayValue->reserve(2);
+    signature->arrayValue->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tVoid)); //Return value
+    signature->arrayValue->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tInteger)); //Command ID
+    parameters->back()->arrayValue->push_back(signature);
+    result = invoke("registerRpcMethod", parameters);
+    if (result->errorStruct) {
+      Ipc::Output::printCritical("Critical: Could not register RPC method managementSubscribeCommand: "
+                                     + result->structValue->at("faultString")->stringValue);
+      return;
+    }
+
+    parameters = std::make_shared<Ipc::Array>();
+    parameters->reserve(2);
+    parameters->push_back(std::make_shared<Ipc::Variable>("managementUnsubscribeCommand"));
+    parameters->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray)); //Outer array
+    signature = std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray); //Inner array (= signature)
+    signature->arrayValue->reserve(2);
+    signature->arrayValue->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tVoid)); //Return value
+    signature->arrayValue->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tInteger)); //Command ID
+    parameters->back()->arrayValue->push_back(signature);
+    result = invoke("registerRpcMethod", parameters);
+    if (result->errorStruct) {
+      Ipc::Output::printCritical("Critical: Could not register RPC method managementUnsubscribeCommand: "
+                                     + result->structValue->at("faultString")->stringValue);
+      return;
+    }
+
     parameters = std::make_shared<Ipc::Array>();
     parameters->reserve(2);
     parameters->push_back(std::make_shared<Ipc::Variable>("managementSleep"));
@@ -353,6 +632,38 @@ void IpcClient::onConnect() {
       return;
     }
 
+    parameters = std::make_shared<Ipc::Array>();
+    parameters->reserve(2);
+    parameters->push_back(std::make_shared<Ipc::Variable>("managementGetConfigurationEntries"));
+    parameters->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray)); //Outer array
+    signature = std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray); //Inner array (= signature)
+    signature->arrayValue->reserve(2);
+    signature->arrayValue->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray)); //Return value
+    signature->arrayValue->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray));
+    parameters->back()->arrayValue->push_back(signature);
+    result = invoke("registerRpcMethod", parameters);
+    if (result->errorStruct) {
+      Ipc::Output::printCritical("Critical: Could not register RPC method managementGetConfigurationEntries: "
+                                     + result->structValue->at("faultString")->stringValue);
+      return;
+    }
+
+    parameters = std::make_shared<Ipc::Array>();
+    parameters->reserve(2);
+    parameters->push_back(std::make_shared<Ipc::Variable>("managementSetConfigurationEntries"));
+    parameters->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray)); //Outer array
+    signature = std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray); //Inner array (= signature)
+    signature->arrayValue->reserve(2);
+    signature->arrayValue->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tVoid)); //Return value
+    signature->arrayValue->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray));
+    parameters->back()->arrayValue->push_back(signature);
+    result = invoke("registerRpcMethod", parameters);
+    if (result->errorStruct) {
+      Ipc::Output::printCritical("Critical: Could not register RPC method managementSetConfigurationEntries: "
+                                     + result->structValue->at("faultString")->stringValue);
+      return;
+    }
+
     parameters = std::make_shared<Ipc::Array>();
     parameters->reserve(2);
     parameters->push_back(std::make_shared<Ipc::Variable>("managementWriteCloudMaticConfig"));
@@ -560,6 +871,20 @@ void IpcClient::onConnect() {
                                      + result->structValue->at("faultString")->stringValue);
       return;
     }
+
+    parameters = std::make_shared<Ipc::Array>();
+    parameters->reserve(2);
+    parameters->push_back(std::make_shared<Ipc::Variable>("managementGetUpgradablePackages"));
+    parameters->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray)); //Outer array
+    signature = std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray); //Inner array (= signature)
+    signature->arrayValue->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray)); //Return value
+    parameters->back()->arrayValue->push_back(signature);
+    result = invoke("registerRpcMethod", parameters);
+    if (result->errorStruct) {
+      Ipc::Output::printCritical("Critical: Could not register RPC method managementGetUpgradablePackages: "
+                                     + result->structValue->at("faultString")->stringValue);
+      return;
+    }
     //}}}
 
     // {{{ Package management
@@ -777,6 +1102,75 @@ void IpcClient::onConnect() {
       return;
     }
 
+    parameters = std::make_shared<Ipc::Array>();
+    parameters->reserve(2);
+    parameters->push_back(std::make_shared<Ipc::Variable>("managementBeginUpload"));
+    parameters->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray)); //Outer array
+    signature = std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray); //Inner array (= signature)
+    signature->arrayValue->reserve(3);
+    signature->arrayValue->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tString)); //Return value
+    signature->arrayValue->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tString)); //1st parameter
+    signature->arrayValue->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tStruct)); //2nd parameter
+    parameters->back()->arrayValue->push_back(signature);
+    result = invoke("registerRpcMethod", parameters);
+    if (result->errorStruct) {
+      Ipc::Output::printCritical("Critical: Could not register RPC method managementBeginUpload: "
+                                     + result->structValue->at("faultString")->stringValue);
+      return;
+    }
+
+    parameters = std::make_shared<Ipc::Array>();
+    parameters->reserve(2);
+    parameters->push_back(std::make_shared<Ipc::Variable>("managementAppendUpload"));
+    parameters->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray)); //Outer array
+    signature = std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray); //Inner array (= signature)
+    signature->arrayValue->reserve(5);
+    signature->arrayValue->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tInteger64)); //Return value
+    signature->arrayValue->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tString)); //1st parameter
+    signature->arrayValue->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tInteger64)); //2nd parameter
+    signature->arrayValue->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tBinary)); //3rd parameter
+    signature->arrayValue->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tBoolean)); //4th parameter
+    parameters->back()->arrayValue->push_back(signature);
+    result = invoke("registerRpcMethod", parameters);
+    if (result->errorStruct) {
+      Ipc::Output::printCritical("Critical: Could not register RPC method managementAppendUpload: "
+                                     + result->structValue->at("faultString")->stringValue);
+      return;
+    }
+
+    parameters = std::make_shared<Ipc::Array>();
+    parameters->reserve(2);
+    parameters->push_back(std::make_shared<Ipc::Variable>("managementCommitUpload"));
+    parameters->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray)); //Outer array
+    signature = std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray); //Inner array (= signature)
+    signature->arrayValue->reserve(3);
+    signature->arrayValue->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tString)); //Return value
+    signature->arrayValue->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tString)); //1st parameter
+    signature->arrayValue->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tString)); //2nd parameter
+    parameters->back()->arrayValue->push_back(signature);
+    result = invoke("registerRpcMethod", parameters);
+    if (result->errorStruct) {
+      Ipc::Output::printCritical("Critical: Could not register RPC method managementCommitUpload: "
+                                     + result->structValue->at("faultString")->stringValue);
+      return;
+    }
+
+    parameters = std::make_shared<Ipc::Array>();
+    parameters->reserve(2);
+    parameters->push_back(std::make_shared<Ipc::Variable>("managementAbortUpload"));
+    parameters->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray)); //Outer array
+    signature = std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray); //Inner array (= signature)
+    signature->arrayValue->reserve(2);
+    signature->arrayValue->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tVoid)); //Return value
+    signature->arrayValue->push_back(std::make_shared<Ipc::Variable>(Ipc::VariableType::tString)); //1st parameter
+    parameters->back()->arrayValue->push_back(signature);
+    result = invoke("registerRpcMethod", parameters);
+    if (result->errorStruct) {
+      Ipc::Output::printCritical("Critical: Could not register RPC method managementAbortUpload: "
+                                     + result->structValue->at("faultString")->stringValue);
+      return;
+    }
+
     parameters = std::make_shared<Ipc::Array>();
     parameters->reserve(2);
     parameters->push_back(std::make_shared<Ipc::Variable>("managementInternalSetReadOnlyTrue"));
@@ -865,24 +1259,24 @@ void IpcClient::onConnectError() {
   }
 }
 
-void IpcClient::setRootReadOnly(bool readOnly) {
+void IpcClient::updateRootIsReadOnly() {
   try {
-    if (!_rootIsReadOnly) return;
-    std::string output;
+    if (GD::settings.rootIsReadOnly()) {
+      _rootIsReadOnly = true;
+      return;
+    }
+    if (_mountInfoFd == -1) return;
+
+    //Hold the lock while reading, so a remount by setRootReadOnly() can't be interleaved with reading the old state.
     std::lock_guard<std::mutex> readOnlyCountGuard(_readOnlyCountMutex);
-    if (readOnly) {
-      _readOnlyCount--;
-      if (_readOnlyCount < 0) _readOnlyCount = 0;
-      if (_readOnlyCount == 0)
-        BaseLib::ProcessManager::exec("sync; mount -o remount,ro /",
-                                      GD::bl->fileDescriptorManager.getMax(),
-                                      output);
-    } else {
-      if (_readOnlyCount == 0)
-        BaseLib::ProcessManager::exec("mount -o remount,rw /",
-                                      GD::bl->fileDescriptorManager.getMax(),
-                                      output);
-      _readOnlyCount++;
+    auto content = MountInfo::read(_mountInfoFd);
+    //While the root file system is writable because of us, only track changes made by others.
+    if (_readOnlyCount > 0 || _rootMountedWritable || _remountInProgress || content.empty()) return;
+
+    bool rootIsReadOnly = MountInfo::rootIsReadOnly(MountInfo::parse(content));
+    if (rootIsReadOnly != _rootIsReadOnly) {
+      GD::out.printInfo(std::string("Info: Root file system is ") + (rootIsReadOnly ? "read only." : "writable."));
+      _rootIsReadOnly = rootIsReadOnly;
     }
   }
   catch (const std::exception &ex) {
@@ -890,196 +1284,836 @@ void IpcClient::setRootReadOnly(bool readOnly) {
   }
 }
 
-bool IpcClient::isAptRunning() {
-  try {
-    std::string output;
-    auto commandStatus = BaseLib::ProcessManager::exec("pgrep apt-get", GD::bl->fileDescriptorManager.getMax(), output);
-    if (commandStatus == 0) return true;
+void IpcClient::mountWatcherThread() {
+  if (_mountInfoFd == -1) return;
+
+  while (!_stopMountWatcherThread) {
+    try {
+      //The kernel signals changes of the mount table with POLLPRI (see proc(5)).
+      pollfd pollFd{};
+      pollFd.fd = _mountInfoFd;
+      pollFd.events = POLLPRI;
+      auto result = poll(&pollFd, 1, 1000);
+      if (result == -1) {
+        if (errno == EINTR) continue;
+        GD::out.printError("Error: Could not poll /proc/self/mountinfo: " + std::string(strerror(errno)));
+        return;
+      }
+      if (result == 0 || !(pollFd.revents & (POLLPRI | POLLERR))) continue;
 
-    setRootReadOnly(false);
+      updateRootIsReadOnly();
+    }
+    catch (const std::exception &ex) {
+      GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+    }
+  }
+}
 
-    auto lockFd1 = open("/var/lib/dpkg/lock", O_RDONLY | O_CREAT, 0640);
-    auto lockFd2 = open("/var/lib/dpkg/lock-frontend", O_RDONLY | O_CREAT, 0640);
+bool IpcClient::remountRoot(bool readOnly) {
+  struct statvfs fileSystemInfo{};
+  if (statvfs("/", &fileSystemInfo) == -1) {
+    GD::out.printError("Error: Could not get mount flags of /: " + std::string(strerror(errno)));
+    return false;
+  }
 
-    if (lockFd1 == -1 || lockFd2 == -1) {
-      close(lockFd1);
-      close(lockFd2);
-      setRootReadOnly(true);
-      GD::out.printError("Error: Could not open dpkg lock file: " + std::string(strerror(errno)));
-      return true;
+  //Keep all other mount flags. Without them a remount would reset e.g. "noatime".
+  unsigned long flags = MS_REMOUNT;
+  if (readOnly) flags |= MS_RDONLY;
+  if (fileSystemInfo.f_flag & ST_NOSUID) flags |= MS_NOSUID;
+  if (fileSystemInfo.f_flag & ST_NODEV) flags |= MS_NODEV;
+  if (fileSystemInfo.f_flag & ST_NOEXEC) flags |= MS_NOEXEC;
+  if (fileSystemInfo.f_flag & ST_SYNCHRONOUS) flags |= MS_SYNCHRONOUS;
+  if (fileSystemInfo.f_flag & ST_MANDLOCK) flags |= MS_MANDLOCK;
+  if (fileSystemInfo.f_flag & ST_NOATIME) flags |= MS_NOATIME;
+  if (fileSystemInfo.f_flag & ST_NODIRATIME) flags |= MS_NODIRATIME;
+  if (fileSystemInfo.f_flag & ST_RELATIME) flags |= MS_RELATIME;
+
+  if (readOnly) {
+    int rootFd = open("/", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (rootFd != -1) {
+      syncfs(rootFd);
+      close(rootFd);
     }
+  }
 
-    struct flock lock1{};
-    struct flock lock2{};
-    auto result1 = fcntl(lockFd1, F_GETLK, &lock1);
-    if (result1 == -1) {
-      close(lockFd1);
-      close(lockFd2);
-      setRootReadOnly(true);
-      GD::out.printError("Error: Could not call fcntl on dpkg lock file: " + std::string(strerror(errno)));
-      return true;
+  if (mount(nullptr, "/", nullptr, flags, nullptr) == -1) {
+    GD::out.printError(std::string("Error: Could not remount / ") + (readOnly ? "read only" : "writable") + ": " + std::string(strerror(errno)));
+    return false;
+  }
+  GD::out.printDebug(std::string("Debug: Remounted / ") + (readOnly ? "read only." : "writable."));
+  return true;
+}
+
+void IpcClient::remountThread() {
+  std::unique_lock<std::mutex> readOnlyCountGuard(_readOnlyCountMutex);
+  while (true) {
+    try {
+      if (!_stopRemountThread) {
+        if (_remountReadOnlyTime == 0) _remountConditionVariable.wait(readOnlyCountGuard);
+        else {
+          _remountConditionVariable.wait_until(readOnlyCountGuard,
+                                               std::chrono::system_clock::time_point(std::chrono::milliseconds(_remountReadOnlyTime)));
+        }
+      }
+
+      //On shutdown a pending remount is executed right away.
+      bool remount = _remountReadOnlyTime != 0 && (_stopRemountThread || BaseLib::HelperFunctions::getTime() >= _remountReadOnlyTime);
+      if (remount) _remountReadOnlyTime = 0;
+      if (remount && _readOnlyCount == 0 && _rootMountedWritable && !_remountInProgress) {
+        _remountInProgress = true;
+        readOnlyCountGuard.unlock();
+        bool success = remountRoot(true);
+        readOnlyCountGuard.lock();
+        _remountInProgress = false;
+        if (success) _rootMountedWritable = false;
+        _remountConditionVariable.notify_all();
+      }
+
+      if (_stopRemountThread) return;
     }
-    auto result2 = fcntl(lockFd2, F_GETLK, &lock2);
-    if (result2 == -1) {
-      close(lockFd1);
-      close(lockFd2);
-      setRootReadOnly(true);
-      GD::out.printError("Error: Could not call fcntl on dpkg lock file (2): " + std::string(strerror(errno)));
-      return true;
+    catch (const std::exception &ex) {
+      GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
     }
+  }
+}
 
-    close(lockFd1);
-    close(lockFd2);
-    setRootReadOnly(true);
+void IpcClient::setRootReadOnly(bool readOnly) {
+  try {
+    if (!_rootIsReadOnly) return;
+    std::unique_lock<std::mutex> readOnlyCountGuard(_readOnlyCountMutex);
+    if (readOnly) {
+      _readOnlyCount--;
+      if (_readOnlyCount < 0) _readOnlyCount = 0;
+      if (_readOnlyCount == 0 && _rootMountedWritable) {
+        //Don't remount right away. Further writes within the grace period reuse the open write window.
+        _remountReadOnlyTime = BaseLib::HelperFunctions::getTime() + (int64_t)GD::settings.readOnlyRemountDelay() * 1000;
+        _remountConditionVariable.notify_all();
+      }
+    } else {
+      _readOnlyCount++;
+      _remountReadOnlyTime = 0;
+
+      //Another thread is remounting. Wait for it, so we don't return before / is writable.
+      _remountConditionVariable.wait(readOnlyCountGuard, [&] { return !_remountInProgress; });
+      if (_rootMountedWritable) return;
 
-    return lock1.l_type == F_WRLCK || lock2.l_type == F_WRLCK;
+      _remountInProgress = true;
+      readOnlyCountGuard.unlock();
+      bool success = remountRoot(false);
+      readOnlyCountGuard.lock();
+      _remountInProgress = false;
+      if (success) _rootMountedWritable = true;
+      _remountConditionVariable.notify_all();
+    }
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+}
+
+bool IpcClient::isHomegearPackage(const std::string &name) {
+  return name.find("homegear") != std::string::npos || name.find("node-blue-node") != std::string::npos;
+}
+
+bool IpcClient::isAptRunning() {
+  try {
+    if (_aptTracker.isBusy()) return true;
+
+    //Covers the time between queueing an apt command and apt taking its locks.
+    auto registry = getCommandRegistry();
+    for (auto &element: *registry) {
+      if (element.second->type == CommandType::apt && !element.second->getState()->finished) return true;
+    }
+    return false;
   }
   catch (const std::exception &ex) {
     GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
   }
-  setRootReadOnly(true);
   return true;
 }
 
-int32_t IpcClient::startCommandThread(std::string command, bool detach, Ipc::PVariable metadata) {
+std::string IpcClient::getCommandTypeName(CommandType type) {
+  switch (type) {
+    case CommandType::generic: return "generic";
+    case CommandType::service: return "service";
+    case CommandType::apt: return "apt";
+    case CommandType::build: return "build";
+    case CommandType::crypto: return "crypto";
+    case CommandType::backup: return "backup";
+    case CommandType::system: return "system";
+  }
+  return "generic";
+}
+
+IpcClient::CommandPriority IpcClient::getCommandPriority(CommandType type) {
+  switch (type) {
+    case CommandType::generic: return CommandPriority::interactive;
+    case CommandType::service: return CommandPriority::service;
+    case CommandType::system: return CommandPriority::service;
+    case CommandType::apt: return CommandPriority::bulk;
+    case CommandType::build: return CommandPriority::bulk;
+    case CommandType::crypto: return CommandPriority::bulk;
+    case CommandType::backup: return CommandPriority::bulk;
+  }
+  return CommandPriority::interactive;
+}
+
+std::string IpcClient::getCommandPriorityName(CommandPriority priority) {
+  switch (priority) {
+    case CommandPriority::interactive: return "interactive";
+    case CommandPriority::service: return "service";
+    case CommandPriority::bulk: return "bulk";
+  }
+  return "interactive";
+}
+
+int32_t IpcClient::getMaxRunningCommands(CommandPriority priority) {
+  switch (priority) {
+    case CommandPriority::interactive: return GD::settings.maxInteractiveCommands();
+    case CommandPriority::service: return GD::settings.maxServiceCommands();
+    case CommandPriority::bulk: return GD::settings.maxBulkCommands();
+  }
+  return GD::settings.maxCommandThreads();
+}
+
+int32_t IpcClient::startCommandThread(CommandType type, std::string command, bool detach, Ipc::PVariable metadata) {
+  try {
+    if (_disposing) return -1;
+
+    auto commandInfo = std::make_shared<CommandInfo>(GD::settings.commandOutputBufferSize());
+    commandInfo->type = type;
+    commandInfo->priority = getCommandPriority(type);
+    commandInfo->command = std::move(command);
+    commandInfo->detach = detach;
+    commandInfo->metadata = std::move(metadata);
+
+    return queueCommand(commandInfo);
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return -1;
+}
+
+int32_t IpcClient::startInternalCommand(CommandType type,
+                                       std::string description,
+                                       std::function<int32_t(std::string &output)> function,
+                                       Ipc::PVariable metadata,
+                                       std::shared_ptr<BackupEngine::Progress> backupProgress) {
   try {
     if (_disposing) return -1;
 
-    std::unordered_map<int32_t, PCommandInfo> commandInfoCopy;
+    auto commandInfo = std::make_shared<CommandInfo>(GD::settings.commandOutputBufferSize());
+    commandInfo->type = type;
+    commandInfo->priority = getCommandPriority(type);
+    commandInfo->command = std::move(description);
+    commandInfo->function = std::move(function);
+    commandInfo->metadata = std::move(metadata);
+    commandInfo->backupProgress = std::move(backupProgress);
+
+    return queueCommand(commandInfo);
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return -1;
+}
+
+int32_t IpcClient::queueCommand(const PCommandInfo &commandInfo) {
+  try {
+    int32_t currentId = -1;
 
     {
       std::lock_guard<std::mutex> commandInfoGuard(_commandInfoMutex);
-      auto commandInfoCopy = _commandInfo;
+      auto registry = std::make_shared<CommandRegistry>(*_commandInfo);
+
+      while (currentId == -1 || currentId == -2) currentId = _currentCommandInfoId++;
+      commandInfo->id = currentId;
+      registry->emplace(currentId, commandInfo);
+      std::atomic_store(&_commandInfo, PCommandRegistry(std::move(registry)));
     }
 
-    int32_t runningCommands = 0;
+    size_t queueDepth = 0;
+    {
+      std::lock_guard<std::mutex> commandQueueGuard(_commandQueueMutex);
+      auto &commandQueue = _commandQueues.at((size_t)commandInfo->priority);
+      commandQueue.push_back(commandInfo);
+      queueDepth = commandQueue.size();
+    }
+
+    dispatchCommands();
 
-    std::list<int32_t> idsToErase;
-    for (auto &commandInfo: commandInfoCopy) {
-      if (!commandInfo.second->running) {
-        if (Ipc::HelperFunctions::getTime() - commandInfo.second->endTime > 60000) {
-          if (commandInfo.second->thread.joinable()) commandInfo.second->thread.join();
-          idsToErase.push_back(commandInfo.first);
+    if (commandInfo->getState()->queued) {
+      GD::out.printInfo("Info: Maximum number of running commands reached. Command " + std::to_string(currentId) + " was queued (class: " + getCommandPriorityName(commandInfo->priority) + ", queue depth: " + std::to_string(queueDepth) + ").");
+    }
+
+    return currentId;
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return -1;
+}
+
+void IpcClient::commandReaperThread() {
+  int64_t lastCheck = 0;
+  while (true) {
+    std::deque<ExitedCommand> exitedCommands;
+    {
+      std::unique_lock<std::mutex> commandReaperGuard(_commandReaperMutex);
+      _commandReaperConditionVariable.wait_for(commandReaperGuard, std::chrono::seconds(1), [&] { return _stopCommandReaperThread || !_exitedCommands.empty(); });
+      if (_stopCommandReaperThread) return;
+      exitedCommands.swap(_exitedCommands);
+    }
+
+    if (!exitedCommands.empty()) {
+      for (auto &exitedCommand: exitedCommands) {
+        auto resourceUsage = CgroupManager::getResourceUsage(exitedCommand.cgroupPath);
+        _cgroupManager.removeCommandCgroup(exitedCommand.cgroupPath);
+        if (exitedCommand.commandInfo->detach) {
+          //Unless the command already released it through "managementInternalSetReadOnlyTrue". Its slot was released on start.
+          if (exitedCommand.commandInfo->rootWritable.exchange(false)) setRootReadOnly(true);
+          setCommandFinished(exitedCommand.commandInfo, exitedCommand.exitCode, resourceUsage);
+        } else {
+          setRootReadOnly(true);
+          commandFinished(exitedCommand.commandInfo, exitedCommand.exitCode, resourceUsage);
         }
-      } else runningCommands++;
+      }
+      dispatchCommands();
     }
 
-    if (runningCommands >= GD::settings.maxCommandThreads()) return -2;
+    auto time = BaseLib::HelperFunctions::getTime();
+    if (time - lastCheck < 1000) continue;
+    lastCheck = time;
 
-    int32_t currentId = -1;
-    while (currentId == -1 || currentId == -2) currentId = _currentCommandInfoId++;
+    checkCommandTimeouts();
+    reapCommands();
+    _cgroupManager.cleanUp();
+    _uploadSessions.removeExpired(GD::settings.uploadTimeout());
+  }
+}
 
-    auto commandInfo = std::make_shared<CommandInfo>();
-    commandInfo->running = true;
-    commandInfo->command = std::move(command);
-    commandInfo->detach = detach;
-    commandInfo->metadata = metadata;
-    commandInfo->thread = std::thread(&IpcClient::executeCommand, this, commandInfo);
+void IpcClient::reapCommands() {
+  try {
+    struct FinishedCommand {
+      int32_t id = -1;
+      int64_t endTime = 0;
+      size_t memoryUsage = 0;
+    };
+
+    auto registry = getCommandRegistry();
+    auto time = BaseLib::HelperFunctions::getTime();
+    auto spillSize = GD::settings.commandOutputSpillSize();
+    std::vector<FinishedCommand> finishedCommands;
+    finishedCommands.reserve(registry->size());
+    size_t memoryUsage = 0;
+
+    for (auto &entry: *registry) {
+      auto state = entry.second->getState();
+      if (!state->finished) continue;
+
+      FinishedCommand finishedCommand;
+      finishedCommand.id = entry.first;
+      finishedCommand.endTime = state->endTime;
+      {
+        std::lock_guard<std::mutex> outputGuard(entry.second->outputMutex);
+        if (spillSize > 0 && !entry.second->output.spilled() && !entry.second->spillFailed && entry.second->output.size() > spillSize) {
+          if (!entry.second->output.spill(GD::settings.logfilePath() + "homegear-management-command-" + std::to_string(entry.first) + ".log")) {
+            //Not retried, so the warning is only printed once.
+            entry.second->spillFailed = true;
+            GD::out.printWarning("Warning: Could not move output of command " + std::to_string(entry.first) + " to " + GD::settings.logfilePath() + ".");
+          }
+        }
+        finishedCommand.memoryUsage = entry.second->output.memoryUsage();
+      }
+      memoryUsage += finishedCommand.memoryUsage;
+      finishedCommands.push_back(finishedCommand);
+    }
+
+    //Evict oldest first until all limits are met.
+    std::sort(finishedCommands.begin(), finishedCommands.end(), [](const FinishedCommand &a, const FinishedCommand &b) { return a.endTime < b.endTime; });
+    auto entryCount = registry->size();
+    std::unordered_set<int32_t> idsToErase;
+    for (auto &finishedCommand: finishedCommands) {
+      if (time - finishedCommand.endTime <= (int64_t)GD::settings.commandRetentionTime() * 1000 &&
+          entryCount <= GD::settings.maxRetainedCommands() &&
+          memoryUsage <= GD::settings.maxRetainedCommandOutput()) {
+        break;
+      }
+      idsToErase.emplace(finishedCommand.id);
+      entryCount--;
+      memoryUsage -= finishedCommand.memoryUsage;
+    }
+    registry.reset();
+
+    if (idsToErase.empty()) return;
 
+    std::lock_guard<std::mutex> commandInfoGuard(_commandInfoMutex);
+    auto newRegistry = std::make_shared<CommandRegistry>();
+    newRegistry->reserve(_commandInfo->size());
+    for (auto &entry: *_commandInfo) {
+      if (idsToErase.find(entry.first) == idsToErase.end()) newRegistry->emplace(entry.first, entry.second);
+    }
+    std::atomic_store(&_commandInfo, PCommandRegistry(std::move(newRegistry)));
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+}
+
+void IpcClient::checkCommandTimeouts() {
+  try {
+    auto registry = getCommandRegistry();
+    auto time = BaseLib::HelperFunctions::getTime();
+    auto snapshot = GD::settings.snapshot();
+    auto &commandTimeouts = snapshot->commandTimeouts;
+
+    for (auto &entry: *registry) {
+      auto state = entry.second->getState();
+      if (state->queued || state->finished || entry.second->cancelled || entry.second->timedOut) continue;
+      //In process commands can't be terminated unless they check a cancel flag like backups do.
+      if (entry.second->function && !entry.second->backupProgress) continue;
+
+      auto timeoutIterator = commandTimeouts.find(getCommandTypeName(entry.second->type));
+      if (timeoutIterator == commandTimeouts.end() || timeoutIterator->second == 0) continue;
+      if (time - state->startTime < (int64_t)timeoutIterator->second * 1000) continue;
+
+      GD::out.printWarning("Warning: Command " + std::to_string(entry.first) + " timed out after " + std::to_string(timeoutIterator->second) + " seconds: " + entry.second->command);
+      terminateCommand(entry.second, true);
+    }
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+}
+
+bool IpcClient::terminateCommand(const PCommandInfo &commandInfo, bool timedOut) {
+  try {
+    bool removedFromQueue = false;
     {
-      std::lock_guard<std::mutex> commandInfoGuard(_commandInfoMutex);
-      for (auto idToErase: idsToErase) {
-        _commandInfo.erase(idToErase);
+      std::lock_guard<std::mutex> commandQueueGuard(_commandQueueMutex);
+      auto &commandQueue = _commandQueues.at((size_t)commandInfo->priority);
+      auto commandIterator = std::find(commandQueue.begin(), commandQueue.end(), commandInfo);
+      if (commandIterator != commandQueue.end()) {
+        commandQueue.erase(commandIterator);
+        removedFromQueue = true;
       }
+    }
+
+    if (removedFromQueue) {
+      auto state = std::make_shared<CommandState>(*commandInfo->getState());
+      state->queued = false;
+      state->finished = true;
+      state->endTime = BaseLib::HelperFunctions::getTime();
+      state->cancelled = !timedOut;
+      state->timedOut = timedOut;
+      commandInfo->setState(state);
+      queueCommandEvent(commandInfo);
+      return true;
+    }
+
+    if (commandInfo->backupProgress) {
+      if (commandInfo->getState()->finished) return false;
+      if (timedOut) commandInfo->timedOut = true;
+      else commandInfo->cancelled = true;
+      commandInfo->backupProgress->cancel = true;
+      return true;
+    }
+
+    pid_t pid = commandInfo->pid;
+    if (pid == -1 || commandInfo->getState()->finished) return false;
+
+    if (timedOut) commandInfo->timedOut = true;
+    else commandInfo->cancelled = true;
+    if (!_processSupervisor.terminateProcess(pid, (int64_t)GD::settings.commandKillTimeout() * 1000)) {
+      commandInfo->timedOut = false;
+      commandInfo->cancelled = false;
+      return false;
+    }
+    return true;
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return false;
+}
+
+IpcClient::PCommandInfo IpcClient::getCommandInfo(int32_t id) const {
+  auto registry = getCommandRegistry();
+  auto commandIterator = registry->find(id);
+  if (commandIterator == registry->end()) return PCommandInfo();
+  return commandIterator->second;
+}
+
+void IpcClient::dispatchCommands() {
+  try {
+    while (!_disposing) {
+      PCommandInfo commandInfo;
+
+      {
+        std::lock_guard<std::mutex> commandQueueGuard(_commandQueueMutex);
+        if (_runningCommands >= GD::settings.maxCommandThreads()) return;
+
+        //Highest priority first. A class at its limit doesn't block the classes after it.
+        for (size_t i = 0; i < commandPriorityCount; i++) {
+          if (_commandQueues[i].empty() || _runningCommandsByPriority[i] >= getMaxRunningCommands((CommandPriority)i)) continue;
+          commandInfo = _commandQueues[i].front();
+          _commandQueues[i].pop_front();
+          break;
+        }
+        if (!commandInfo) return;
+
+        auto state = std::make_shared<CommandState>(*commandInfo->getState());
+        state->queued = false;
+        state->startTime = BaseLib::HelperFunctions::getTime();
+        commandInfo->setState(state);
+        _runningCommandsByPriority[(size_t)commandInfo->priority]++;
+        _runningCommands++;
+      }
+
+      queueCommandEvent(commandInfo);
+      executeCommand(commandInfo);
+    }
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+}
+
+void IpcClient::executeCommand(const PCommandInfo &commandInfo) {
+  //Once the command has been started, the read-write reference on / and the cgroup belong to it.
+  bool started = false;
+  std::string cgroupPath;
+  try {
+    setRootReadOnly(false);
+
+    if (commandInfo->function) {
+      {
+        std::lock_guard<std::mutex> internalCommandGuard(_internalCommandMutex);
+        _internalCommands.push_back(commandInfo);
+        started = true;
+        //The number of threads is limited by the number of running commands.
+        if (_idleInternalCommandThreads < _internalCommands.size() && !_stopInternalCommandThreads) {
+          _internalCommandThreads.emplace_back(&IpcClient::internalCommandThread, this);
+        }
+      }
+      _internalCommandConditionVariable.notify_one();
+      return;
+    }
+
+    cgroupPath = _cgroupManager.createCommandCgroup(getCommandTypeName(commandInfo->type), commandInfo->id);
+    int cgroupProcsFd = CgroupManager::openProcs(cgroupPath);
+
+    auto exitCallback = [this, commandInfo, cgroupPath](int32_t exitCode) {
+      //Called on the process supervisor's thread, which must not block.
+      {
+        std::lock_guard<std::mutex> commandReaperGuard(_commandReaperMutex);
+        _exitedCommands.push_back(ExitedCommand{commandInfo, exitCode, cgroupPath});
+      }
+      _commandReaperConditionVariable.notify_all();
+    };
+
+    pid_t pid = -1;
+    if (commandInfo->detach) {
+      //Detached commands keep running while Homegear Management is restarted, e.g. by a package upgrade, so they don't
+      //take up a command slot. They stay registered until their process has exited, so they can be cancelled and time out.
+      //Root stays writable until then or until the command calls "managementInternalSetReadOnlyTrue", whichever comes first.
+      commandInfo->rootWritable = true;
+      pid = _processSupervisor.startDetachedProcess(commandInfo->command, exitCallback, cgroupProcsFd);
+    } else {
+      pid = _processSupervisor.startProcess(commandInfo->command,
+                                            [this, commandInfo](const char *data, size_t size) {
+                                              {
+                                                std::lock_guard<std::mutex> outputGuard(commandInfo->outputMutex);
+                                                commandInfo->output.append(data, size);
+                                              }
+                                              queueCommandEvent(commandInfo);
+                                            },
+                                            exitCallback,
+                                            cgroupProcsFd);
+    }
+    if (cgroupProcsFd != -1) close(cgroupProcsFd);
+    started = true;
+    commandInfo->pid = pid;
+    if (pid == -1) {
+      commandInfo->rootWritable = false;
+      _cgroupManager.removeCommandCgroup(cgroupPath);
+      setRootReadOnly(true);
+      commandFinished(commandInfo, -1);
+    } else if (commandInfo->detach) releaseCommandSlot(commandInfo);
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+    if (started) return;
+    if (!cgroupPath.empty()) _cgroupManager.removeCommandCgroup(cgroupPath);
+    setRootReadOnly(true);
+    commandFinished(commandInfo, -1);
+  }
+}
+
+void IpcClient::commandFinished(const PCommandInfo &commandInfo, int32_t exitCode, const CgroupManager::ResourceUsage &resourceUsage) {
+  setCommandFinished(commandInfo, exitCode, resourceUsage);
+  releaseCommandSlot(commandInfo);
+}
+
+void IpcClient::setCommandFinished(const PCommandInfo &commandInfo, int32_t exitCode, const CgroupManager::ResourceUsage &resourceUsage) {
+  try {
+    {
+      std::lock_guard<std::mutex> outputGuard(commandInfo->outputMutex);
+      GD::out.printInfo("Info: Output of command " + commandInfo->command + ":\n" + commandInfo->output.read());
+    }
+    auto state = std::make_shared<CommandState>(*commandInfo->getState());
+    state->queued = false;
+    state->finished = true;
+    state->exitCode = exitCode;
+    state->resourceUsage = resourceUsage;
+    state->cancelled = commandInfo->cancelled;
+    state->timedOut = commandInfo->timedOut;
+    state->endTime = BaseLib::HelperFunctions::getTime();
+    commandInfo->setState(state);
+    queueCommandEvent(commandInfo);
+
+    //An upgrade might have changed the distribution or the dpkg architecture. Detached apt commands install, upgrade or
+    //remove packages, "apt-get update" doesn't change anything probed.
+    if (commandInfo->type == CommandType::apt && commandInfo->detach && commandInfo->pid != -1) GD::systemInfo.load(_dpkgDatabase);
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+}
+
+void IpcClient::releaseCommandSlot(const PCommandInfo &commandInfo) {
+  {
+    std::lock_guard<std::mutex> commandQueueGuard(_commandQueueMutex);
+    _runningCommandsByPriority[(size_t)commandInfo->priority]--;
+    _runningCommands--;
+  }
+  _commandQueueConditionVariable.notify_all();
+}
+
+Ipc::PVariable IpcClient::getResourceUsageVariable(const CgroupManager::ResourceUsage &resourceUsage) {
+  auto result = std::make_shared<Ipc::Variable>(Ipc::VariableType::tStruct);
+  if (resourceUsage.cpuTime >= 0) result->structValue->emplace("cpuTime", std::make_shared<Ipc::Variable>(resourceUsage.cpuTime));
+  if (resourceUsage.peakMemory >= 0) result->structValue->emplace("peakMemory", std::make_shared<Ipc::Variable>(resourceUsage.peakMemory));
+  if (resourceUsage.ioReadBytes >= 0) result->structValue->emplace("ioReadBytes", std::make_shared<Ipc::Variable>(resourceUsage.ioReadBytes));
+  if (resourceUsage.ioWriteBytes >= 0) result->structValue->emplace("ioWriteBytes", std::make_shared<Ipc::Variable>(resourceUsage.ioWriteBytes));
+  return result;
+}
+
+Ipc::PVariable IpcClient::getBackupProgressVariable(const BackupEngine::Progress &progress) {
+  auto result = std::make_shared<Ipc::Variable>(Ipc::VariableType::tStruct);
+  result->structValue->emplace("files", std::make_shared<Ipc::Variable>((int64_t)progress.files));
+  result->structValue->emplace("bytes", std::make_shared<Ipc::Variable>((int64_t)progress.bytes));
+  result->structValue->emplace("compressedBytes", std::make_shared<Ipc::Variable>((int64_t)progress.compressedBytes));
+  return result;
+}
+
+// {{{ RPC methods
+Ipc::PVariable IpcClient::getCommandStatus(Ipc::PArray &parameters) {
+  try {
+    //The optional last parameter is an array of field names to return, e.g. ["finished", "exitCode"].
+    std::unordered_set<std::string> fields;
+    bool filterFields = false;
+    size_t parameterCount = parameters->size();
+    if (parameterCount > 0 && parameters->back()->type == Ipc::VariableType::tArray) {
+      filterFields = true;
+      for (auto &field: *parameters->back()->arrayValue) {
+        if (field->type != Ipc::VariableType::tString) return Ipc::Variable::createError(-1, "Field names need to be of type String.");
+        fields.emplace(field->stringValue);
+      }
+      parameterCount--;
+    }
+
+    if (parameterCount > 2)
+      return Ipc::Variable::createError(-1,
+                                        "Wrong parameter count.");
+    if (parameterCount > 0 && parameters->at(0)->type != Ipc::VariableType::tInteger
+        && parameters->at(0)->type != Ipc::VariableType::tInteger64)
+      return Ipc::Variable::createError(-1, "Parameter 1 is not of type Integer.");
+    if (parameterCount == 2 && parameters->at(1)->type != Ipc::VariableType::tInteger
+        && parameters->at(1)->type != Ipc::VariableType::tInteger64)
+      return Ipc::Variable::createError(-1, "Parameter 2 is not of type Integer.");
+
+    auto wants = [&](const std::string &field) { return !filterFields || fields.find(field) != fields.end(); };
+
+    if (parameterCount == 0) {
+      auto registry = getCommandRegistry();
+
+      auto result = std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray);
+      result->arrayValue->reserve(registry->size());
+      for (auto &commandInfo: *registry) {
+        auto state = commandInfo.second->getState();
+        auto element = std::make_shared<Ipc::Variable>(Ipc::VariableType::tStruct);
+
+        if (wants("id")) element->structValue->emplace("id", std::make_shared<Ipc::Variable>(commandInfo.first));
+        if (wants("finished")) element->structValue->emplace("finished", std::make_shared<Ipc::Variable>(state->finished));
+        if (wants("queued")) element->structValue->emplace("queued", std::make_shared<Ipc::Variable>(state->queued));
+        if (wants("type")) element->structValue->emplace("type", std::make_shared<Ipc::Variable>(getCommandTypeName(commandInfo.second->type)));
+        if (wants("class")) element->structValue->emplace("class", std::make_shared<Ipc::Variable>(getCommandPriorityName(commandInfo.second->priority)));
+        if (wants("metadata")) element->structValue->emplace("metadata", commandInfo.second->metadata);
+        if (commandInfo.second->backupProgress && wants("progress")) element->structValue->emplace("progress", getBackupProgressVariable(*commandInfo.second->backupProgress));
+        if (!state->queued && wants("startTime")) element->structValue->emplace("startTime", std::make_shared<Ipc::Variable>(state->startTime));
+        if (state->finished) {
+          if (wants("endTime")) element->structValue->emplace("endTime", std::make_shared<Ipc::Variable>(state->endTime));
+          if (wants("exitCode")) element->structValue->emplace("exitCode", std::make_shared<Ipc::Variable>(state->exitCode));
+          if (wants("cancelled")) element->structValue->emplace("cancelled", std::make_shared<Ipc::Variable>(state->cancelled));
+          if (wants("timedOut")) element->structValue->emplace("timedOut", std::make_shared<Ipc::Variable>(state->timedOut));
+          if (wants("resourceUsage")) element->structValue->emplace("resourceUsage", getResourceUsageVariable(state->resourceUsage));
+          if (wants("output")) {
+            std::lock_guard<std::mutex> outputGuard(commandInfo.second->outputMutex);
+            element->structValue->emplace("output", std::make_shared<Ipc::Variable>(commandInfo.second->output.read()));
+          }
+        }
+
+        result->arrayValue->emplace_back(element);
+      }
+      return result;
+    } else {
+      int32_t commandId = parameters->at(0)->integerValue;
+
+      auto commandInfo = getCommandInfo(commandId);
+      if (!commandInfo) return Ipc::Variable::createError(-2, "Unknown command ID.");
+
+      auto state = commandInfo->getState();
+      auto result = std::make_shared<Ipc::Variable>(Ipc::VariableType::tStruct);
+      if (wants("finished")) result->structValue->emplace("finished", std::make_shared<Ipc::Variable>(state->finished));
+      if (wants("queued")) result->structValue->emplace("queued", std::make_shared<Ipc::Variable>(state->queued));
+      if (wants("type")) result->structValue->emplace("type", std::make_shared<Ipc::Variable>(getCommandTypeName(commandInfo->type)));
+      if (wants("class")) result->structValue->emplace("class", std::make_shared<Ipc::Variable>(getCommandPriorityName(commandInfo->priority)));
+      if (wants("metadata")) result->structValue->emplace("metadata", commandInfo->metadata);
+      if (commandInfo->backupProgress && wants("progress")) result->structValue->emplace("progress", getBackupProgressVariable(*commandInfo->backupProgress));
+      if (!state->queued && wants("startTime")) result->structValue->emplace("startTime", std::make_shared<Ipc::Variable>(state->startTime));
+      if (state->finished) {
+        if (wants("endTime")) result->structValue->emplace("endTime", std::make_shared<Ipc::Variable>(state->endTime));
+        if (wants("exitCode")) result->structValue->emplace("exitCode", std::make_shared<Ipc::Variable>(state->exitCode));
+        if (wants("cancelled")) result->structValue->emplace("cancelled", std::make_shared<Ipc::Variable>(state->cancelled));
+        if (wants("timedOut")) result->structValue->emplace("timedOut", std::make_shared<Ipc::Variable>(state->timedOut));
+        if (wants("resourceUsage")) result->structValue->emplace("resourceUsage", getResourceUsageVariable(state->resourceUsage));
+      }
+      if (parameterCount == 2) {
+        //Incremental read: Only return output written after the passed cursor, also while the command is running.
+        uint64_t cursor = parameters->at(1)->integerValue64 < 0 ? 0 : (uint64_t)parameters->at(1)->integerValue64;
+        uint64_t nextCursor = 0;
+        bool truncated = false;
+        std::string output;
+        {
+          std::lock_guard<std::mutex> outputGuard(commandInfo->outputMutex);
+          if (wants("output")) output = commandInfo->output.read(cursor, nextCursor, truncated);
+          else nextCursor = commandInfo->output.end();
+        }
+        if (wants("output")) {
+          result->structValue->emplace("output", std::make_shared<Ipc::Variable>(output));
+          result->structValue->emplace("outputTruncated", std::make_shared<Ipc::Variable>(truncated));
+        }
+        result->structValue->emplace("cursor", std::make_shared<Ipc::Variable>((int64_t)nextCursor));
+      } else if (state->finished && wants("output")) {
+        std::lock_guard<std::mutex> outputGuard(commandInfo->outputMutex);
+        result->structValue->emplace("output", std::make_shared<Ipc::Variable>(commandInfo->output.read()));
+      }
+      return result;
+    }
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return Ipc::Variable::createError(-32500, "Unknown application error.");
+}
+
+Ipc::PVariable IpcClient::getCommandQueueStatus(Ipc::PArray &parameters) {
+  try {
+    if (!parameters->empty()) return Ipc::Variable::createError(-1, "Wrong parameter count.");
+
+    int32_t runningCommands = 0;
+    std::array<int32_t, commandPriorityCount> runningCommandsByPriority{};
+    std::array<size_t, commandPriorityCount> queueDepthByPriority{};
+    {
+      std::lock_guard<std::mutex> commandQueueGuard(_commandQueueMutex);
+      runningCommands = _runningCommands;
+      runningCommandsByPriority = _runningCommandsByPriority;
+      for (size_t i = 0; i < commandPriorityCount; i++) {
+        queueDepthByPriority[i] = _commandQueues[i].size();
+      }
+    }
+
+    auto result = std::make_shared<Ipc::Variable>(Ipc::VariableType::tStruct);
+    result->structValue->emplace("maxRunningCommands", std::make_shared<Ipc::Variable>(GD::settings.maxCommandThreads()));
+    result->structValue->emplace("runningCommands", std::make_shared<Ipc::Variable>(runningCommands));
+    size_t queueDepth = 0;
+    auto classes = std::make_shared<Ipc::Variable>(Ipc::VariableType::tStruct);
+    for (size_t i = 0; i < commandPriorityCount; i++) {
+      auto element = std::make_shared<Ipc::Variable>(Ipc::VariableType::tStruct);
+      element->structValue->emplace("maxRunningCommands", std::make_shared<Ipc::Variable>(getMaxRunningCommands((CommandPriority)i)));
+      element->structValue->emplace("runningCommands", std::make_shared<Ipc::Variable>(runningCommandsByPriority[i]));
+      element->structValue->emplace("queueDepth", std::make_shared<Ipc::Variable>((int32_t)queueDepthByPriority[i]));
+      classes->structValue->emplace(getCommandPriorityName((CommandPriority)i), element);
+      queueDepth += queueDepthByPriority[i];
+    }
+    result->structValue->emplace("queueDepth", std::make_shared<Ipc::Variable>((int32_t)queueDepth));
+    result->structValue->emplace("classes", classes);
+    return result;
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return Ipc::Variable::createError(-32500, "Unknown application error.");
+}
+
+Ipc::PVariable IpcClient::subscribeCommand(Ipc::PArray &parameters) {
+  try {
+    if (parameters->size() != 1) return Ipc::Variable::createError(-1, "Wrong parameter count.");
+    if (parameters->at(0)->type != Ipc::VariableType::tInteger
+        && parameters->at(0)->type != Ipc::VariableType::tInteger64)
+      return Ipc::Variable::createError(-1, "Parameter 1 is not of type Integer.");
+
+    auto commandInfo = getCommandInfo(parameters->at(0)->integerValue);
+    if (!commandInfo) return Ipc::Variable::createError(-2, "Unknown command ID.");
+
+    commandInfo->subscribed = true;
 
-      _commandInfo.emplace(currentId, commandInfo);
-    }
+    //Send the current state right away, so no state change between start and subscription is missed.
+    queueCommandEvent(commandInfo);
 
-    return currentId;
+    return std::make_shared<Ipc::Variable>();
   }
   catch (const std::exception &ex) {
     GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
   }
-  return -1;
+  return Ipc::Variable::createError(-32500, "Unknown application error.");
 }
 
-void IpcClient::executeCommand(PCommandInfo commandInfo) {
+Ipc::PVariable IpcClient::cancelCommand(Ipc::PArray &parameters) {
   try {
-    std::string output;
-    if (commandInfo->detach) {
-      setRootReadOnly(false);
-      auto commandStatus = BaseLib::ProcessManager::exec(commandInfo->command, GD::bl->fileDescriptorManager.getMax());
-      std::lock_guard<std::mutex> outputGuard(commandInfo->outputMutex);
-      commandInfo->status = commandStatus ? 0 : -1;
-    } else {
-      setRootReadOnly(false);
-      auto commandStatus =
-          BaseLib::ProcessManager::exec(commandInfo->command, GD::bl->fileDescriptorManager.getMax(), output);
-      setRootReadOnly(true);
+    if (parameters->size() != 1) return Ipc::Variable::createError(-1, "Wrong parameter count.");
+    if (parameters->at(0)->type != Ipc::VariableType::tInteger
+        && parameters->at(0)->type != Ipc::VariableType::tInteger64)
+      return Ipc::Variable::createError(-1, "Parameter 1 is not of type Integer.");
 
-      {
-        std::lock_guard<std::mutex> outputGuard(commandInfo->outputMutex);
-        commandInfo->status = commandStatus;
-        commandInfo->output = std::move(output);
-      }
-    }
-    commandInfo->endTime = BaseLib::HelperFunctions::getTime();
-    GD::out.printInfo("Info: Output of command " + commandInfo->command + ":\n" + commandInfo->output);
+    auto commandInfo = getCommandInfo(parameters->at(0)->integerValue);
+    if (!commandInfo) return Ipc::Variable::createError(-2, "Unknown command ID.");
+
+    if (!terminateCommand(commandInfo, false)) return Ipc::Variable::createError(-3, "Command is not running.");
+
+    return std::make_shared<Ipc::Variable>();
   }
   catch (const std::exception &ex) {
-    commandInfo->status = -1;
     GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
   }
-  commandInfo->running = false;
+  return Ipc::Variable::createError(-32500, "Unknown application error.");
 }
 
-// {{{ RPC methods
-Ipc::PVariable IpcClient::getCommandStatus(Ipc::PArray &parameters) {
+Ipc::PVariable IpcClient::unsubscribeCommand(Ipc::PArray &parameters) {
   try {
-    if (!parameters->empty() && parameters->size() != 1)
-      return Ipc::Variable::createError(-1,
-                                        "Wrong parameter count.");
-    if (parameters->size() == 1 && parameters->at(0)->type != Ipc::VariableType::tInteger
+    if (parameters->size() != 1) return Ipc::Variable::createError(-1, "Wrong parameter count.");
+    if (parameters->at(0)->type != Ipc::VariableType::tInteger
         && parameters->at(0)->type != Ipc::VariableType::tInteger64)
-      return Ipc::Variable::createError(-1, "Parameter is not of type Integer.");
-
-    if (parameters->empty()) {
-      std::unordered_map<int32_t, PCommandInfo> commandInfoCopy;
-
-      {
-        std::lock_guard<std::mutex> commandInfoGuard(_commandInfoMutex);
-        commandInfoCopy = _commandInfo;
-      }
-
-      auto result = std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray);
-      result->arrayValue->reserve(commandInfoCopy.size());
-      for (auto &commandInfo: commandInfoCopy) {
-        auto element = std::make_shared<Ipc::Variable>(Ipc::VariableType::tStruct);
-
-        std::lock_guard<std::mutex> outputGuard(commandInfo.second->outputMutex);
-        element->structValue->emplace("finished", std::make_shared<Ipc::Variable>(!commandInfo.second->running));
-        element->structValue->emplace("metadata", commandInfo.second->metadata);
-        if (!commandInfo.second->running) {
-          element->structValue->emplace("endTime", std::make_shared<Ipc::Variable>(commandInfo.second->endTime));
-          element->structValue->emplace("exitCode", std::make_shared<Ipc::Variable>(commandInfo.second->status));
-          element->structValue->emplace("output", std::make_shared<Ipc::Variable>(commandInfo.second->output));
-        }
+      return Ipc::Variable::createError(-1, "Parameter 1 is not of type Integer.");
 
-        result->arrayValue->emplace_back(element);
-      }
-      return result;
-    } else {
-      int32_t commandId = parameters->at(0)->integerValue;
+    auto commandInfo = getCommandInfo(parameters->at(0)->integerValue);
+    if (!commandInfo) return Ipc::Variable::createError(-2, "Unknown command ID.");
 
-      PCommandInfo commandInfo;
-      {
-        std::lock_guard<std::mutex> commandInfoGuard(_commandInfoMutex);
-        auto commandIterator = _commandInfo.find(commandId);
-        if (commandIterator == _commandInfo.end()) return Ipc::Variable::createError(-2, "Unknown command ID.");
-        commandInfo = commandIterator->second;
-      }
+    commandInfo->subscribed = false;
 
-      auto result = std::make_shared<Ipc::Variable>(Ipc::VariableType::tStruct);
-      std::lock_guard<std::mutex> outputGuard(commandInfo->outputMutex);
-      result->structValue->emplace("finished", std::make_shared<Ipc::Variable>(!commandInfo->running));
-      result->structValue->emplace("metadata", commandInfo->metadata);
-      if (!commandInfo->running) {
-        result->structValue->emplace("endTime", std::make_shared<Ipc::Variable>(commandInfo->endTime));
-        result->structValue->emplace("exitCode", std::make_shared<Ipc::Variable>(commandInfo->status));
-        result->structValue->emplace("output", std::make_shared<Ipc::Variable>(commandInfo->output));
-      }
-      return result;
-    }
+    return std::make_shared<Ipc::Variable>();
   }
   catch (const std::exception &ex) {
     GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
@@ -1094,7 +2128,7 @@ Ipc::PVariable IpcClient::sleep(Ipc::PArray &parameters) {
         && parameters->at(0)->type != Ipc::VariableType::tInteger64)
       return Ipc::Variable::createError(-1, "Parameter 1 is not of type Integer.");
 
-    return std::make_shared<Ipc::Variable>(startCommandThread(
+    return std::make_shared<Ipc::Variable>(startCommandThread(CommandType::generic,
         "sleep " + std::to_string(parameters->at(0)->integerValue)));
   }
   catch (const std::exception &ex) {
@@ -1112,18 +2146,7 @@ Ipc::PVariable IpcClient::dpkgPackageInstalled(Ipc::PArray &parameters) {
 
     auto package = BaseLib::HelperFunctions::stripNonAlphaNumeric(parameters->at(0)->stringValue);
 
-    std::string output;
-    auto commandStatus = BaseLib::ProcessManager::exec(
-        "dpkg-query -W -f '${db:Status-Abbrev}|${binary:Package}\\n' '*' 2>/dev/null | grep '^ii' | awk -F '|' '{print $2}' | cut -d ':' -f 1 | grep ^"
-            + package + "$",
-        GD::bl->fileDescriptorManager.getMax(),
-        output);
-
-    if (commandStatus != 0) return std::make_shared<Ipc::Variable>(false);;
-
-    BaseLib::HelperFunctions::trim(output);
-
-    return std::make_shared<Ipc::Variable>(output == package);
+    return std::make_shared<Ipc::Variable>(_dpkgDatabase.isInstalled(package));
   }
   catch (const std::exception &ex) {
     GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
@@ -1133,37 +2156,21 @@ Ipc::PVariable IpcClient::dpkgPackageInstalled(Ipc::PArray &parameters) {
 
 Ipc::PVariable IpcClient::getSystemInfo(Ipc::PArray &parameters) {
   try {
+    auto systemInfo = GD::systemInfo.get();
     auto info = std::make_shared<Ipc::Variable>(Ipc::VariableType::tStruct);
 
-    {
-      if (GD::settings.system().empty()) {
-        std::string output;
-        auto commandStatus = BaseLib::ProcessManager::exec("lsb_release -i -s | tr '[:upper:]' '[:lower:]'",
-                                                           GD::bl->fileDescriptorManager.getMax(),
-                                                           output);
-        if (commandStatus != 0) return Ipc::Variable::createError(-32500, "Unknown application error.");
-        info->structValue->emplace("system", std::make_shared<Ipc::Variable>(BaseLib::HelperFunctions::trim(output)));
-      } else info->structValue->emplace("system", std::make_shared<Ipc::Variable>(GD::settings.system()));
-    }
-
-    {
-      if (GD::settings.codename().empty()) {
-        std::string output;
-        auto commandStatus =
-            BaseLib::ProcessManager::exec("lsb_release -c -s", GD::bl->fileDescriptorManager.getMax(), output);
-        if (commandStatus != 0) return Ipc::Variable::createError(-32500, "Unknown application error.");
-        info->structValue->emplace("codename", std::make_shared<Ipc::Variable>(BaseLib::HelperFunctions::trim(output)));
-      } else info->structValue->emplace("codename", std::make_shared<Ipc::Variable>(GD::settings.codename()));
-    }
-
-    {
-      std::string output;
-      auto commandStatus =
-          BaseLib::ProcessManager::exec("dpkg --print-architecture", GD::bl->fileDescriptorManager.getMax(), output);
-      if (commandStatus != 0) return Ipc::Variable::createError(-32500, "Unknown application error.");
-      info->structValue->emplace("architecture",
-                                 std::make_shared<Ipc::Variable>(BaseLib::HelperFunctions::trim(output)));
-    }
+    info->structValue->emplace("system", std::make_shared<Ipc::Variable>(GD::settings.system().empty() ? systemInfo->system : GD::settings.system()));
+    info->structValue->emplace("codename", std::make_shared<Ipc::Variable>(GD::settings.codename().empty() ? systemInfo->codename : GD::settings.codename()));
+    info->structValue->emplace("architecture", std::make_shared<Ipc::Variable>(systemInfo->architecture));
+    info->structValue->emplace("prettyName", std::make_shared<Ipc::Variable>(systemInfo->prettyName));
+    info->structValue->emplace("version", std::make_shared<Ipc::Variable>(systemInfo->version));
+    info->structValue->emplace("kernelName", std::make_shared<Ipc::Variable>(systemInfo->kernelName));
+    info->structValue->emplace("kernelVersion", std::make_shared<Ipc::Variable>(systemInfo->kernelVersion));
+    info->structValue->emplace("machine", std::make_shared<Ipc::Variable>(systemInfo->machine));
+    info->structValue->emplace("cpuCount", std::make_shared<Ipc::Variable>(systemInfo->cpuCount));
+    info->structValue->emplace("totalMemory", std::make_shared<Ipc::Variable>(systemInfo->totalMemory));
+    info->structValue->emplace("bootTime", std::make_shared<Ipc::Variable>(systemInfo->bootTime));
+    info->structValue->emplace("uptime", std::make_shared<Ipc::Variable>(SystemInfo::getUptime()));
 
     return info;
   }
@@ -1183,15 +2190,16 @@ Ipc::PVariable IpcClient::serviceCommand(Ipc::PArray &parameters) {
       return Ipc::Variable::createError(-1,
                                         "Parameter 2 is not of type String.");
 
-    auto controllableServices = GD::settings.controllableServices();
-    if (controllableServices.find(parameters->at(0)->stringValue) == controllableServices.end())
+    auto snapshot = GD::settings.snapshot();
+    auto &controllableServices = snapshot->controllableServices;
+    if (!controllableServices.contains(parameters->at(0)->stringValue))
       return Ipc::Variable::createError(-2, "This service is not in the list of allowed services.");
 
-    auto allowedServiceCommands = GD::settings.allowedServiceCommands();
-    if (allowedServiceCommands.find(parameters->at(1)->stringValue) == allowedServiceCommands.end())
+    auto &allowedServiceCommands = snapshot->allowedServiceCommands;
+    if (!allowedServiceCommands.contains(parameters->at(1)->stringValue))
       return Ipc::Variable::createError(-2, "This command is not in the list of allowed service commands.");
 
-    return std::make_shared<Ipc::Variable>(startCommandThread(
+    return std::make_shared<Ipc::Variable>(startCommandThread(CommandType::service,
         "systemctl " + parameters->at(1)->stringValue + " " + parameters->at(0)->stringValue));
   }
   catch (const std::exception &ex) {
@@ -1204,7 +2212,7 @@ Ipc::PVariable IpcClient::reboot(Ipc::PArray &parameters) {
   try {
     if (!parameters->empty()) return Ipc::Variable::createError(-1, "Wrong parameter count.");
 
-    return std::make_shared<Ipc::Variable>(startCommandThread("reboot"));
+    return std::make_shared<Ipc::Variable>(startCommandThread(CommandType::system, "reboot"));
   }
   catch (const std::exception &ex) {
     GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
@@ -1216,7 +2224,7 @@ Ipc::PVariable IpcClient::shutdown(Ipc::PArray &parameters) {
   try {
     if (!parameters->empty()) return Ipc::Variable::createError(-1, "Wrong parameter count.");
 
-    return std::make_shared<Ipc::Variable>(startCommandThread("shutdown -H now"));
+    return std::make_shared<Ipc::Variable>(startCommandThread(CommandType::system, "shutdown -H now"));
   }
   catch (const std::exception &ex) {
     GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
@@ -1238,30 +2246,14 @@ Ipc::PVariable IpcClient::getConfigurationEntry(Ipc::PArray &parameters) {
       return Ipc::Variable::createError(-2, "Configuration file not found.");
     }
 
-    auto &settingsWhitelist = GD::settings.settingsWhitelist();
-
-    for (auto &entry: settingsWhitelist) {
-      std::regex regex(entry.first);
-      if (std::regex_match(parameters->at(0)->stringValue, regex)) {
-        auto settingIterator = entry.second.find(parameters->at(1)->stringValue);
-        if (settingIterator == entry.second.end())
-          return Ipc::Variable::createError(-2,
-                                            "You are not allowed to read this setting.");
-
-        std::string output;
-        BaseLib::ProcessManager::exec("cat /etc/homegear/" + parameters->at(0)->stringValue + " | grep \"^" + parameters->at(1)->stringValue
-                                          + " \"",
-                                      GD::bl->fileDescriptorManager.getMax(),
-                                      output);
-
-        BaseLib::HelperFunctions::trim(output);
-        auto settingPair = BaseLib::HelperFunctions::splitFirst(output, '=');
-        BaseLib::HelperFunctions::trim(settingPair.second);
-        return std::make_shared<Ipc::Variable>(settingPair.second);
-      }
-    }
+    auto whitelistError = checkSettingsWhitelist(parameters->at(0)->stringValue, parameters->at(1)->stringValue, false);
+    if (whitelistError) return whitelistError;
 
-    return Ipc::Variable::createError(-2, "You are not allowed to read this file.");
+    std::string value;
+    auto result = _configurationFiles.get(parameters->at(0)->stringValue, parameters->at(1)->stringValue, value);
+    if (result == ConfigurationFiles::Result::fileNotFound) return Ipc::Variable::createError(-2, "Configuration file not found.");
+    else if (result == ConfigurationFiles::Result::error) return Ipc::Variable::createError(-32500, "Unknown application error.");
+    return std::make_shared<Ipc::Variable>(value);
   }
   catch (const std::exception &ex) {
     GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
@@ -1286,36 +2278,109 @@ Ipc::PVariable IpcClient::setConfigurationEntry(Ipc::PArray &parameters) {
       return Ipc::Variable::createError(-2, "Configuration file not found.");
     }
 
-    auto &settingsWhitelist = GD::settings.settingsWhitelist();
+    //A line break would add another, not whitelisted entry.
+    if (parameters->at(2)->stringValue.find_first_of("\r\n") != std::string::npos) return Ipc::Variable::createError(-1, "Parameter 3 contains a line break.");
 
-    BaseLib::HelperFunctions::stringReplace(parameters->at(2)->stringValue, "/", "\\/");
+    auto whitelistError = checkSettingsWhitelist(parameters->at(0)->stringValue, parameters->at(1)->stringValue, true);
+    if (whitelistError) return whitelistError;
 
-    for (auto &entry: settingsWhitelist) {
-      std::regex regex(entry.first);
-      if (std::regex_match(parameters->at(0)->stringValue, regex)) {
-        auto settingIterator = entry.second.find(parameters->at(1)->stringValue);
-        if (settingIterator == entry.second.end())
-          return Ipc::Variable::createError(-2,
-                                            "You are not allowed to write this setting.");
+    setRootReadOnly(false);
+    auto result = _configurationFiles.set(parameters->at(0)->stringValue, parameters->at(1)->stringValue, parameters->at(2)->stringValue);
+    setRootReadOnly(true);
 
-        BaseLib::HelperFunctions::stringReplace(parameters->at(2)->stringValue, "\n", "\\n");
+    //Like "sed" before, ignore entries which don't exist.
+    if (result == ConfigurationFiles::Result::fileNotFound) return Ipc::Variable::createError(-2, "Configuration file not found.");
+    else if (result == ConfigurationFiles::Result::error) return Ipc::Variable::createError(-32500, "Unknown application error.");
+    return std::make_shared<Ipc::Variable>();
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return Ipc::Variable::createError(-32500, "Unknown application error.");
+}
 
-        setRootReadOnly(false);
+Ipc::PVariable IpcClient::getConfigurationEntries(Ipc::PArray &parameters) {
+  try {
+    if (parameters->size() != 1) return Ipc::Variable::createError(-1, "Wrong parameter count.");
+    if (parameters->at(0)->type != Ipc::VariableType::tArray) return Ipc::Variable::createError(-1, "Parameter is not of type Array.");
+
+    //File name => keys
+    std::map<std::string, std::vector<std::string>> keysByFile;
+    for (auto &entry: *parameters->at(0)->arrayValue) {
+      if (entry->type != Ipc::VariableType::tArray || entry->arrayValue->size() != 2 || entry->arrayValue->at(0)->type != Ipc::VariableType::tString
+          || entry->arrayValue->at(1)->type != Ipc::VariableType::tString) {
+        return Ipc::Variable::createError(-1, "Entries need to be arrays of file name and setting name.");
+      }
 
-        std::string output;
-        BaseLib::ProcessManager::exec(
-            "sed -i \"s/^" + parameters->at(1)->stringValue + " .*/" + parameters->at(1)->stringValue + " = "
-                + parameters->at(2)->stringValue + "/g\" /etc/homegear/" + parameters->at(0)->stringValue,
-            GD::bl->fileDescriptorManager.getMax(),
-            output);
+      auto &filename = entry->arrayValue->at(0)->stringValue;
+      auto &key = entry->arrayValue->at(1)->stringValue;
+      auto whitelistError = checkSettingsWhitelist(filename, key, false);
+      if (whitelistError) return whitelistError;
+      keysByFile[filename].push_back(key);
+    }
 
-        setRootReadOnly(true);
+    std::map<std::string, std::unordered_map<std::string, std::string>> valuesByFile;
+    for (auto &file: keysByFile) {
+      auto result = _configurationFiles.get(file.first, file.second, valuesByFile[file.first]);
+      if (result == ConfigurationFiles::Result::fileNotFound) return Ipc::Variable::createError(-2, "Configuration file not found: " + file.first);
+      else if (result == ConfigurationFiles::Result::error) return Ipc::Variable::createError(-32500, "Unknown application error.");
+    }
 
-        return std::make_shared<Ipc::Variable>();
+    //Values are returned in the order of the request. Entries which don't exist are returned as empty strings.
+    auto values = std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray);
+    values->arrayValue->reserve(parameters->at(0)->arrayValue->size());
+    for (auto &entry: *parameters->at(0)->arrayValue) {
+      auto &fileValues = valuesByFile[entry->arrayValue->at(0)->stringValue];
+      auto valueIterator = fileValues.find(entry->arrayValue->at(1)->stringValue);
+      values->arrayValue->push_back(std::make_shared<Ipc::Variable>(valueIterator == fileValues.end() ? std::string() : valueIterator->second));
+    }
+    return values;
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return Ipc::Variable::createError(-32500, "Unknown application error.");
+}
+
+Ipc::PVariable IpcClient::setConfigurationEntries(Ipc::PArray &parameters) {
+  try {
+    if (parameters->size() != 1) return Ipc::Variable::createError(-1, "Wrong parameter count.");
+    if (parameters->at(0)->type != Ipc::VariableType::tArray) return Ipc::Variable::createError(-1, "Parameter is not of type Array.");
+
+    //All entries are checked before anything is written.
+    std::map<std::string, std::unordered_map<std::string, std::string>> valuesByFile;
+    for (auto &entry: *parameters->at(0)->arrayValue) {
+      if (entry->type != Ipc::VariableType::tArray || entry->arrayValue->size() != 3 || entry->arrayValue->at(0)->type != Ipc::VariableType::tString
+          || entry->arrayValue->at(1)->type != Ipc::VariableType::tString || entry->arrayValue->at(2)->type != Ipc::VariableType::tString) {
+        return Ipc::Variable::createError(-1, "Entries need to be arrays of file name, setting name and value.");
+      }
+
+      auto &filename = entry->arrayValue->at(0)->stringValue;
+      auto &key = entry->arrayValue->at(1)->stringValue;
+      auto &value = entry->arrayValue->at(2)->stringValue;
+      if (value.find_first_of("\r\n") != std::string::npos) return Ipc::Variable::createError(-1, "Value of " + key + " contains a line break.");
+      auto whitelistError = checkSettingsWhitelist(filename, key, true);
+      if (whitelistError) return whitelistError;
+      valuesByFile[filename][key] = value;
+    }
+
+    Ipc::PVariable error;
+    setRootReadOnly(false);
+    for (auto &file: valuesByFile) {
+      //Like "managementSetConfigurationEntry", entries which don't exist are ignored.
+      auto result = _configurationFiles.set(file.first, file.second);
+      if (result == ConfigurationFiles::Result::fileNotFound) {
+        error = Ipc::Variable::createError(-2, "Configuration file not found: " + file.first);
+        break;
+      } else if (result == ConfigurationFiles::Result::error) {
+        error = Ipc::Variable::createError(-32500, "Unknown application error.");
+        break;
       }
     }
+    setRootReadOnly(true);
 
-    return Ipc::Variable::createError(-2, "You are not allowed to write to this file.");
+    if (error) return error;
+    return std::make_shared<Ipc::Variable>();
   }
   catch (const std::exception &ex) {
     GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
@@ -1323,6 +2388,17 @@ Ipc::PVariable IpcClient::setConfigurationEntry(Ipc::PArray &parameters) {
   return Ipc::Variable::createError(-32500, "Unknown application error.");
 }
 
+Ipc::PVariable IpcClient::checkSettingsWhitelist(const std::string &filename, const std::string &key, bool write) {
+  auto snapshot = GD::settings.snapshot();
+  auto settings = snapshot->settingsWhitelist.find(filename);
+  if (!settings) return Ipc::Variable::createError(-2, write ? "You are not allowed to write to this file." : "You are not allowed to read this file.");
+
+  if (!settings->contains(key)) {
+    return Ipc::Variable::createError(-2, write ? "You are not allowed to write this setting." : "You are not allowed to read this setting.");
+  }
+  return Ipc::PVariable();
+}
+
 Ipc::PVariable IpcClient::writeCloudMaticConfig(Ipc::PArray &parameters) {
   try {
     if (parameters->size() != 5) return Ipc::Variable::createError(-1, "Wrong parameter count.");
@@ -1477,6 +2553,10 @@ Ipc::PVariable IpcClient::installNode(Ipc::PArray &parameters) {
 
     auto nodesPath = GD::bl->settings.nodeBluePath() + "nodes/";
 
+    //Archive uploaded with "managementBeginUpload" (type "nodePackage").
+    bool uploadedPackage = url.size() > nodesPath.size() + 7 && url.compare(0, nodesPath.size(), nodesPath) == 0
+        && url.find('/', nodesPath.size()) == std::string::npos && url.compare(url.size() - 7, 7, ".tar.gz") == 0;
+
     if (url.empty()) { //Node-RED node
       auto module = BaseLib::HelperFunctions::stripNonAlphaNumeric(parameters->at(0)->stringValue, std::unordered_set<char>{'@', '/'});
 
@@ -1506,7 +2586,8 @@ Ipc::PVariable IpcClient::installNode(Ipc::PArray &parameters) {
       auto moduleParts = BaseLib::HelperFunctions::splitFirst(module, '/');
       if (!BaseLib::Io::fileExists(nodesPath + moduleParts.first)) {
         GD::out.printInfo("Info: Creating link to node package...");
-        if (BaseLib::ProcessManager::exec("cd \"" + nodesPath + "\"; ln -s \"" + nodeRedNodesPath + "node_modules/" + moduleParts.first + "\" " + moduleParts.first, GD::bl->fileDescriptorManager.getMax(), output) != 0) {
+        if (symlink((nodeRedNodesPath + "node_modules/" + moduleParts.first).c_str(), (nodesPath + moduleParts.first).c_str()) == -1) {
+          output = strerror(errno);
           setRootReadOnly(true);
           Ipc::Output::printError("Error: Could not link node package: " + output);
           return Ipc::Variable::createError(-4, "Could not link node package: " + output);
@@ -1514,7 +2595,7 @@ Ipc::PVariable IpcClient::installNode(Ipc::PArray &parameters) {
       }
 
       setRootReadOnly(true);
-    } else if (url.at(0) == '/') {
+    } else if (url.at(0) == '/' && !uploadedPackage) {
       //Local upload
       auto module = BaseLib::HelperFunctions::stripNonAlphaNumeric(parameters->at(0)->stringValue);
 
@@ -1523,13 +2604,13 @@ Ipc::PVariable IpcClient::installNode(Ipc::PArray &parameters) {
       auto tempPath = parameters->at(1)->stringValue;
       std::string output;
 
-      if (BaseLib::ProcessManager::exec("mv \"" + tempPath + module + "\" \"" + nodesPath + module + "\"", GD::bl->fileDescriptorManager.getMax(), output) != 0) {
-        BaseLib::ProcessManager::exec("rm -Rf \"" + tempPath + "\"", GD::bl->fileDescriptorManager.getMax(), output);
+      if (!FileOperations::move(tempPath + module, nodesPath + module, output)) {
+        FileOperations::remove(tempPath, output);
         setRootReadOnly(true);
         return Ipc::Variable::createError(-4, "Could not move node package: " + output);
       }
 
-      BaseLib::ProcessManager::exec("rm -Rf \"" + tempPath + "\"", GD::bl->fileDescriptorManager.getMax(), output);
+      FileOperations::remove(tempPath, output);
 
       setRootReadOnly(true);
     } else {
@@ -1546,14 +2627,21 @@ Ipc::PVariable IpcClient::installNode(Ipc::PArray &parameters) {
         }
 
         auto packagePath = tempPath + module + ".tar.gz";
-        if (BaseLib::ProcessManager::exec("wget -O '" + packagePath + "' '" + url + "'", GD::bl->fileDescriptorManager.getMax(), output) != 0) {
-          BaseLib::ProcessManager::exec("rm -Rf \"" + tempPath + "\"", GD::bl->fileDescriptorManager.getMax(), output);
+        if (uploadedPackage) {
+          if (rename(url.c_str(), packagePath.c_str()) == -1) {
+            std::string error(strerror(errno));
+            FileOperations::remove(tempPath, output);
+            setRootReadOnly(true);
+            return Ipc::Variable::createError(-2, "Could not move uploaded node package: " + error);
+          }
+        } else if (BaseLib::ProcessManager::exec("wget -O '" + packagePath + "' '" + url + "'", GD::bl->fileDescriptorManager.getMax(), output) != 0) {
+          FileOperations::remove(tempPath, output);
           setRootReadOnly(true);
           return Ipc::Variable::createError(-2, "Could not download node package: " + output);
         }
 
         if (BaseLib::ProcessManager::exec("tar -C '" + tempPath + "' -zxf '" + packagePath + "'", GD::bl->fileDescriptorManager.getMax(), output) != 0) {
-          BaseLib::ProcessManager::exec("rm -Rf \"" + tempPath + "\"", GD::bl->fileDescriptorManager.getMax(), output);
+          FileOperations::remove(tempPath, output);
           setRootReadOnly(true);
           return Ipc::Variable::createError(-3, "Could not extract node package: " + output);
         }
@@ -1562,7 +2650,7 @@ Ipc::PVariable IpcClient::installNode(Ipc::PArray &parameters) {
 
         auto directories = BaseLib::Io::getDirectories(tempPath, false);
         if (directories.empty()) {
-          BaseLib::ProcessManager::exec("rm -Rf \"" + tempPath + "\"", GD::bl->fileDescriptorManager.getMax(), output);
+          FileOperations::remove(tempPath, output);
           setRootReadOnly(true);
           return Ipc::Variable::createError(-3, "Could not find node directory in archive: " + output);
         }
@@ -1570,18 +2658,18 @@ Ipc::PVariable IpcClient::installNode(Ipc::PArray &parameters) {
         auto directory = BaseLib::HelperFunctions::stripNonAlphaNumeric(directories.front());
 
         //Delete old version of module, if it exists (this method is also called for module updates)
-        BaseLib::ProcessManager::exec("rm -Rf \"" + nodesPath + module + "\"", GD::bl->fileDescriptorManager.getMax(), output);
+        if (!FileOperations::remove(nodesPath + module, output)) GD::out.printWarning("Warning: " + output);
 
-        if (BaseLib::ProcessManager::exec("mv \"" + tempPath + directory + "\" \"" + nodesPath + module + "\"", GD::bl->fileDescriptorManager.getMax(), output) != 0) {
-          BaseLib::ProcessManager::exec("rm -Rf \"" + tempPath + "\"", GD::bl->fileDescriptorManager.getMax(), output);
+        if (!FileOperations::move(tempPath + directory, nodesPath + module, output)) {
+          FileOperations::remove(tempPath, output);
           setRootReadOnly(true);
           return Ipc::Variable::createError(-4, "Could not move node package: " + output);
         }
 
-        BaseLib::ProcessManager::exec("rm -Rf \"" + tempPath + "\"", GD::bl->fileDescriptorManager.getMax(), output);
+        FileOperations::remove(tempPath, output);
       } catch (const std::exception &ex) {
         GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
-        BaseLib::ProcessManager::exec("rm -Rf \"" + tempPath + "\"", GD::bl->fileDescriptorManager.getMax(), output);
+        FileOperations::remove(tempPath, output);
         setRootReadOnly(true);
         return Ipc::Variable::createError(-32500, "Unknown application error.");
       }
@@ -1591,7 +2679,7 @@ Ipc::PVariable IpcClient::installNode(Ipc::PArray &parameters) {
       if (BaseLib::Io::fileExists(modulePath + "CMakeLists.txt")) {
         BaseLib::Io::writeFile(modulePath + ".compiling", "");
         setRootReadOnly(true);
-        startCommandThread("mkdir \"" + modulePath + "build\"; cd \"" + modulePath + "build" + "\"; cmake ..; make -j; sleep 10; cd ..; rm -Rf build; rm .compiling", false);
+        startCommandThread(CommandType::build, "mkdir \"" + modulePath + "build\"; cd \"" + modulePath + "build" + "\"; cmake ..; make -j; sleep 10; cd ..; rm -Rf build; rm .compiling", false);
       }
         //}}}
       else setRootReadOnly(true);
@@ -1632,7 +2720,7 @@ Ipc::PVariable IpcClient::uninstallNode(Ipc::PArray &parameters) {
       auto moduleParts = BaseLib::HelperFunctions::splitFirst(module, '/');
       if (BaseLib::Io::linkExists(nodesPath + moduleParts.first) && !BaseLib::Io::directoryExists(nodeRedNodesPath + "node_modules/" + moduleParts.first)) {
         GD::out.printInfo("Info: Removing link...");
-        if (BaseLib::ProcessManager::exec("rm -Rf \"" + nodesPath + moduleParts.first + "\"", GD::bl->fileDescriptorManager.getMax(), output) != 0) {
+        if (!FileOperations::remove(nodesPath + moduleParts.first, output)) {
           setRootReadOnly(true);
           return Ipc::Variable::createError(-1, "Could not remove module.");
         }
@@ -1643,7 +2731,7 @@ Ipc::PVariable IpcClient::uninstallNode(Ipc::PArray &parameters) {
 
       try {
         std::string output;
-        if (BaseLib::ProcessManager::exec("rm -Rf \"" + nodesPath + module + "\"", GD::bl->fileDescriptorManager.getMax(), output) != 0) {
+        if (!FileOperations::remove(nodesPath + module, output)) {
           setRootReadOnly(true);
           return Ipc::Variable::createError(-1, "Could not remove module.");
         }
@@ -1670,25 +2758,18 @@ Ipc::PVariable IpcClient::getNodePackages(Ipc::PArray &parameters) {
 
     Ipc::PVariable result = std::make_shared<Ipc::Variable>(Ipc::VariableType::tStruct);
 
-    std::string output;
-    BaseLib::ProcessManager::exec(R"(apt list --installed 2>/dev/null | grep "^node-blue-node-" | cut -d "/" -f 1)",
-                                  GD::bl->fileDescriptorManager.getMax(),
-                                  output);
-    BaseLib::HelperFunctions::trim(output);
-    auto packages = BaseLib::HelperFunctions::splitAll(output, '\n');
-    for (auto &package: packages) {
-      output.clear();
-      BaseLib::ProcessManager::exec("dpkg-query -L " + package + " 2>/dev/null | grep \".hni$\"",
-                                    GD::bl->fileDescriptorManager.getMax(),
-                                    output);
-      BaseLib::HelperFunctions::trim(output);
-      auto files = BaseLib::HelperFunctions::splitAll(output, '\n');
-      for (auto &file: files) {
+    auto packages = _dpkgDatabase.getInstalledPackages();
+    for (auto &package: *packages) {
+      if (package.first.compare(0, 15, "node-blue-node-") != 0) continue;
+
+      auto files = _dpkgDatabase.getFiles(package.first);
+      for (auto &file: *files) {
+        if (file.size() < 4 || file.compare(file.size() - 4, 4, ".hni") != 0) continue;
         auto parts = BaseLib::HelperFunctions::splitAll(file, '/');
         if (parts.size() < 2) continue;
 
         auto id = parts.at(parts.size() - 2) + '/' + parts.back();
-        result->structValue->emplace(id, std::make_shared<Ipc::Variable>(package));
+        result->structValue->emplace(id, std::make_shared<Ipc::Variable>(package.first));
       }
     }
 
@@ -1720,7 +2801,7 @@ Ipc::PVariable IpcClient::aptUpdate(Ipc::PArray &parameters) {
 
     if (isAptRunning()) return Ipc::Variable::createError(1, "apt is already being executed.");
 
-    return std::make_shared<Ipc::Variable>(startCommandThread("apt-get update", false));
+    return std::make_shared<Ipc::Variable>(startCommandThread(CommandType::apt, "apt-get update", false));
   }
   catch (const std::exception &ex) {
     GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
@@ -1737,27 +2818,18 @@ Ipc::PVariable IpcClient::aptUpgrade(Ipc::PArray &parameters) {
 
     if (isAptRunning()) return Ipc::Variable::createError(1, "apt is already being executed.");
 
-    std::string output;
-    std::ostringstream packages;
-    if (parameters->at(0)->integerValue == 0) {
-      BaseLib::ProcessManager::exec("apt list --upgradable 2>/dev/null |grep -v homegear |grep -v node-blue-node",
-                                    GD::bl->fileDescriptorManager.getMax(),
-                                    output);
-    } else if (parameters->at(0)->integerValue == 1) {
-      BaseLib::ProcessManager::exec("apt list --upgradable 2>/dev/null | grep -e homegear -e node-blue-node",
-                                    GD::bl->fileDescriptorManager.getMax(),
-                                    output);
-    } else return Ipc::Variable::createError(-1, "Parameter has invalid value.");
-
-    auto lines = BaseLib::HelperFunctions::splitAll(output, '\n');
-    for (auto &line: lines) {
-      auto linePair = BaseLib::HelperFunctions::splitFirst(line, '/');
-      if (linePair.second.empty()) continue;
+    if (parameters->at(0)->integerValue != 0 && parameters->at(0)->integerValue != 1) return Ipc::Variable::createError(-1, "Parameter has invalid value.");
+    //0: System packages, 1: Homegear packages
+    bool homegearPackages = parameters->at(0)->integerValue == 1;
 
-      packages << linePair.first << ' ';
+    std::ostringstream packages;
+    auto upgradablePackages = _aptPackageIndex.getUpgradablePackages();
+    for (auto &package: *upgradablePackages) {
+      if (isHomegearPackage(package.name) != homegearPackages) continue;
+      packages << package.name << ' ';
     }
 
-    return std::make_shared<Ipc::Variable>(startCommandThread(
+    return std::make_shared<Ipc::Variable>(startCommandThread(CommandType::apt,
         "DEBIAN_FRONTEND=noninteractive apt-get -f install; DEBIAN_FRONTEND=noninteractive apt-get -o Dpkg::Options::=--force-confold -o Dpkg::Options::=--force-confdef -y install --only-upgrade "
             + packages.str()
             + " >> /tmp/apt.log 2>&1; sleep 60; /usr/bin/homegear -e rc '$hg->managementInternalSetReadOnlyTrue();'",
@@ -1776,13 +2848,14 @@ Ipc::PVariable IpcClient::aptUpgradeSpecific(Ipc::PArray &parameters) {
       return Ipc::Variable::createError(-1,
                                         "Parameter 1 is not of type String.");
 
-    auto packagesWhitelist = GD::settings.packagesWhitelist();
-    if (packagesWhitelist.find(parameters->at(0)->stringValue) == packagesWhitelist.end())
+    auto snapshot = GD::settings.snapshot();
+    auto &packagesWhitelist = snapshot->packagesWhitelist;
+    if (!packagesWhitelist.contains(parameters->at(0)->stringValue))
       return Ipc::Variable::createError(-2, "This package is not in the list of allowed packages.");
 
     if (isAptRunning()) return Ipc::Variable::createError(1, "apt is already being executed.");
 
-    return std::make_shared<Ipc::Variable>(startCommandThread(
+    return std::make_shared<Ipc::Variable>(startCommandThread(CommandType::apt,
         "DEBIAN_FRONTEND=noninteractive apt-get -f install; DEBIAN_FRONTEND=noninteractive apt-get -o Dpkg::Options::=--force-confold -o Dpkg::Options::=--force-confdef -y install --only-upgrade "
             + parameters->at(0)->stringValue
             + " >> /tmp/apt.log 2>&1; sleep 60; /usr/bin/homegear -e rc '$hg->managementInternalSetReadOnlyTrue();'",
@@ -1800,7 +2873,7 @@ Ipc::PVariable IpcClient::aptFullUpgrade(Ipc::PArray &parameters) {
 
     if (isAptRunning()) return Ipc::Variable::createError(1, "apt is already being executed.");
 
-    return std::make_shared<Ipc::Variable>(startCommandThread(
+    return std::make_shared<Ipc::Variable>(startCommandThread(CommandType::apt,
         "DEBIAN_FRONTEND=noninteractive apt-get -f install; DEBIAN_FRONTEND=noninteractive apt-get -y dist-upgrade >> /tmp/apt.log 2>&1; sleep 60; /usr/bin/homegear -e rc '$hg->managementInternalSetReadOnlyTrue();'",
         true));
   }
@@ -1814,18 +2887,40 @@ Ipc::PVariable IpcClient::homegearUpdateAvailable(Ipc::PArray &parameters) {
   try {
     if (!parameters->empty()) return Ipc::Variable::createError(-1, "Wrong parameter count.");
 
-    std::string output;
-    BaseLib::ProcessManager::exec("apt list --upgradable 2>/dev/null | grep homegear",
-                                  GD::bl->fileDescriptorManager.getMax(),
-                                  output);
+    auto upgradablePackages = _aptPackageIndex.getUpgradablePackages();
+    for (auto &package: *upgradablePackages) {
+      if (package.name.find("homegear") == std::string::npos) continue;
+
+      auto splitVersion = BaseLib::HelperFunctions::splitFirst(package.candidateVersion, '-').first;
+      splitVersion = BaseLib::HelperFunctions::splitFirst(splitVersion, '~').first;
+      return std::make_shared<Ipc::Variable>(splitVersion);
+    }
 
-    if (output.empty()) return std::make_shared<Ipc::Variable>(false);
+    return std::make_shared<Ipc::Variable>(false);
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return Ipc::Variable::createError(-32500, "Unknown application error.");
+}
 
-    auto splitLine = BaseLib::HelperFunctions::splitAll(output, ' ');
-    auto splitVersion = BaseLib::HelperFunctions::splitFirst(splitLine.at(1), '-').first;
-    splitVersion = BaseLib::HelperFunctions::splitFirst(splitVersion, '~').first;
+Ipc::PVariable IpcClient::getUpgradablePackages(Ipc::PArray &parameters) {
+  try {
+    if (!parameters->empty()) return Ipc::Variable::createError(-1, "Wrong parameter count.");
 
-    return std::make_shared<Ipc::Variable>(splitVersion);
+    auto upgradablePackages = _aptPackageIndex.getUpgradablePackages();
+    auto result = std::make_shared<Ipc::Variable>(Ipc::VariableType::tArray);
+    result->arrayValue->reserve(upgradablePackages->size());
+    for (auto &package: *upgradablePackages) {
+      auto element = std::make_shared<Ipc::Variable>(Ipc::VariableType::tStruct);
+      element->structValue->emplace("name", std::make_shared<Ipc::Variable>(package.name));
+      element->structValue->emplace("architecture", std::make_shared<Ipc::Variable>(package.architecture));
+      element->structValue->emplace("installedVersion", std::make_shared<Ipc::Variable>(package.installedVersion));
+      element->structValue->emplace("candidateVersion", std::make_shared<Ipc::Variable>(package.candidateVersion));
+      element->structValue->emplace("homegearPackage", std::make_shared<Ipc::Variable>(isHomegearPackage(package.name)));
+      result->arrayValue->push_back(element);
+    }
+    return result;
   }
   catch (const std::exception &ex) {
     GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
@@ -1837,16 +2932,12 @@ Ipc::PVariable IpcClient::systemUpdateAvailable(Ipc::PArray &parameters) {
   try {
     if (!parameters->empty()) return Ipc::Variable::createError(-1, "Wrong parameter count.");
 
-    std::string output;
-    BaseLib::ProcessManager::exec("apt list --upgradable 2>/dev/null | grep -c -v homegear",
-                                  GD::bl->fileDescriptorManager.getMax(),
-                                  output);
-
-    BaseLib::HelperFunctions::trim(output);
-    auto count = BaseLib::Math::getNumber(output);
+    auto upgradablePackages = _aptPackageIndex.getUpgradablePackages();
+    for (auto &package: *upgradablePackages) {
+      if (package.name.find("homegear") == std::string::npos) return std::make_shared<Ipc::Variable>(true);
+    }
 
-    //The exec above returns "Listing..." (count == 1) when no update is available
-    return std::make_shared<Ipc::Variable>(count > 1);
+    return std::make_shared<Ipc::Variable>(false);
   }
   catch (const std::exception &ex) {
     GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
@@ -1863,13 +2954,14 @@ Ipc::PVariable IpcClient::aptInstall(Ipc::PArray &parameters) {
       return Ipc::Variable::createError(-1,
                                         "Parameter 1 is not of type String.");
 
-    auto packagesWhitelist = GD::settings.packagesWhitelist();
-    if (packagesWhitelist.find(parameters->at(0)->stringValue) == packagesWhitelist.end())
+    auto snapshot = GD::settings.snapshot();
+    auto &packagesWhitelist = snapshot->packagesWhitelist;
+    if (!packagesWhitelist.contains(parameters->at(0)->stringValue))
       return Ipc::Variable::createError(-2, "This package is not in the list of allowed packages.");
 
     if (isAptRunning()) return Ipc::Variable::createError(1, "apt is already being executed.");
 
-    return std::make_shared<Ipc::Variable>(startCommandThread(
+    return std::make_shared<Ipc::Variable>(startCommandThread(CommandType::apt,
         "DEBIAN_FRONTEND=noninteractive apt-get update; DEBIAN_FRONTEND=noninteractive apt-get -f install; DEBIAN_FRONTEND=noninteractive apt-get -o Dpkg::Options::=\"--force-overwrite\" -y install "
             + parameters->at(0)->stringValue
             + " >> /tmp/apt.log 2>&1; sleep 60; /usr/bin/homegear -e rc '$hg->managementInternalSetReadOnlyTrue();'",
@@ -1888,17 +2980,18 @@ Ipc::PVariable IpcClient::aptRemove(Ipc::PArray &parameters) {
       return Ipc::Variable::createError(-1,
                                         "Parameter 1 is not of type String.");
 
-    auto packagesBlacklist = GD::settings.packagesBlacklist();
-    if (packagesBlacklist.find(parameters->at(0)->stringValue) != packagesBlacklist.end())
+    auto snapshot = GD::settings.snapshot();
+    auto &packagesBlacklist = snapshot->packagesBlacklist;
+    if (packagesBlacklist.contains(parameters->at(0)->stringValue))
       return Ipc::Variable::createError(-2, "You are not allowed to deinstall this package.");
 
-    auto packagesWhitelist = GD::settings.packagesWhitelist();
-    if (packagesWhitelist.find(parameters->at(0)->stringValue) == packagesWhitelist.end())
+    auto &packagesWhitelist = snapshot->packagesWhitelist;
+    if (!packagesWhitelist.contains(parameters->at(0)->stringValue))
       return Ipc::Variable::createError(-2, "This package is not in the list of allowed packages.");
 
     if (isAptRunning()) return Ipc::Variable::createError(1, "apt is already being executed.");
 
-    return std::make_shared<Ipc::Variable>(startCommandThread(
+    return std::make_shared<Ipc::Variable>(startCommandThread(CommandType::apt,
         "DEBIAN_FRONTEND=noninteractive apt-get -y remove --purge " + parameters->at(0)->stringValue
             + " >> /tmp/apt.log 2>&1; sleep 60; /usr/bin/homegear -e rc '$hg->managementInternalSetReadOnlyTrue();'",
         true));
@@ -1934,12 +3027,24 @@ Ipc::PVariable IpcClient::createBackup(Ipc::PArray &parameters) {
     auto metadata = std::make_shared<Ipc::Variable>(Ipc::VariableType::tStruct);
     metadata->structValue->emplace("filename", std::make_shared<Ipc::Variable>(file));
 
+    auto backupPaths = GD::settings.backupPaths();
+    if (!backupPaths.empty()) {
+      auto progress = std::make_shared<BackupEngine::Progress>();
+      auto threads = GD::settings.backupThreads();
+      return std::make_shared<Ipc::Variable>(startInternalCommand(CommandType::backup, "createBackup " + file, [file, backupPaths, threads, progress](std::string &output) {
+        BackupEngine backupEngine(backupPaths, threads, *progress);
+        if (!backupEngine.create(file, output)) return 1;
+        output.append("Created backup \"" + file + "\" with " + std::to_string(progress->files) + " files.\n");
+        return 0;
+      }, metadata, progress));
+    }
+
     auto backup_script = GD::settings.BackupScript();
     if (!BaseLib::Io::fileExists(backup_script)) {
       return Ipc::Variable::createError(-2, R"(Backup script file not found. Please check the setting "backupScript" in "management.conf".)");
     }
 
-    return std::make_shared<Ipc::Variable>(startCommandThread(backup_script + " " + file, false, metadata));
+    return std::make_shared<Ipc::Variable>(startCommandThread(CommandType::backup, backup_script + " " + file, false, metadata));
   }
   catch (const std::exception &ex) {
     GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
@@ -1957,7 +3062,7 @@ Ipc::PVariable IpcClient::restoreBackup(Ipc::PArray &parameters) {
       return Ipc::Variable::createError(-1,
                                         "Parameter 1 is not a valid file.");
 
-    return std::make_shared<Ipc::Variable>(startCommandThread(
+    return std::make_shared<Ipc::Variable>(startCommandThread(CommandType::backup,
         "chown root:root /var/lib/homegear/scripts/RestoreHomegear.sh;chmod 750 /var/lib/homegear/scripts/RestoreHomegear.sh;cp -a /var/lib/homegear/scripts/RestoreHomegear.sh /;/RestoreHomegear.sh \""
             + parameters->at(0)->stringValue + "\";rm -f /RestoreHomegear.sh"));
   }
@@ -1971,7 +3076,7 @@ Ipc::PVariable IpcClient::restoreBackup(Ipc::PArray &parameters) {
 // {{{ System reset
 Ipc::PVariable IpcClient::systemReset(Ipc::PArray &parameters) {
   try {
-    return std::make_shared<Ipc::Variable>(startCommandThread(
+    return std::make_shared<Ipc::Variable>(startCommandThread(CommandType::system,
         "chown root:root /var/lib/homegear/scripts/SystemReset.sh;chmod 750 /var/lib/homegear/scripts/SystemReset.sh;cp -a /var/lib/homegear/scripts/SystemReset.sh /;/SystemReset.sh;rm -f /SystemReset.sh 2>&1; sleep 60; /usr/bin/homegear -e rc '$hg->managementInternalSetReadOnlyTrue();'",
         true));
   }
@@ -1996,23 +3101,7 @@ Ipc::PVariable IpcClient::caExists(Ipc::PArray &parameters) {
 
 Ipc::PVariable IpcClient::createCa(Ipc::PArray &parameters) {
   try {
-    if (BaseLib::Io::directoryExists("/etc/homegear/ca")
-        && BaseLib::Io::fileExists("/etc/homegear/ca/private/cakey.pem"))
-      return std::make_shared<Ipc::Variable>(false);
-
-    setRootReadOnly(false);
-
-    std::string output;
-    BaseLib::ProcessManager::exec(
-        "mkdir /etc/homegear/ca /etc/homegear/ca/newcerts /etc/homegear/ca/certs /etc/homegear/ca/crl /etc/homegear/ca/private /etc/homegear/ca/requests",
-        GD::bl->fileDescriptorManager.getMax(),
-        output);
-    BaseLib::ProcessManager::exec("touch /etc/homegear/ca/index.txt", GD::bl->fileDescriptorManager.getMax(), output);
-    BaseLib::ProcessManager::exec("echo \"1000\" > /etc/homegear/ca/serial",
-                                  GD::bl->fileDescriptorManager.getMax(),
-                                  output);
-
-    setRootReadOnly(true);
+    if (_certificateAuthority.exists()) return std::make_shared<Ipc::Variable>(false);
 
     std::string uuid =
         BaseLib::HelperFunctions::getHexString(BaseLib::HelperFunctions::getRandomNumber(-2147483648, 2147483647), 8)
@@ -2024,9 +3113,17 @@ Ipc::PVariable IpcClient::createCa(Ipc::PArray &parameters) {
                                                                                                  2147483647), 8));
     uuid.append(BaseLib::HelperFunctions::getHexString(BaseLib::HelperFunctions::getRandomNumber(0, 65535), 4));
 
-    return std::make_shared<Ipc::Variable>(startCommandThread(
-        "cd /etc/homegear/ca && openssl genrsa -out /etc/homegear/ca/private/cakey.pem 4096 && chmod 400 /etc/homegear/ca/private/cakey.pem && chown root:root /etc/homegear/ca/private/cakey.pem && openssl req -config /etc/homegear/openssl.cnf -new -x509 -key /etc/homegear/ca/private/cakey.pem -out /etc/homegear/ca/cacert.pem -days 100000 -set_serial 0 -subj \"/C=HG/ST=HG/L=HG/O=HG/CN=Homegear CA "
-            + uuid + "\""));
+    std::string commonName = "Homegear CA " + uuid;
+    return std::make_shared<Ipc::Variable>(startInternalCommand(CommandType::crypto, "createCa " + commonName, [this, commonName](std::string &output) {
+      std::string error;
+      if (!_certificateAuthority.create(commonName, error)) {
+        output = "Error: " + error + "\n";
+        return 1;
+      }
+      output = "Created CA \"" + commonName + "\".\n";
+      _certificateKeyPool.notify();
+      return 0;
+    }));
   }
   catch (const std::exception &ex) {
     GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
@@ -2041,9 +3138,7 @@ Ipc::PVariable IpcClient::createCert(Ipc::PArray &parameters) {
       return Ipc::Variable::createError(-1,
                                         "Parameter is not of type String.");
 
-    if (!BaseLib::Io::directoryExists("/etc/homegear/ca")
-        || !BaseLib::Io::fileExists("/etc/homegear/ca/private/cakey.pem"))
-      return Ipc::Variable::createError(-2, "No CA found.");
+    if (!_certificateAuthority.exists()) return Ipc::Variable::createError(-2, "No CA found.");
 
     std::string commonName;
     commonName.reserve(parameters->at(0)->stringValue.size());
@@ -2054,12 +3149,10 @@ Ipc::PVariable IpcClient::createCert(Ipc::PArray &parameters) {
 
     std::string filename = BaseLib::HelperFunctions::stripNonAlphaNumeric(commonName);
 
-    std::string output;
-    BaseLib::ProcessManager::exec("cat /etc/homegear/ca/index.txt | grep -c \"CN=" + commonName + "$\"",
-                                  GD::bl->fileDescriptorManager.getMax(),
-                                  output);
-    BaseLib::HelperFunctions::trim(output);
-    if (output != "0") return Ipc::Variable::createError(-3, "A certificate with this common name already exists.");
+    if (_certificateAuthority.commonNameExists(commonName)) return Ipc::Variable::createError(-3, "A certificate with this common name already exists.");
+
+    CertificateKeyPool::KeyType keyType = CertificateKeyPool::KeyType::rsa4096;
+    CertificateKeyPool::getKeyType(GD::settings.certificateKeyType(), keyType);
 
     auto metadata = std::make_shared<Ipc::Variable>(Ipc::VariableType::tStruct);
     metadata->structValue->emplace("filenamePrefix", std::make_shared<Ipc::Variable>(filename));
@@ -2070,14 +3163,15 @@ Ipc::PVariable IpcClient::createCert(Ipc::PArray &parameters) {
     metadata->structValue->emplace("keyPath",
                                    std::make_shared<Ipc::Variable>("/etc/homegear/ca/private/" + filename + ".key"));
 
-    return std::make_shared<Ipc::Variable>(startCommandThread("cd /etc/homegear/ca; openssl genrsa -out private/" + filename + ".key 4096; chown homegear:homegear private/"
-                                                                  + filename + ".key; chmod 440 private/" + filename
-                                                                  + ".key; openssl req -config /etc/homegear/openssl.cnf -new -key private/" + filename
-                                                                  + ".key -out newcert.csr -subj \"/C=HG/ST=HG/L=HG/O=HG/CN=" + commonName
-                                                                  + "\"; openssl ca -config /etc/homegear/openssl.cnf -in newcert.csr -out certs/" + filename
-                                                                  + ".crt -days 100000 -batch; rm newcert.csr",
-                                                              false,
-                                                              metadata));
+    return std::make_shared<Ipc::Variable>(startInternalCommand(CommandType::crypto, "createCert " + commonName, [this, commonName, filename, keyType](std::string &output) {
+      std::string error;
+      if (!_certificateAuthority.createCertificate(commonName, filename, "homegear", keyType, error)) {
+        output = "Error: " + error + "\n";
+        return 1;
+      }
+      output = "Created certificate \"" + commonName + "\".\n";
+      return 0;
+    }, metadata));
   }
   catch (const std::exception &ex) {
     GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
@@ -2092,11 +3186,7 @@ Ipc::PVariable IpcClient::deleteCert(Ipc::PArray &parameters) {
       return Ipc::Variable::createError(-1,
                                         "Parameter is not of type String.");
 
-    if (!BaseLib::Io::directoryExists("/etc/homegear/ca")
-        || !BaseLib::Io::fileExists("/etc/homegear/ca/private/cakey.pem"))
-      return Ipc::Variable::createError(-2, "No CA found.");
-
-    setRootReadOnly(false);
+    if (!_certificateAuthority.exists()) return Ipc::Variable::createError(-2, "No CA found.");
 
     std::string commonName;
     commonName.reserve(parameters->at(0)->stringValue.size());
@@ -2107,34 +3197,10 @@ Ipc::PVariable IpcClient::deleteCert(Ipc::PArray &parameters) {
 
     std::string filename = BaseLib::HelperFunctions::stripNonAlphaNumeric(commonName);
 
-    std::string output;
-    BaseLib::ProcessManager::exec("cat /etc/homegear/ca/index.txt | grep -c \"CN=" + commonName + "\"",
-                                  GD::bl->fileDescriptorManager.getMax(),
-                                  output);
-    BaseLib::HelperFunctions::trim(output);
-    bool fileExists = output != "0" || BaseLib::Io::fileExists("/etc/homegear/ca/certs/" + filename + ".crt")
-        || BaseLib::Io::fileExists("/etc/homegear/ca/private/" + filename + ".key");
-    if (!fileExists) {
-      setRootReadOnly(true);
-      return std::make_shared<Ipc::Variable>(1);
-    }
-
-    BaseLib::ProcessManager::exec(
-        "sed -i \"/.*CN=" + commonName + "$/d\" /etc/homegear/ca/index.txt; rm -f /etc/homegear/ca/certs/" + filename
-            + ".crt; rm -f /etc/homegear/ca/private/" + filename + ".key; sync",
-        GD::bl->fileDescriptorManager.getMax(),
-        output);
-
-    output.clear();
-    BaseLib::ProcessManager::exec("cat /etc/homegear/ca/index.txt | grep -c \"CN=" + commonName + "\"",
-                                  GD::bl->fileDescriptorManager.getMax(),
-                                  output);
-    BaseLib::HelperFunctions::trim(output);
-    fileExists = output != "0" || BaseLib::Io::fileExists("/etc/homegear/ca/certs/" + filename + ".crt")
-        || BaseLib::Io::fileExists("/etc/homegear/ca/private/" + filename + ".key");
+    setRootReadOnly(false);
+    auto result = _certificateAuthority.deleteCertificate(commonName, filename);
     setRootReadOnly(true);
-    if (!fileExists) return std::make_shared<Ipc::Variable>(0);
-    else return std::make_shared<Ipc::Variable>(-1);
+    return std::make_shared<Ipc::Variable>(result);
   }
   catch (const std::exception &ex) {
     GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
@@ -2434,13 +3500,13 @@ Ipc::PVariable IpcClient::copyDeviceDescriptionFile(Ipc::PArray &parameters) {
     auto filepath = "/etc/homegear/devices/" + std::to_string(parameters->at(1)->integerValue) + "/"
         + BaseLib::HelperFunctions::splitLast(parameters->at(0)->stringValue, '/').second;
 
-    auto result = std::make_shared<Ipc::Variable>(GD::bl->io.copyFile(parameters->at(0)->stringValue, filepath));
-
-    chmod(filepath.c_str(), S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    std::string error;
+    bool result = FileOperations::copyFile(parameters->at(0)->stringValue, filepath, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH, error);
+    if (!result) GD::out.printError("Error: " + error);
 
     setRootReadOnly(true);
 
-    return result;
+    return std::make_shared<Ipc::Variable>(result);
   }
   catch (const std::exception &ex) {
     GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
@@ -2470,23 +3536,29 @@ Ipc::PVariable IpcClient::uploadDeviceDescriptionFile(Ipc::PArray &parameters) {
 
     bool isBase64 = parameters->size() > 3 && parameters->at(3)->booleanValue;
 
-    setRootReadOnly(false);
+    //A single chunk upload, so the file is replaced atomically.
+    std::string id;
+    //Committed within this call, so it doesn't count against "maxUploadSessions".
+    auto result = _uploadSessions.begin(filepath, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH, std::numeric_limits<uint64_t>::max(), std::numeric_limits<size_t>::max(), false, id);
+    if (result != UploadSessions::Result::ok) return getUploadError(result);
 
+    uint64_t size = 0;
     if (isBase64) {
       std::string content;
       BaseLib::Base64::decode(parameters->at(1)->stringValue, content);
-      BaseLib::Io::writeFile(filepath, content);
+      result = _uploadSessions.append(id, 0, content.data(), content.size(), size);
+    } else if (parameters->at(1)->type == Ipc::VariableType::tBinary) {
+      result = _uploadSessions.append(id, 0, (const char *)parameters->at(1)->binaryValue.data(), parameters->at(1)->binaryValue.size(), size);
     } else {
-      if (parameters->at(1)->type == Ipc::VariableType::tBinary)
-        BaseLib::Io::writeFile(filepath,
-                               parameters->at(1)->binaryValue,
-                               parameters->at(1)->binaryValue.size());
-      else BaseLib::Io::writeFile(filepath, parameters->at(1)->stringValue);
+      result = _uploadSessions.append(id, 0, parameters->at(1)->stringValue.data(), parameters->at(1)->stringValue.size(), size);
+    }
+    if (result != UploadSessions::Result::ok) {
+      _uploadSessions.abort(id);
+      return getUploadError(result);
     }
 
-    chmod(filepath.c_str(), S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-
-    setRootReadOnly(true);
+    result = _uploadSessions.commit(id, "", filepath);
+    if (result != UploadSessions::Result::ok) return getUploadError(result);
 
     return std::make_shared<Ipc::Variable>();
   }
@@ -2497,13 +3569,152 @@ Ipc::PVariable IpcClient::uploadDeviceDescriptionFile(Ipc::PArray &parameters) {
 }
 // }}}
 
+// {{{ Uploads
+Ipc::PVariable IpcClient::getUploadError(UploadSessions::Result result) {
+  switch (result) {
+    case UploadSessions::Result::ok: return std::make_shared<Ipc::Variable>();
+    case UploadSessions::Result::sessionNotFound: return Ipc::Variable::createError(-2, "Unknown upload ID.");
+    case UploadSessions::Result::invalidOffset: return Ipc::Variable::createError(-3, "Invalid offset.");
+    case UploadSessions::Result::tooLarge: return Ipc::Variable::createError(-4, "The upload exceeds the maximum size.");
+    case UploadSessions::Result::checksumMismatch: return Ipc::Variable::createError(-5, "Checksum mismatch. The upload was discarded.");
+    case UploadSessions::Result::tooManySessions: return Ipc::Variable::createError(-6, "Too many uploads in progress.");
+    case UploadSessions::Result::error: break;
+  }
+  return Ipc::Variable::createError(-32500, "Unknown application error.");
+}
+
+Ipc::PVariable IpcClient::beginUpload(Ipc::PArray &parameters) {
+  try {
+    if (parameters->size() != 2) return Ipc::Variable::createError(-1, "Wrong parameter count.");
+    if (parameters->at(0)->type != Ipc::VariableType::tString) return Ipc::Variable::createError(-1, "Parameter 1 is not of type String.");
+    if (parameters->at(1)->type != Ipc::VariableType::tStruct) return Ipc::Variable::createError(-1, "Parameter 2 is not of type Struct.");
+
+    std::string destination;
+    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+    auto &type = parameters->at(0)->stringValue;
+    auto &uploadParameters = parameters->at(1)->structValue;
+    if (type == "deviceDescriptionFile") {
+      auto filenameIterator = uploadParameters->find("filename");
+      auto familyIdIterator = uploadParameters->find("familyId");
+      if (filenameIterator == uploadParameters->end() || filenameIterator->second->type != Ipc::VariableType::tString) {
+        return Ipc::Variable::createError(-1, "\"filename\" is missing or not of type String.");
+      }
+      if (familyIdIterator == uploadParameters->end() || (familyIdIterator->second->type != Ipc::VariableType::tInteger && familyIdIterator->second->type != Ipc::VariableType::tInteger64)) {
+        return Ipc::Variable::createError(-1, "\"familyId\" is missing or not of type Integer.");
+      }
+
+      std::string filename = filenameIterator->second->stringValue;
+      BaseLib::HelperFunctions::stripNonPrintable(filename);
+      auto filenamePair = BaseLib::HelperFunctions::splitLast(filename, '/');
+      filename = filenamePair.second.empty() ? filenamePair.first : filenamePair.second;
+      if (filename.empty() || filename == "." || filename == "..") return Ipc::Variable::createError(-1, "Invalid file name.");
+      destination = "/etc/homegear/devices/" + std::to_string(familyIdIterator->second->integerValue) + "/" + filename;
+    } else if (type == "nodePackage") {
+      //Picked up by "managementInstallNode".
+      destination = GD::bl->settings.nodeBluePath() + "nodes/" + BaseLib::HelperFunctions::getHexString(BaseLib::HelperFunctions::getRandomBytes(16)) + ".tar.gz";
+      mode = S_IRUSR | S_IWUSR;
+    } else return Ipc::Variable::createError(-1, "Unknown upload type.");
+
+    std::string id;
+    //Packages not installed within "uploadTimeout" are deleted.
+    auto result = _uploadSessions.begin(destination, mode, GD::settings.maxUploadSize(), GD::settings.maxUploadSessions(), type == "nodePackage", id);
+    if (result != UploadSessions::Result::ok) return getUploadError(result);
+    return std::make_shared<Ipc::Variable>(id);
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return Ipc::Variable::createError(-32500, "Unknown application error.");
+}
+
+Ipc::PVariable IpcClient::appendUpload(Ipc::PArray &parameters) {
+  try {
+    if (parameters->size() < 3 || parameters->size() > 4) return Ipc::Variable::createError(-1, "Wrong parameter count.");
+    if (parameters->at(0)->type != Ipc::VariableType::tString) return Ipc::Variable::createError(-1, "Parameter 1 is not of type String.");
+    if (parameters->at(1)->type != Ipc::VariableType::tInteger && parameters->at(1)->type != Ipc::VariableType::tInteger64) {
+      return Ipc::Variable::createError(-1, "Parameter 2 is not of type Integer64.");
+    }
+    if (parameters->at(2)->type != Ipc::VariableType::tBinary && parameters->at(2)->type != Ipc::VariableType::tString) {
+      return Ipc::Variable::createError(-1, "Parameter 3 is not of type Binary or String.");
+    }
+    int64_t offset = parameters->at(1)->type == Ipc::VariableType::tInteger ? parameters->at(1)->integerValue : parameters->at(1)->integerValue64;
+    if (offset < 0) return Ipc::Variable::createError(-1, "Parameter 2 is negative.");
+
+    bool isBase64 = parameters->size() > 3 && parameters->at(3)->booleanValue;
+
+    uint64_t size = 0;
+    UploadSessions::Result result;
+    if (isBase64) {
+      std::string chunk;
+      BaseLib::Base64::decode(parameters->at(2)->stringValue, chunk);
+      result = _uploadSessions.append(parameters->at(0)->stringValue, (uint64_t)offset, chunk.data(), chunk.size(), size);
+    } else if (parameters->at(2)->type == Ipc::VariableType::tBinary) {
+      result = _uploadSessions.append(parameters->at(0)->stringValue, (uint64_t)offset, (const char *)parameters->at(2)->binaryValue.data(), parameters->at(2)->binaryValue.size(), size);
+    } else {
+      result = _uploadSessions.append(parameters->at(0)->stringValue, (uint64_t)offset, parameters->at(2)->stringValue.data(), parameters->at(2)->stringValue.size(), size);
+    }
+
+    if (result == UploadSessions::Result::invalidOffset) return Ipc::Variable::createError(-3, "Invalid offset. Bytes received so far: " + std::to_string(size));
+    if (result != UploadSessions::Result::ok) return getUploadError(result);
+    return std::make_shared<Ipc::Variable>((int64_t)size);
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return Ipc::Variable::createError(-32500, "Unknown application error.");
+}
+
+Ipc::PVariable IpcClient::commitUpload(Ipc::PArray &parameters) {
+  try {
+    if (parameters->size() != 2) return Ipc::Variable::createError(-1, "Wrong parameter count.");
+    if (parameters->at(0)->type != Ipc::VariableType::tString) return Ipc::Variable::createError(-1, "Parameter 1 is not of type String.");
+    if (parameters->at(1)->type != Ipc::VariableType::tString) return Ipc::Variable::createError(-1, "Parameter 2 is not of type String.");
+    if (parameters->at(1)->stringValue.size() != 64) return Ipc::Variable::createError(-1, "Parameter 2 is no SHA-256 checksum.");
+
+    std::string destination;
+    auto result = _uploadSessions.commit(parameters->at(0)->stringValue, parameters->at(1)->stringValue, destination);
+    if (result != UploadSessions::Result::ok) return getUploadError(result);
+    return std::make_shared<Ipc::Variable>(destination);
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return Ipc::Variable::createError(-32500, "Unknown application error.");
+}
+
+Ipc::PVariable IpcClient::abortUpload(Ipc::PArray &parameters) {
+  try {
+    if (parameters->size() != 1) return Ipc::Variable::createError(-1, "Wrong parameter count.");
+    if (parameters->at(0)->type != Ipc::VariableType::tString) return Ipc::Variable::createError(-1, "Parameter 1 is not of type String.");
+
+    return getUploadError(_uploadSessions.abort(parameters->at(0)->stringValue));
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return Ipc::Variable::createError(-32500, "Unknown application error.");
+}
+// }}}
+
 // {{{ Internal
 Ipc::PVariable IpcClient::internalSetRootReadOnlyTrue(Ipc::PArray &parameters) {
   try {
     if (!parameters->empty()) return Ipc::Variable::createError(-1, "Wrong parameter count.");
 
+    //Called by detached commands when they are done. Release the reference of one still holding it. When there is none, the
+    //caller was started before Homegear Management was restarted.
+    bool released = false;
+    for (auto &entry: *getCommandRegistry()) {
+      if (entry.second->rootWritable.exchange(false)) {
+        released = true;
+        break;
+      }
+    }
     setRootReadOnly(true);
 
+    //For commands of this instance the system info is reloaded when they exit. This call is all we get from the others.
+    if (!released) GD::systemInfo.load(_dpkgDatabase);
+
     return std::make_shared<Ipc::Variable>();
   }
   catch (const std::exception &ex) {
@@ -34,10 +34,26 @@
 #include <homegear-base/BaseLib.h>
 #include <homegear-ipc/IIpcClient.h>
 
+#include "ProcessSupervisor.h"
+#include "CommandOutputBuffer.h"
+#include "CgroupManager.h"
+#include "DpkgDatabase.h"
+#include "AptPackageIndex.h"
+#include "AptTracker.h"
+#include "ConfigurationFiles.h"
+#include "CertificateAuthority.h"
+#include "UploadSessions.h"
+#include "BackupEngine.h"
+
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include <string>
 #include <set>
+#include <map>
+#include <deque>
+#include <array>
+#include <functional>
 
 class IpcClient : public Ipc::IIpcClient {
  public:
@@ -49,51 +65,224 @@ class IpcClient : public Ipc::IIpcClient {
   void onDisconnect() override;
   void onConnectError() override;
 
+  /**
+   * The class of a command. Determines the cgroup and resource limits the command is executed with.
+   */
+  enum class CommandType {
+    generic,
+    service,
+    apt,
+    build,
+    crypto,
+    backup,
+    system
+  };
+
+  /**
+   * Scheduling class of a command. Every class has its own queue and concurrency limit, so short interactive commands
+   * don't wait behind long running package operations. Lower values are dispatched first.
+   */
+  enum class CommandPriority : int32_t {
+    interactive = 0,
+    service = 1,
+    bulk = 2
+  };
+  static constexpr size_t commandPriorityCount = 3;
+
+  static std::string getCommandTypeName(CommandType type);
+  static CommandPriority getCommandPriority(CommandType type);
+  static std::string getCommandPriorityName(CommandPriority priority);
+  static int32_t getMaxRunningCommands(CommandPriority priority);
+  static Ipc::PVariable getResourceUsageVariable(const CgroupManager::ResourceUsage &resourceUsage);
+  static Ipc::PVariable getBackupProgressVariable(const BackupEngine::Progress &progress);
+
+  /**
+   * Immutable state of a command. A new snapshot is published on every state change, so readers never need a lock.
+   */
+  struct CommandState {
+    bool queued = true;
+    bool finished = false;
+    int32_t exitCode = -1;
+    int64_t startTime = 0;
+    int64_t endTime = 0;
+    bool cancelled = false;
+    bool timedOut = false;
+    CgroupManager::ResourceUsage resourceUsage;
+  };
+  typedef std::shared_ptr<const CommandState> PCommandState;
+
   class CommandInfo {
    public:
-    int64_t endTime = 0;
+    explicit CommandInfo(size_t outputBufferSize) : output(outputBufferSize) {}
+
+    int32_t id = -1;
+    CommandType type = CommandType::generic;
+    CommandPriority priority = CommandPriority::interactive;
     std::string command;
-    std::atomic_bool running{false};
+    std::function<int32_t(std::string &output)> function; //Executed in process instead of "command" when set. Returns the exit code.
+    std::shared_ptr<BackupEngine::Progress> backupProgress; //Set for backups created in process. Used to report progress and to cancel.
     bool detach = false;
-    std::thread thread;
+    std::atomic_bool rootWritable{false}; //Detached commands only. Set while the command holds its read-write reference on /.
     std::mutex outputMutex;
-    std::string output;
-    std::atomic_int status{-1};
+    CommandOutputBuffer output;
     Ipc::PVariable metadata;
+    std::atomic_bool subscribed{false};
+    std::atomic<pid_t> pid{-1};
+    std::atomic_bool cancelled{false};
+    std::atomic_bool timedOut{false};
+    uint64_t eventCursor = 0; //Output already sent in events. Protected by outputMutex.
+    bool spillFailed = false; //The output couldn't be moved to a file and stays in memory. Protected by outputMutex.
+
+    PCommandState getState() const { return std::atomic_load(&_state); }
+    void setState(PCommandState state) { std::atomic_store(&_state, std::move(state)); }
+   private:
+    PCommandState _state = std::make_shared<const CommandState>();
   };
   typedef std::shared_ptr<CommandInfo> PCommandInfo;
+  typedef std::unordered_map<int32_t, PCommandInfo> CommandRegistry;
+  typedef std::shared_ptr<const CommandRegistry> PCommandRegistry;
+
+  /**
+   * A process which has exited. It is finished on the reaper thread, as remounting / can block.
+   */
+  struct ExitedCommand {
+    PCommandInfo commandInfo;
+    int32_t exitCode = -1;
+    std::string cgroupPath;
+  };
 
   std::atomic_bool _disposing;
   std::atomic_bool _rootIsReadOnly;
-  std::mutex _commandInfoMutex;
+  std::mutex _commandInfoMutex; //Serializes writers of _commandInfo.
   int32_t _currentCommandInfoId = 0;
-  std::unordered_map<int32_t, PCommandInfo> _commandInfo;
+  PCommandRegistry _commandInfo = std::make_shared<const CommandRegistry>(); //Copy on write. Use getCommandRegistry() to read.
   std::mutex _readOnlyCountMutex;
   int32_t _readOnlyCount = 0;
+  //The following members are protected by _readOnlyCountMutex.
+  bool _rootMountedWritable = false; //True while we hold / writable, including the grace period.
+  bool _remountInProgress = false;
+  int64_t _remountReadOnlyTime = 0; //Time of the pending read only remount or 0.
+  bool _stopRemountThread = false;
+  std::condition_variable _remountConditionVariable;
+  std::thread _remountThread;
+  int _mountInfoFd = -1;
+  std::atomic_bool _stopMountWatcherThread{false};
+  std::thread _mountWatcherThread;
   std::atomic<int32_t> _homegearPid{0};
   std::atomic_bool _stopLifetickThread{false};
   std::thread _lifetickThread;
 
+  ProcessSupervisor _processSupervisor;
+  AptTracker _aptTracker;
+  ConfigurationFiles _configurationFiles{"/etc/homegear/"};
+  CgroupManager _cgroupManager;
+  DpkgDatabase _dpkgDatabase;
+  AptPackageIndex _aptPackageIndex{_dpkgDatabase};
+  CertificateKeyPool _certificateKeyPool{"/etc/homegear/ca/"};
+  CertificateAuthority _certificateAuthority{"/etc/homegear/ca/", _certificateKeyPool};
+  UploadSessions _uploadSessions{[this](bool readOnly) { setRootReadOnly(readOnly); }};
+  std::mutex _commandQueueMutex;
+  std::condition_variable _commandQueueConditionVariable;
+  std::array<std::deque<PCommandInfo>, commandPriorityCount> _commandQueues;
+  std::array<int32_t, commandPriorityCount> _runningCommandsByPriority{};
+  int32_t _runningCommands = 0;
+  std::mutex _commandEventMutex;
+  std::condition_variable _commandEventConditionVariable;
+  std::deque<PCommandInfo> _pendingCommandEvents;
+  bool _stopCommandEventThread = false;
+  std::thread _commandEventThread;
+  std::mutex _internalCommandMutex;
+  std::condition_variable _internalCommandConditionVariable;
+  std::deque<PCommandInfo> _internalCommands;
+  bool _stopInternalCommandThreads = false;
+  size_t _idleInternalCommandThreads = 0;
+  std::vector<std::thread> _internalCommandThreads; //Started on demand, so a running backup doesn't block other commands.
+  std::mutex _commandReaperMutex;
+  std::condition_variable _commandReaperConditionVariable;
+  bool _stopCommandReaperThread = false;
+  std::deque<ExitedCommand> _exitedCommands; //Protected by _commandReaperMutex.
+  std::thread _commandReaperThread;
+
+  PCommandRegistry getCommandRegistry() const { return std::atomic_load(&_commandInfo); }
+  PCommandInfo getCommandInfo(int32_t id) const;
   void lifetickThread();
+  void mountWatcherThread();
+  void remountThread();
+
+  /**
+   * Remounts / with mount(2), keeping all other mount flags. Must not be called with _readOnlyCountMutex locked.
+   */
+  static bool remountRoot(bool readOnly);
 
-  int32_t startCommandThread(std::string command,
+  /**
+   * Reads the root file system state from /proc/self/mountinfo. The "rootIsReadOnly" setting overrides the detection.
+   */
+  void updateRootIsReadOnly();
+  void commandEventThread();
+  void queueCommandEvent(const PCommandInfo &commandInfo);
+  void internalCommandThread();
+  void commandReaperThread();
+  void reapCommands();
+  void checkCommandTimeouts();
+
+  /**
+   * Removes a queued command from the queue or terminates the process group of a running command.
+   *
+   * @return Returns false when the command has already finished.
+   */
+  bool terminateCommand(const PCommandInfo &commandInfo, bool timedOut);
+
+  int32_t startCommandThread(CommandType type,
+                             std::string command,
                              bool detach = false,
                              Ipc::PVariable metadata = std::make_shared<Ipc::Variable>());
-  void executeCommand(PCommandInfo commandInfo);
+
+  /**
+   * Like startCommandThread, but "function" is executed in process on an internal command thread. The command is
+   * queued and limited like external commands of the same type and / is writable while it runs.
+   *
+   * @param backupProgress Set for backups. Its counters are returned by "managementGetCommandStatus".
+   */
+  int32_t startInternalCommand(CommandType type,
+                               std::string description,
+                               std::function<int32_t(std::string &output)> function,
+                               Ipc::PVariable metadata = std::make_shared<Ipc::Variable>(),
+                               std::shared_ptr<BackupEngine::Progress> backupProgress = std::shared_ptr<BackupEngine::Progress>());
+  int32_t queueCommand(const PCommandInfo &commandInfo);
+  void dispatchCommands();
+  void executeCommand(const PCommandInfo &commandInfo);
+  void commandFinished(const PCommandInfo &commandInfo, int32_t exitCode, const CgroupManager::ResourceUsage &resourceUsage = CgroupManager::ResourceUsage());
+  /**
+   * Publishes the final state of a command. Unlike commandFinished, the command keeps its slot.
+   */
+  void setCommandFinished(const PCommandInfo &commandInfo, int32_t exitCode, const CgroupManager::ResourceUsage &resourceUsage = CgroupManager::ResourceUsage());
+  void releaseCommandSlot(const PCommandInfo &commandInfo);
 
   void setRootReadOnly(bool readOnly);
+  static bool isHomegearPackage(const std::string &name);
+  /**
+   * Returns an error when "key" in "filename" may not be read or written according to "settingsWhitelist".
+   */
+  static Ipc::PVariable checkSettingsWhitelist(const std::string &filename, const std::string &key, bool write);
+  static Ipc::PVariable getUploadError(UploadSessions::Result result);
   bool isAptRunning();
 
   // {{{ RPC methods
   Ipc::PVariable dpkgPackageInstalled(Ipc::PArray &parameters);
   Ipc::PVariable getSystemInfo(Ipc::PArray &parameters);
   Ipc::PVariable getCommandStatus(Ipc::PArray &parameters);
+  Ipc::PVariable getCommandQueueStatus(Ipc::PArray &parameters);
+  Ipc::PVariable subscribeCommand(Ipc::PArray &parameters);
+  Ipc::PVariable cancelCommand(Ipc::PArray &parameters);
+  Ipc::PVariable unsubscribeCommand(Ipc::PArray &parameters);
   Ipc::PVariable sleep(Ipc::PArray &parameters);
   Ipc::PVariable getConfigurationEntry(Ipc::PArray &parameters);
   Ipc::PVariable reboot(Ipc::PArray &parameters);
   Ipc::PVariable shutdown(Ipc::PArray &parameters);
   Ipc::PVariable serviceCommand(Ipc::PArray &parameters);
   Ipc::PVariable setConfigurationEntry(Ipc::PArray &parameters);
+  Ipc::PVariable getConfigurationEntries(Ipc::PArray &parameters);
+  Ipc::PVariable setConfigurationEntries(Ipc::PArray &parameters);
   Ipc::PVariable writeCloudMaticConfig(Ipc::PArray &parameters);
   Ipc::PVariable setSystemTime(Ipc::PArray &parameters);
   // }}}
@@ -116,6 +305,7 @@ class IpcClient : public Ipc::IIpcClient {
   Ipc::PVariable aptFullUpgrade(Ipc::PArray &parameters);
   Ipc::PVariable homegearUpdateAvailable(Ipc::PArray &parameters);
   Ipc::PVariable systemUpdateAvailable(Ipc::PArray &parameters);
+  Ipc::PVariable getUpgradablePackages(Ipc::PArray &parameters);
   // }}}
 
   // {{{ Package management
@@ -200,6 +390,33 @@ class IpcClient : public Ipc::IIpcClient {
   Ipc::PVariable uploadDeviceDescriptionFile(Ipc::PArray &parameters);
   // }}}
 
+  // {{{ Uploads
+  /**
+   * Starts a chunked upload.
+   *
+   * @param parameters 1. The type of the upload: "deviceDescriptionFile" or "nodePackage". 2. A Struct with the
+   *                   parameters of the type. "deviceDescriptionFile" needs "filename" (String) and "familyId"
+   *                   (Integer). "nodePackage" (a .tar.gz archive) has no parameters.
+   * @return Returns the upload ID as a String.
+   */
+  Ipc::PVariable beginUpload(Ipc::PArray &parameters);
+
+  /**
+   * @param parameters 1. The upload ID. 2. The number of bytes sent before this chunk (Integer64). 3. The chunk as
+   *                   Binary or String. 4. Optional: Set to true when the chunk is base64 encoded.
+   * @return Returns the number of bytes received so far as Integer64. Error -3 is returned when the offset doesn't
+   *         match. Its message contains the number of bytes received so far, so the client can continue from there.
+   */
+  Ipc::PVariable appendUpload(Ipc::PArray &parameters);
+
+  /**
+   * @param parameters 1. The upload ID. 2. The SHA-256 checksum of the file as hexadecimal String.
+   * @return Returns the path of the uploaded file. For "nodePackage" pass it to "managementInstallNode" as URL.
+   */
+  Ipc::PVariable commitUpload(Ipc::PArray &parameters);
+  Ipc::PVariable abortUpload(Ipc::PArray &parameters);
+  // }}}
+
   // {{{ Internal
   Ipc::PVariable internalSetRootReadOnlyTrue(Ipc::PArray &parameters);
   // }}}
@@ -0,0 +1,110 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Homegear.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU Lesser General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+*/
+
+#include "MountInfo.h"
+
+#include <sstream>
+#include <cerrno>
+#include <unistd.h>
+
+std::string MountInfo::unescape(const std::string &value) {
+  //Spaces, tabs, newlines and backslashes are escaped as octal, e.g. "\040".
+  if (value.find('\\') == std::string::npos) return value;
+  std::string result;
+  result.reserve(value.size());
+  for (size_t i = 0; i < value.size(); i++) {
+    if (value[i] == '\\' && i + 3 < value.size() && value[i + 1] >= '0' && value[i + 1] <= '3' && value[i + 2] >= '0' && value[i + 2] <= '7' && value[i + 3] >= '0' && value[i + 3] <= '7') {
+      result.push_back((char)(((value[i + 1] - '0') << 6) | ((value[i + 2] - '0') << 3) | (value[i + 3] - '0')));
+      i += 3;
+    } else result.push_back(value[i]);
+  }
+  return result;
+}
+
+std::vector<MountInfo::Mount> MountInfo::parse(const std::string &content) {
+  //Format: "36 35 98:0 /mnt1 /mnt2 rw,noatime master:1 - ext3 /dev/root rw,errors=continue"
+  //(mount ID, parent ID, major:minor, root, mount point, mount options, optional fields, separator, file system type,
+  //source, super options)
+  std::vector<Mount> mounts;
+  std::istringstream stream(content);
+  std::string line;
+  std::vector<std::string> fields;
+  while (std::getline(stream, line)) {
+    fields.clear();
+    std::istringstream lineStream(line);
+    std::string field;
+    while (lineStream >> field) fields.push_back(std::move(field));
+
+    size_t separatorIndex = 6;
+    while (separatorIndex < fields.size() && fields[separatorIndex] != "-") separatorIndex++;
+    if (separatorIndex + 2 >= fields.size()) continue;
+
+    Mount mount;
+    mount.mountPoint = unescape(fields[4]);
+    mount.fileSystemType = fields[separatorIndex + 1];
+    mount.source = unescape(fields[separatorIndex + 2]);
+
+    auto isReadOnly = [](const std::string &options) {
+      return options == "ro" || options.compare(0, 3, "ro,") == 0 || options.find(",ro,") != std::string::npos || (options.size() > 3 && options.compare(options.size() - 3, 3, ",ro") == 0);
+    };
+    mount.readOnly = isReadOnly(fields[5]) || (separatorIndex + 3 < fields.size() && isReadOnly(fields[separatorIndex + 3]));
+    mounts.push_back(std::move(mount));
+  }
+  return mounts;
+}
+
+std::string MountInfo::read(int fd) {
+  std::string content;
+  if (lseek(fd, 0, SEEK_SET) == -1) return content;
+
+  char buffer[4096];
+  while (true) {
+    auto bytesRead = ::read(fd, buffer, sizeof(buffer));
+    if (bytesRead == -1 && errno == EINTR) continue;
+    if (bytesRead <= 0) break;
+    content.append(buffer, (size_t)bytesRead);
+  }
+  return content;
+}
+
+bool MountInfo::rootIsReadOnly(const std::vector<Mount> &mounts) {
+  //Mounts are listed in mount order, so the last entry for "/" is the visible one.
+  bool rootIsReadOnly = false;
+  for (auto &mount: mounts) {
+    if (mount.mountPoint == "/") rootIsReadOnly = mount.readOnly;
+  }
+  if (rootIsReadOnly) return true;
+
+  //Some images report the root device under its own name instead of as "/".
+  for (auto &mount: mounts) {
+    if (mount.readOnly && (mount.source == "/dev/root" || mount.source == "/dev/mmcblk0p1" || mount.source.compare(0, 9, "/dev/emmc") == 0)) return true;
+  }
+  return false;
+}
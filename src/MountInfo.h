@@ -0,0 +1,67 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Homegear.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU Lesser General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+*/
+
+#ifndef MOUNTINFO_H_
+#define MOUNTINFO_H_
+
+#include <string>
+#include <vector>
+
+/**
+ * Parser for /proc/self/mountinfo (see proc(5)).
+ */
+class MountInfo {
+ public:
+  struct Mount {
+    std::string mountPoint;
+    std::string source;
+    std::string fileSystemType;
+    bool readOnly = false;
+  };
+
+  MountInfo() = delete;
+
+  static std::vector<Mount> parse(const std::string &content);
+
+  /**
+   * Reads the whole file from the current position of "fd" after seeking to the start. Reading the file this way also
+   * acknowledges a POLLPRI event on "fd".
+   */
+  static std::string read(int fd);
+
+  /**
+   * Checks if the root file system is mounted read only.
+   */
+  static bool rootIsReadOnly(const std::vector<Mount> &mounts);
+ private:
+  static std::string unescape(const std::string &value);
+};
+
+#endif
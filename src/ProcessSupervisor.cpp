@@ -0,0 +1,405 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Homegear.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU Lesser General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+*/
+
+#include "ProcessSupervisor.h"
+#include "GD.h"
+#include <homegear-base/Managers/ProcessManager.h>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <csignal>
+
+ProcessSupervisor::ProcessSupervisor() = default;
+
+ProcessSupervisor::~ProcessSupervisor() {
+  stop();
+}
+
+bool ProcessSupervisor::start() {
+  try {
+    stop();
+
+    _epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (_epollFd == -1) {
+      GD::out.printError("Error: Could not create epoll instance: " + std::string(strerror(errno)));
+      return false;
+    }
+
+    _eventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (_eventFd == -1) {
+      GD::out.printError("Error: Could not create event file descriptor: " + std::string(strerror(errno)));
+      close(_epollFd);
+      _epollFd = -1;
+      return false;
+    }
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = _eventFd;
+    if (epoll_ctl(_epollFd, EPOLL_CTL_ADD, _eventFd, &event) == -1) {
+      GD::out.printError("Error: Could not add event file descriptor to epoll: " + std::string(strerror(errno)));
+      close(_eventFd);
+      close(_epollFd);
+      _eventFd = -1;
+      _epollFd = -1;
+      return false;
+    }
+
+    _exitCallbackHandlerId = BaseLib::ProcessManager::registerCallbackHandler(std::bind(&ProcessSupervisor::onProcessExit,
+                                                                                       this,
+                                                                                       std::placeholders::_1,
+                                                                                       std::placeholders::_2,
+                                                                                       std::placeholders::_3,
+                                                                                       std::placeholders::_4));
+
+    _stopSupervisorThread = false;
+    _supervisorThread = std::thread(&ProcessSupervisor::supervisorThread, this);
+    return true;
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return false;
+}
+
+void ProcessSupervisor::stop() {
+  try {
+    if (_supervisorThread.joinable()) {
+      _stopSupervisorThread = true;
+      uint64_t value = 1;
+      if (write(_eventFd, &value, sizeof(value)) == -1) {
+        GD::out.printWarning("Warning: Could not wake up process supervisor: " + std::string(strerror(errno)));
+      }
+      _supervisorThread.join();
+    }
+
+    if (_exitCallbackHandlerId != -1) {
+      BaseLib::ProcessManager::unregisterCallbackHandler(_exitCallbackHandlerId);
+      _exitCallbackHandlerId = -1;
+    }
+
+    {
+      std::lock_guard<std::mutex> processesGuard(_processesMutex);
+      for (auto &process: _processesByFd) {
+        close(process.first);
+      }
+      _processesByFd.clear();
+      _processes.clear();
+    }
+
+    if (_eventFd != -1) {
+      close(_eventFd);
+      _eventFd = -1;
+    }
+    if (_epollFd != -1) {
+      close(_epollFd);
+      _epollFd = -1;
+    }
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+}
+
+pid_t ProcessSupervisor::forkChild(const std::string &command, int stdoutFd, int stderrFd, bool newSession, int cgroupProcsFd) {
+  auto maxFd = GD::bl->fileDescriptorManager.getMax();
+  int devNull = open("/dev/null", O_RDWR | O_CLOEXEC);
+  if (devNull == -1) {
+    GD::out.printError("Error: Could not open /dev/null: " + std::string(strerror(errno)));
+    return -1;
+  }
+
+  pid_t pid = fork();
+  if (pid == -1) {
+    GD::out.printError("Error: Could not fork: " + std::string(strerror(errno)));
+    close(devNull);
+    return -1;
+  } else if (pid == 0) {
+    //Child process. Only async-signal-safe functions from here on.
+    pthread_sigmask(SIG_SETMASK, &BaseLib::SharedObjects::defaultSignalMask, nullptr);
+    if (newSession) setsid();
+    else setpgid(0, 0);
+    if (cgroupProcsFd != -1 && write(cgroupProcsFd, "0", 1) != 1) {
+      //Not fatal, the command runs in Homegear Management's cgroup then.
+    }
+
+    dup2(devNull, STDIN_FILENO);
+    dup2(stdoutFd == -1 ? devNull : stdoutFd, STDOUT_FILENO);
+    dup2(stderrFd == -1 ? devNull : stderrFd, STDERR_FILENO);
+    for (int i = 3; i < maxFd; i++) {
+      close(i);
+    }
+
+    execl("/bin/sh", "sh", "-c", command.c_str(), (char *)nullptr);
+    _exit(127);
+  }
+
+  //Also set the process group in the parent, so it is valid before the child is scheduled.
+  if (!newSession) setpgid(pid, pid);
+  close(devNull);
+  return pid;
+}
+
+pid_t ProcessSupervisor::startProcess(const std::string &command, OutputCallback outputCallback, ExitCallback exitCallback, int cgroupProcsFd) {
+  try {
+    if (_epollFd == -1) return -1;
+
+    int stdoutPipe[2];
+    int stderrPipe[2];
+    if (pipe2(stdoutPipe, O_CLOEXEC) == -1) {
+      GD::out.printError("Error: Could not create pipe: " + std::string(strerror(errno)));
+      return -1;
+    }
+    if (pipe2(stderrPipe, O_CLOEXEC) == -1) {
+      GD::out.printError("Error: Could not create pipe: " + std::string(strerror(errno)));
+      close(stdoutPipe[0]);
+      close(stdoutPipe[1]);
+      return -1;
+    }
+
+    auto process = std::make_shared<Process>();
+    process->outputCallback = std::move(outputCallback);
+    process->exitCallback = std::move(exitCallback);
+
+    //Hold the mutex while forking, so an exit notification for the new process can't arrive before it is known.
+    std::lock_guard<std::mutex> processesGuard(_processesMutex);
+    process->pid = forkChild(command, stdoutPipe[1], stderrPipe[1], false, cgroupProcsFd);
+    close(stdoutPipe[1]);
+    close(stderrPipe[1]);
+    if (process->pid == -1) {
+      close(stdoutPipe[0]);
+      close(stderrPipe[0]);
+      return -1;
+    }
+
+    process->stdoutFd = stdoutPipe[0];
+    process->stderrFd = stderrPipe[0];
+    _processes.emplace(process->pid, process);
+
+    for (auto fd: {process->stdoutFd, process->stderrFd}) {
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+      _processesByFd.emplace(fd, process);
+
+      epoll_event event{};
+      event.events = EPOLLIN;
+      event.data.fd = fd;
+      if (epoll_ctl(_epollFd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        GD::out.printError("Error: Could not add pipe of process " + std::to_string(process->pid) + " to epoll: " + std::string(strerror(errno)));
+      }
+    }
+
+    return process->pid;
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return -1;
+}
+
+pid_t ProcessSupervisor::startDetachedProcess(const std::string &command, ExitCallback exitCallback, int cgroupProcsFd) {
+  try {
+    if (_epollFd == -1) return -1;
+
+    auto process = std::make_shared<Process>();
+    process->exitCallback = std::move(exitCallback);
+
+    //There are no pipes to drain, so the exit callback is called right after the exit notification.
+    std::lock_guard<std::mutex> processesGuard(_processesMutex);
+    process->pid = forkChild(command, -1, -1, true, cgroupProcsFd);
+    if (process->pid == -1) return -1;
+    _processes.emplace(process->pid, process);
+    return process->pid;
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return -1;
+}
+
+bool ProcessSupervisor::terminateProcess(pid_t pid, int64_t killTimeout) {
+  try {
+    {
+      std::lock_guard<std::mutex> processesGuard(_processesMutex);
+      auto processIterator = _processes.find(pid);
+      if (processIterator == _processes.end() || processIterator->second->exited) return false;
+
+      if (kill(-pid, SIGTERM) == -1 && errno != ESRCH) {
+        GD::out.printWarning("Warning: Could not terminate process group " + std::to_string(pid) + ": " + std::string(strerror(errno)));
+      }
+      processIterator->second->killTime = BaseLib::HelperFunctions::getTime() + killTimeout;
+    }
+
+    //Wake up the supervisor thread, so it picks up the kill time.
+    uint64_t value = 1;
+    if (write(_eventFd, &value, sizeof(value)) == -1) {
+      GD::out.printWarning("Warning: Could not notify process supervisor: " + std::string(strerror(errno)));
+    }
+    return true;
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return false;
+}
+
+void ProcessSupervisor::onProcessExit(pid_t pid, int exitCode, int signal, bool coreDumped) {
+  try {
+    std::lock_guard<std::mutex> processesGuard(_processesMutex);
+    auto processIterator = _processes.find(pid);
+    if (processIterator == _processes.end()) return;
+
+    processIterator->second->exited = true;
+    processIterator->second->exitCode = signal != 0 ? 128 + signal : exitCode;
+    processIterator->second->exitTime = BaseLib::HelperFunctions::getTime();
+
+    uint64_t value = 1;
+    if (write(_eventFd, &value, sizeof(value)) == -1) {
+      GD::out.printWarning("Warning: Could not notify process supervisor: " + std::string(strerror(errno)));
+    }
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+}
+
+void ProcessSupervisor::closeFd(const PProcess &process, int fd) {
+  epoll_ctl(_epollFd, EPOLL_CTL_DEL, fd, nullptr);
+  close(fd);
+
+  std::lock_guard<std::mutex> processesGuard(_processesMutex);
+  _processesByFd.erase(fd);
+  if (process->stdoutFd == fd) process->stdoutFd = -1;
+  if (process->stderrFd == fd) process->stderrFd = -1;
+}
+
+bool ProcessSupervisor::readFd(const PProcess &process, int fd) {
+  char buffer[16384];
+  //Limit the number of reads, so one very chatty process can't starve the others. epoll reports the fd again.
+  for (int32_t i = 0; i < 16; i++) {
+    auto bytesRead = read(fd, buffer, sizeof(buffer));
+    if (bytesRead > 0) {
+      if (process->outputCallback) process->outputCallback(buffer, (size_t)bytesRead);
+    } else if (bytesRead == 0) return false;
+    else if (errno == EINTR) continue;
+    else return errno == EAGAIN || errno == EWOULDBLOCK;
+  }
+  return true;
+}
+
+void ProcessSupervisor::supervisorThread() {
+  std::array<epoll_event, 16> events{};
+
+  while (!_stopSupervisorThread) {
+    try {
+      int timeout = -1;
+      {
+        auto time = BaseLib::HelperFunctions::getTime();
+        std::lock_guard<std::mutex> processesGuard(_processesMutex);
+        for (auto &process: _processes) {
+          if (process.second->killTime > 0) {
+            if (process.second->killTime <= time) {
+              //Also kills what is left of the group after the main process has exited.
+              GD::out.printWarning("Warning: Process group " + std::to_string(process.first) + " did not terminate in time. Killing it.");
+              kill(-process.first, SIGKILL);
+              process.second->killTime = 0;
+            } else if (timeout == -1 || process.second->killTime - time < timeout) {
+              timeout = (int)(process.second->killTime - time);
+            }
+          }
+          if (process.second->exited && (timeout == -1 || timeout > 100)) {
+            //Pipes are still open. Check again soon.
+            timeout = 100;
+          }
+        }
+      }
+
+      auto eventCount = epoll_wait(_epollFd, events.data(), events.size(), timeout);
+      if (eventCount == -1) {
+        if (errno == EINTR) continue;
+        GD::out.printError("Error: epoll_wait failed: " + std::string(strerror(errno)));
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        continue;
+      }
+
+      for (int i = 0; i < eventCount; i++) {
+        auto fd = events.at(i).data.fd;
+        if (fd == _eventFd) {
+          uint64_t value = 0;
+          if (read(_eventFd, &value, sizeof(value)) == -1 && errno != EAGAIN) {
+            GD::out.printWarning("Warning: Could not read from event file descriptor: " + std::string(strerror(errno)));
+          }
+          continue;
+        }
+
+        PProcess process;
+        {
+          std::lock_guard<std::mutex> processesGuard(_processesMutex);
+          auto processIterator = _processesByFd.find(fd);
+          if (processIterator == _processesByFd.end()) continue;
+          process = processIterator->second;
+        }
+
+        if (!readFd(process, fd)) closeFd(process, fd);
+      }
+
+      std::vector<PProcess> finishedProcesses;
+      {
+        auto time = BaseLib::HelperFunctions::getTime();
+        std::lock_guard<std::mutex> processesGuard(_processesMutex);
+        for (auto processIterator = _processes.begin(); processIterator != _processes.end();) {
+          auto &process = processIterator->second;
+          //When the process has exited but a child of it still holds the pipes open, don't wait for that child
+          //longer than two seconds.
+          if (!process->exited || ((process->stdoutFd != -1 || process->stderrFd != -1) && time - process->exitTime < 2000)) {
+            processIterator++;
+            continue;
+          }
+
+          finishedProcesses.push_back(process);
+          processIterator = _processes.erase(processIterator);
+        }
+      }
+
+      for (auto &process: finishedProcesses) {
+        for (auto fd: {process->stdoutFd, process->stderrFd}) {
+          if (fd == -1) continue;
+          readFd(process, fd);
+          closeFd(process, fd);
+        }
+
+        if (process->exitCallback) process->exitCallback(process->exitCode);
+      }
+    }
+    catch (const std::exception &ex) {
+      GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+    }
+  }
+}
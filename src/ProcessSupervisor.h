@@ -0,0 +1,119 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Homegear.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU Lesser General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+*/
+
+#ifndef PROCESSSUPERVISOR_H_
+#define PROCESSSUPERVISOR_H_
+
+#include <homegear-base/BaseLib.h>
+
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <unordered_map>
+
+/**
+ * Starts child processes and watches all of them from a single thread.
+ *
+ * stdout and stderr of every child are read through non-blocking pipes multiplexed with epoll. Exit notifications
+ * come from BaseLib's ProcessManager, which owns SIGCHLD, and are forwarded to the supervisor thread through an
+ * eventfd. The exit callback is called once the child has exited and its pipes are drained.
+ */
+class ProcessSupervisor {
+ public:
+  typedef std::function<void(const char *data, size_t size)> OutputCallback;
+  typedef std::function<void(int32_t exitCode)> ExitCallback;
+
+  ProcessSupervisor();
+  virtual ~ProcessSupervisor();
+
+  bool start();
+  void stop();
+
+  /**
+   * Executes a shell command. The callbacks are called from the supervisor thread.
+   *
+   * @param command The command to pass to "/bin/sh -c".
+   * @param outputCallback Called for every block of output read from stdout or stderr.
+   * @param exitCallback Called exactly once when the process has finished.
+   * @param cgroupProcsFd When not -1, the child joins the cgroup by writing to this "cgroup.procs" file descriptor.
+   * @return Returns the process ID or -1 on error. On error no callback is called.
+   */
+  pid_t startProcess(const std::string &command, OutputCallback outputCallback, ExitCallback exitCallback, int cgroupProcsFd = -1);
+
+  /**
+   * Executes a shell command in a new session with all output discarded. The process is not stopped with the supervisor,
+   * so it keeps running when Homegear Management is restarted. Until then it can be terminated with terminateProcess()
+   * like any other supervised process.
+   *
+   * @param exitCallback Called exactly once when the process has finished. Not called when the supervisor is stopped first.
+   * @return Returns the process ID or -1 on error. On error the callback is not called.
+   */
+  pid_t startDetachedProcess(const std::string &command, ExitCallback exitCallback, int cgroupProcsFd = -1);
+
+  /**
+   * Sends SIGTERM to the process group of a supervised process and SIGKILL when it is still there after "killTimeout"
+   * milliseconds. Every supervised process runs in its own process group, so this also stops its children.
+   *
+   * @return Returns false when the process is unknown or has already exited.
+   */
+  bool terminateProcess(pid_t pid, int64_t killTimeout);
+ private:
+  struct Process {
+    pid_t pid = -1;
+    int stdoutFd = -1;
+    int stderrFd = -1;
+    bool exited = false;
+    int32_t exitCode = -1;
+    int64_t exitTime = 0;
+    int64_t killTime = 0;
+    OutputCallback outputCallback;
+    ExitCallback exitCallback;
+  };
+  typedef std::shared_ptr<Process> PProcess;
+
+  std::atomic_bool _stopSupervisorThread{false};
+  std::thread _supervisorThread;
+  int _epollFd = -1;
+  int _eventFd = -1;
+  int32_t _exitCallbackHandlerId = -1;
+
+  std::mutex _processesMutex;
+  std::unordered_map<pid_t, PProcess> _processes;
+  std::unordered_map<int, PProcess> _processesByFd;
+
+  pid_t forkChild(const std::string &command, int stdoutFd, int stderrFd, bool newSession, int cgroupProcsFd);
+  void onProcessExit(pid_t pid, int exitCode, int signal, bool coreDumped);
+  void closeFd(const PProcess &process, int fd);
+  bool readFd(const PProcess &process, int fd);
+  void supervisorThread();
+};
+
+#endif
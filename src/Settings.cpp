@@ -31,36 +31,149 @@
 #include "Settings.h"
 #include "GD.h"
 
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <poll.h>
+
 Settings::Settings() {
 }
 
-void Settings::reset() {
-  _socketPath = _executablePath;
-  _runAsUser = "";
-  _runAsGroup = "";
-  _debugLevel = 3;
-  _memoryDebugging = false;
-  _enableCoreDumps = true;
-  _workingDirectory = _executablePath;
-  _logfilePath = "/var/log/homegear/";
-  _homegearDataPath = "/var/lib/homegear/";
-  _system = "";
-  _codename = "";
-  _secureMemorySize = 65536;
-  _maxCommandThreads = 30;
-  _allowedServiceCommands.clear();
-  _controllableServices.clear();
-  _packagesWhitelist.clear();
-  _packagesBlacklist.clear();
-  _settingsWhitelist.clear();
-  backup_script_ = "/var/lib/homegear/scripts/BackupHomegear.sh";
+void Settings::reset(Snapshot &snapshot) {
+  snapshot.socketPath = _executablePath;
+  snapshot.runAsUser = "";
+  snapshot.runAsGroup = "";
+  snapshot.debugLevel = 3;
+  snapshot.memoryDebugging = false;
+  snapshot.enableCoreDumps = true;
+  snapshot.workingDirectory = _executablePath;
+  snapshot.logfilePath = "/var/log/homegear/";
+  snapshot.homegearDataPath = "/var/lib/homegear/";
+  snapshot.system = "";
+  snapshot.codename = "";
+  snapshot.readOnlyRemountDelay = 10;
+  snapshot.secureMemorySize = 65536;
+  snapshot.maxCommandThreads = 30;
+  snapshot.maxInteractiveCommands = 30;
+  snapshot.maxServiceCommands = 4;
+  snapshot.maxBulkCommands = 2;
+  snapshot.commandOutputBufferSize = 1048576;
+  snapshot.commandRetentionTime = 60;
+  snapshot.maxRetainedCommands = 100;
+  snapshot.maxRetainedCommandOutput = 8388608;
+  snapshot.commandOutputSpillSize = 65536;
+  snapshot.enableCgroups = true;
+  snapshot.cgroupPath = "";
+  snapshot.commandCgroups.clear();
+  snapshot.commandCgroups["apt"] = CgroupLimits{20, -1, 20};
+  snapshot.commandCgroups["build"] = CgroupLimits{10, -1, 10};
+  snapshot.commandCgroups["crypto"] = CgroupLimits{10, -1, -1};
+  snapshot.commandCgroups["backup"] = CgroupLimits{20, -1, 10};
+  snapshot.commandTimeouts.clear();
+  snapshot.commandTimeouts["service"] = 300;
+  snapshot.commandTimeouts["apt"] = 7200;
+  snapshot.commandTimeouts["build"] = 3600;
+  snapshot.commandTimeouts["crypto"] = 1800;
+  snapshot.commandKillTimeout = 10;
+  snapshot.allowedServiceCommands.clear();
+  snapshot.controllableServices.clear();
+  snapshot.packagesWhitelist.clear();
+  snapshot.packagesBlacklist.clear();
+  snapshot.settingsWhitelist.clear();
+  snapshot.backupScript = "/var/lib/homegear/scripts/BackupHomegear.sh";
+  snapshot.backupPaths.clear();
+  snapshot.backupThreads = 0;
+  snapshot.certificateKeyPoolSize = 0;
+  snapshot.certificateKeyType = "rsa4096";
+  snapshot.maxUploadSize = 104857600;
+  snapshot.maxUploadSessions = 4;
+  snapshot.uploadTimeout = 300;
 }
 
 bool Settings::changed() {
-  if (GD::bl->io.getFileLastModifiedTime(_path) != _lastModified) {
-    return true;
+  std::lock_guard<std::mutex> loadGuard(_loadMutex);
+  struct stat statStruct{};
+  if (stat(_path.c_str(), &statStruct) == -1) return false;
+  //Editors often replace the file, so the inode needs to be compared, too.
+  return statStruct.st_ino != _inode || (int64_t)statStruct.st_mtim.tv_sec * 1000000000 + statStruct.st_mtim.tv_nsec != _lastModified;
+}
+
+void Settings::reload() {
+  std::string path;
+  std::string executablePath;
+  {
+    std::lock_guard<std::mutex> loadGuard(_loadMutex);
+    path = _path;
+    executablePath = _executablePath;
+  }
+  if (path.empty()) return;
+  load(path, executablePath);
+  GD::out.printInfo("Info: Settings reloaded from " + path);
+}
+
+void Settings::publish(const std::shared_ptr<Snapshot> &snapshot) {
+  std::atomic_store(&_snapshot, std::const_pointer_cast<const Snapshot>(snapshot));
+  _loaded = true;
+}
+
+void Settings::startWatching() {
+  stopWatching();
+  _stopWatchThread = false;
+  _watchThread = std::thread(&Settings::watchThread, this);
+}
+
+void Settings::stopWatching() {
+  _stopWatchThread = true;
+  if (_watchThread.joinable()) _watchThread.join();
+}
+
+void Settings::watchThread() {
+  std::string directory;
+  std::string filename;
+  {
+    std::lock_guard<std::mutex> loadGuard(_loadMutex);
+    auto slashPosition = _path.find_last_of('/');
+    directory = slashPosition == std::string::npos ? "." : _path.substr(0, slashPosition + 1);
+    filename = slashPosition == std::string::npos ? _path : _path.substr(slashPosition + 1);
+  }
+
+  //Watch the directory, as editors and package managers replace the file instead of writing to it.
+  int inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotifyFd == -1) {
+    GD::out.printError("Error: Could not initialize inotify: " + std::string(strerror(errno)));
+    return;
+  }
+  if (inotify_add_watch(inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+    GD::out.printError("Error: Could not watch " + directory + ": " + std::string(strerror(errno)));
+    close(inotifyFd);
+    return;
+  }
+
+  alignas(struct inotify_event) char buffer[4096];
+  while (!_stopWatchThread) {
+    try {
+      pollfd pollFd{};
+      pollFd.fd = inotifyFd;
+      pollFd.events = POLLIN;
+      auto result = poll(&pollFd, 1, 1000);
+      if (result <= 0) continue;
+
+      bool fileChanged = false;
+      ssize_t bytesRead = 0;
+      while ((bytesRead = read(inotifyFd, buffer, sizeof(buffer))) > 0) {
+        for (char *position = buffer; position < buffer + bytesRead;) {
+          auto event = (struct inotify_event *)position;
+          position += sizeof(struct inotify_event) + event->len;
+          if (event->len > 0 && filename == event->name) fileChanged = true;
+        }
+      }
+
+      if (fileChanged && changed()) reload();
+    }
+    catch (const std::exception &ex) {
+      GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+    }
   }
-  return false;
+  close(inotifyFd);
 }
 
 void Settings::load(std::string filename, std::string executablePath) {
@@ -71,9 +184,12 @@ void Settings::load(std::string filename, std::string executablePath) {
         "libcurl3-gnutls", "zlib1g", "libicu52", "libicu55", "libicu57", "libicu60", "libicu63"}};
 
   try {
+    std::lock_guard<std::mutex> loadGuard(_loadMutex);
     _executablePath = executablePath;
-    reset();
     _path = filename;
+    auto newSnapshot = std::make_shared<Snapshot>();
+    auto &snapshot = *newSnapshot;
+    reset(snapshot);
     char input[1024];
     FILE *fin;
     int32_t len, ptr;
@@ -81,11 +197,13 @@ void Settings::load(std::string filename, std::string executablePath) {
 
     if (!(fin = fopen(filename.c_str(), "r"))) {
       GD::bl->out.printError("Unable to open config file: " + filename + ". " + strerror(errno));
+      //Keep the current settings when a reload fails.
+      if (!_loaded) publish(newSnapshot);
       return;
     }
 
     for (auto &element: blackList) {
-      _packagesBlacklist.emplace(element);
+      snapshot.packagesBlacklist.add(element);
     }
     GD::bl->out.printDebug("Debug: packagesBlacklist was set");
 
@@ -111,101 +229,219 @@ void Settings::load(std::string filename, std::string executablePath) {
         std::string value(&input[ptr]);
         BaseLib::HelperFunctions::trim(value);
         if (name == "socketpath") {
-          _socketPath = value;
-          if (_socketPath.empty()) _socketPath = _executablePath;
-          if (_socketPath.back() != '/') _socketPath.push_back('/');
-          GD::bl->out.printDebug("Debug: socketPath set to " + _socketPath);
+          snapshot.socketPath = value;
+          if (snapshot.socketPath.empty()) snapshot.socketPath = _executablePath;
+          if (snapshot.socketPath.back() != '/') snapshot.socketPath.push_back('/');
+          GD::bl->out.printDebug("Debug: socketPath set to " + snapshot.socketPath);
         } else if (name == "runasuser") {
-          _runAsUser = value;
-          GD::bl->out.printDebug("Debug: runAsUser set to " + _runAsUser);
+          snapshot.runAsUser = value;
+          GD::bl->out.printDebug("Debug: runAsUser set to " + snapshot.runAsUser);
         } else if (name == "runasgroup") {
-          _runAsGroup = value;
-          GD::bl->out.printDebug("Debug: runAsGroup set to " + _runAsGroup);
+          snapshot.runAsGroup = value;
+          GD::bl->out.printDebug("Debug: runAsGroup set to " + snapshot.runAsGroup);
         } else if (name == "debuglevel") {
-          _debugLevel = BaseLib::Math::getNumber(value);
-          if (_debugLevel < 0) _debugLevel = 3;
-          GD::bl->debugLevel = _debugLevel;
-          GD::bl->out.printDebug("Debug: debugLevel set to " + std::to_string(_debugLevel));
+          snapshot.debugLevel = BaseLib::Math::getNumber(value);
+          if (snapshot.debugLevel < 0) snapshot.debugLevel = 3;
+          GD::bl->debugLevel = snapshot.debugLevel;
+          GD::bl->out.printDebug("Debug: debugLevel set to " + std::to_string(snapshot.debugLevel));
         } else if (name == "memorydebugging") {
-          if (BaseLib::HelperFunctions::toLower(value) == "true") _memoryDebugging = true;
-          GD::bl->out.printDebug("Debug: memoryDebugging set to " + std::to_string(_memoryDebugging));
+          if (BaseLib::HelperFunctions::toLower(value) == "true") snapshot.memoryDebugging = true;
+          GD::bl->out.printDebug("Debug: memoryDebugging set to " + std::to_string(snapshot.memoryDebugging));
         } else if (name == "enablecoredumps") {
-          if (BaseLib::HelperFunctions::toLower(value) == "false") _enableCoreDumps = false;
-          GD::bl->out.printDebug("Debug: enableCoreDumps set to " + std::to_string(_enableCoreDumps));
+          if (BaseLib::HelperFunctions::toLower(value) == "false") snapshot.enableCoreDumps = false;
+          GD::bl->out.printDebug("Debug: enableCoreDumps set to " + std::to_string(snapshot.enableCoreDumps));
         } else if (name == "workingdirectory") {
-          _workingDirectory = value;
-          if (_workingDirectory.empty()) _workingDirectory = _executablePath;
-          if (_workingDirectory.back() != '/') _workingDirectory.push_back('/');
-          GD::bl->out.printDebug("Debug: workingDirectory set to " + _workingDirectory);
+          snapshot.workingDirectory = value;
+          if (snapshot.workingDirectory.empty()) snapshot.workingDirectory = _executablePath;
+          if (snapshot.workingDirectory.back() != '/') snapshot.workingDirectory.push_back('/');
+          GD::bl->out.printDebug("Debug: workingDirectory set to " + snapshot.workingDirectory);
         } else if (name == "logfilepath") {
-          _logfilePath = value;
-          if (_logfilePath.empty()) _logfilePath = "/var/log/homegear/";
-          if (_logfilePath.back() != '/') _logfilePath.push_back('/');
-          GD::bl->out.printDebug("Debug: logfilePath set to " + _logfilePath);
+          snapshot.logfilePath = value;
+          if (snapshot.logfilePath.empty()) snapshot.logfilePath = "/var/log/homegear/";
+          if (snapshot.logfilePath.back() != '/') snapshot.logfilePath.push_back('/');
+          GD::bl->out.printDebug("Debug: logfilePath set to " + snapshot.logfilePath);
         } else if (name == "homegeardatapath") {
-          _homegearDataPath = value;
-          if (_homegearDataPath.empty()) _homegearDataPath = "/var/lib/homegear/";
-          if (_homegearDataPath.back() != '/') _homegearDataPath.push_back('/');
-          GD::bl->out.printDebug("Debug: homegearDataPath set to " + _homegearDataPath);
+          snapshot.homegearDataPath = value;
+          if (snapshot.homegearDataPath.empty()) snapshot.homegearDataPath = "/var/lib/homegear/";
+          if (snapshot.homegearDataPath.back() != '/') snapshot.homegearDataPath.push_back('/');
+          GD::bl->out.printDebug("Debug: homegearDataPath set to " + snapshot.homegearDataPath);
         } else if (name == "system") {
-          _system = BaseLib::HelperFunctions::toLower(value);
-          if (!_system.empty()) _system.at(0) = std::toupper(_system.at(0));
-          GD::bl->out.printDebug("Debug: system set to " + _system);
+          snapshot.system = BaseLib::HelperFunctions::toLower(value);
+          if (!snapshot.system.empty()) snapshot.system.at(0) = std::toupper(snapshot.system.at(0));
+          GD::bl->out.printDebug("Debug: system set to " + snapshot.system);
         } else if (name == "codename") {
-          _codename = BaseLib::HelperFunctions::toLower(value);
-          GD::bl->out.printDebug("Debug: codename set to " + _codename);
+          snapshot.codename = BaseLib::HelperFunctions::toLower(value);
+          GD::bl->out.printDebug("Debug: codename set to " + snapshot.codename);
         } else if (name == "rootisreadonly") {
-          _rootIsReadOnly = (value == "true");
-          GD::bl->out.printDebug("Debug: rootIsReadOnly set to " + std::to_string(_rootIsReadOnly));
+          snapshot.rootIsReadOnly = (value == "true");
+          GD::bl->out.printDebug("Debug: rootIsReadOnly set to " + std::to_string(snapshot.rootIsReadOnly));
+        } else if (name == "readonlyremountdelay") {
+          auto readOnlyRemountDelay = BaseLib::Math::getNumber(value);
+          snapshot.readOnlyRemountDelay = readOnlyRemountDelay < 0 ? 0 : readOnlyRemountDelay;
+          GD::bl->out.printDebug("Debug: readOnlyRemountDelay set to " + std::to_string(snapshot.readOnlyRemountDelay));
         } else if (name == "securememorysize") {
-          _secureMemorySize = BaseLib::Math::getNumber(value);
+          snapshot.secureMemorySize = BaseLib::Math::getNumber(value);
           //Allow 0 => disable secure memory. 16384 is minimum size. Values smaller than 16384 are set to 16384 by gcrypt: https://gnupg.org/documentation/manuals/gcrypt-devel/Controlling-the-library.html
-          if (_secureMemorySize < 0) _secureMemorySize = 1;
-          GD::bl->out.printDebug("Debug: secureMemorySize set to " + std::to_string(_secureMemorySize));
+          if (snapshot.secureMemorySize < 0) snapshot.secureMemorySize = 1;
+          GD::bl->out.printDebug("Debug: secureMemorySize set to " + std::to_string(snapshot.secureMemorySize));
         } else if (name == "maxcommandthreads") {
-          _maxCommandThreads = BaseLib::Math::getNumber(value);
-          if (_maxCommandThreads < 1) _maxCommandThreads = 1;
-          GD::bl->out.printDebug("Debug: maxCommandThreads set to " + std::to_string(_maxCommandThreads));
+          snapshot.maxCommandThreads = BaseLib::Math::getNumber(value);
+          if (snapshot.maxCommandThreads < 1) snapshot.maxCommandThreads = 1;
+          GD::bl->out.printDebug("Debug: maxCommandThreads set to " + std::to_string(snapshot.maxCommandThreads));
+        } else if (name == "maxinteractivecommands") {
+          snapshot.maxInteractiveCommands = BaseLib::Math::getNumber(value);
+          if (snapshot.maxInteractiveCommands < 1) snapshot.maxInteractiveCommands = 1;
+          GD::bl->out.printDebug("Debug: maxInteractiveCommands set to " + std::to_string(snapshot.maxInteractiveCommands));
+        } else if (name == "maxservicecommands") {
+          snapshot.maxServiceCommands = BaseLib::Math::getNumber(value);
+          if (snapshot.maxServiceCommands < 1) snapshot.maxServiceCommands = 1;
+          GD::bl->out.printDebug("Debug: maxServiceCommands set to " + std::to_string(snapshot.maxServiceCommands));
+        } else if (name == "maxbulkcommands") {
+          snapshot.maxBulkCommands = BaseLib::Math::getNumber(value);
+          if (snapshot.maxBulkCommands < 1) snapshot.maxBulkCommands = 1;
+          GD::bl->out.printDebug("Debug: maxBulkCommands set to " + std::to_string(snapshot.maxBulkCommands));
+        } else if (name == "commandoutputbuffersize") {
+          auto commandOutputBufferSize = BaseLib::Math::getNumber(value);
+          snapshot.commandOutputBufferSize = commandOutputBufferSize < 1024 ? 1024 : commandOutputBufferSize;
+          GD::bl->out.printDebug("Debug: commandOutputBufferSize set to " + std::to_string(snapshot.commandOutputBufferSize));
+        } else if (name == "commandretentiontime") {
+          auto commandRetentionTime = BaseLib::Math::getNumber(value);
+          snapshot.commandRetentionTime = commandRetentionTime < 1 ? 1 : commandRetentionTime;
+          GD::bl->out.printDebug("Debug: commandRetentionTime set to " + std::to_string(snapshot.commandRetentionTime));
+        } else if (name == "maxretainedcommands") {
+          auto maxRetainedCommands = BaseLib::Math::getNumber(value);
+          snapshot.maxRetainedCommands = maxRetainedCommands < 1 ? 1 : maxRetainedCommands;
+          GD::bl->out.printDebug("Debug: maxRetainedCommands set to " + std::to_string(snapshot.maxRetainedCommands));
+        } else if (name == "maxretainedcommandoutput") {
+          auto maxRetainedCommandOutput = BaseLib::Math::getNumber(value);
+          snapshot.maxRetainedCommandOutput = maxRetainedCommandOutput < 0 ? 0 : maxRetainedCommandOutput;
+          GD::bl->out.printDebug("Debug: maxRetainedCommandOutput set to " + std::to_string(snapshot.maxRetainedCommandOutput));
+        } else if (name == "commandoutputspillsize") {
+          auto commandOutputSpillSize = BaseLib::Math::getNumber(value);
+          snapshot.commandOutputSpillSize = commandOutputSpillSize < 0 ? 0 : commandOutputSpillSize;
+          GD::bl->out.printDebug("Debug: commandOutputSpillSize set to " + std::to_string(snapshot.commandOutputSpillSize));
+        } else if (name == "enablecgroups") {
+          snapshot.enableCgroups = BaseLib::HelperFunctions::toLower(value) == "true";
+          GD::bl->out.printDebug("Debug: enableCgroups set to " + std::to_string(snapshot.enableCgroups));
+        } else if (name == "cgrouppath") {
+          snapshot.cgroupPath = value;
+          while (!snapshot.cgroupPath.empty() && snapshot.cgroupPath.back() == '/') snapshot.cgroupPath.pop_back();
+          GD::bl->out.printDebug("Debug: cgroupPath set to " + snapshot.cgroupPath);
+        } else if (name == "commandcgroup") {
+          std::vector<std::string> elements = GD::bl->hf.splitAll(value, ' ');
+          GD::bl->hf.trim(elements.at(0));
+          auto &limits = snapshot.commandCgroups[elements.at(0)];
+          for (uint32_t i = 1; i < elements.size(); i++) {
+            auto pair = BaseLib::HelperFunctions::splitFirst(elements.at(i), '=');
+            BaseLib::HelperFunctions::toLower(BaseLib::HelperFunctions::trim(pair.first));
+            BaseLib::HelperFunctions::trim(pair.second);
+            if (pair.first == "cpuweight") limits.cpuWeight = BaseLib::Math::getNumber(pair.second);
+            else if (pair.first == "memorymax") limits.memoryMax = pair.second == "max" ? -1 : BaseLib::Math::getNumber64(pair.second);
+            else if (pair.first == "ioweight") limits.ioWeight = BaseLib::Math::getNumber(pair.second);
+            else if (!pair.first.empty()) GD::bl->out.printWarning("Warning: Unknown cgroup limit: " + pair.first);
+          }
+          GD::bl->out.printDebug("Debug: commandCgroup was set for " + elements.at(0));
+        } else if (name == "commandtimeout") {
+          std::vector<std::string> elements = GD::bl->hf.splitAll(value, ' ');
+          if (elements.size() == 2) {
+            GD::bl->hf.trim(elements.at(0));
+            auto timeout = BaseLib::Math::getNumber(GD::bl->hf.trim(elements.at(1)));
+            snapshot.commandTimeouts[elements.at(0)] = timeout < 0 ? 0 : timeout;
+            GD::bl->out.printDebug("Debug: commandTimeout of " + elements.at(0) + " set to " + std::to_string(snapshot.commandTimeouts[elements.at(0)]));
+          } else GD::bl->out.printWarning("Warning: Invalid value for commandTimeout: " + value);
+        } else if (name == "commandkilltimeout") {
+          auto commandKillTimeout = BaseLib::Math::getNumber(value);
+          snapshot.commandKillTimeout = commandKillTimeout < 1 ? 1 : commandKillTimeout;
+          GD::bl->out.printDebug("Debug: commandKillTimeout set to " + std::to_string(snapshot.commandKillTimeout));
         } else if (name == "allowedservicecommands") {
           std::vector<std::string> elements = GD::bl->hf.splitAll(value, ' ');
           for (auto &element: elements) {
             GD::bl->hf.trim(element);
-            _allowedServiceCommands.emplace(element);
+            snapshot.allowedServiceCommands.add(element);
           }
           GD::bl->out.printDebug("Debug: allowedServiceCommands was set");
         } else if (name == "controllableservices") {
           std::vector<std::string> elements = GD::bl->hf.splitAll(value, ' ');
           for (auto &element: elements) {
             GD::bl->hf.trim(element);
-            _controllableServices.emplace(element);
+            snapshot.controllableServices.add(element);
           }
           GD::bl->out.printDebug("Debug: controllableServices was set");
         } else if (name == "packageswhitelist") {
           std::vector<std::string> elements = GD::bl->hf.splitAll(value, ' ');
           for (auto &element: elements) {
             GD::bl->hf.trim(element);
-            _packagesWhitelist.emplace(element);
+            snapshot.packagesWhitelist.add(element);
           }
           GD::bl->out.printDebug("Debug: packagesWhitelist was set");
         } else if (name == "settingswhitelist") {
           std::vector<std::string> elements = GD::bl->hf.splitAll(value, ' ');
-          GD::bl->hf.trim(elements.at(0));
-          for (uint32_t i = 0; i < elements.size(); i++) {
-            GD::bl->hf.trim(elements.at(i));
-            _settingsWhitelist[elements.at(0)].emplace(elements.at(i));
+          for (auto &element: elements) {
+            GD::bl->hf.trim(element);
+          }
+          //The first element is the file name pattern, the others are the settings.
+          std::vector<std::string> settings(elements.begin() + 1, elements.end());
+          if (!snapshot.settingsWhitelist.add(elements.at(0), settings)) {
+            GD::bl->out.printError("Error: Invalid file name pattern in settingsWhitelist: " + elements.at(0));
           }
           GD::bl->out.printDebug("Debug: controllableServices was set");
         } else if (name == "backupscript") {
-          backup_script_ = value;
-          GD::bl->out.printDebug("Debug: backupScript set to " + backup_script_);
+          snapshot.backupScript = value;
+          GD::bl->out.printDebug("Debug: backupScript set to " + snapshot.backupScript);
+        } else if (name == "backuppaths") {
+          snapshot.backupPaths.clear();
+          std::vector<std::string> elements = GD::bl->hf.splitAll(value, ' ');
+          for (auto &element: elements) {
+            GD::bl->hf.trim(element);
+            if (element.empty()) continue;
+            if (element.front() != '/') GD::bl->out.printWarning("Warning: Ignoring relative path in backupPaths: " + element);
+            else snapshot.backupPaths.push_back(element);
+          }
+          GD::bl->out.printDebug("Debug: backupPaths was set");
+        } else if (name == "backupthreads") {
+          auto backupThreads = BaseLib::Math::getNumber(value);
+          snapshot.backupThreads = backupThreads < 0 ? 0 : backupThreads;
+          GD::bl->out.printDebug("Debug: backupThreads set to " + std::to_string(snapshot.backupThreads));
+        } else if (name == "certificatekeypoolsize") {
+          auto certificateKeyPoolSize = BaseLib::Math::getNumber(value);
+          snapshot.certificateKeyPoolSize = certificateKeyPoolSize < 0 ? 0 : certificateKeyPoolSize;
+          GD::bl->out.printDebug("Debug: certificateKeyPoolSize set to " + std::to_string(snapshot.certificateKeyPoolSize));
+        } else if (name == "certificatekeytype") {
+          BaseLib::HelperFunctions::toLower(value);
+          if (value == "rsa4096" || value == "ecp256" || value == "ed25519") {
+            snapshot.certificateKeyType = value;
+            GD::bl->out.printDebug("Debug: certificateKeyType set to " + snapshot.certificateKeyType);
+          } else GD::bl->out.printWarning("Warning: Invalid value for certificateKeyType: " + value);
+        } else if (name == "maxuploadsize") {
+          auto maxUploadSize = BaseLib::Math::getNumber64(value);
+          snapshot.maxUploadSize = maxUploadSize < 0 ? 0 : maxUploadSize;
+          GD::bl->out.printDebug("Debug: maxUploadSize set to " + std::to_string(snapshot.maxUploadSize));
+        } else if (name == "maxuploadsessions") {
+          auto maxUploadSessions = BaseLib::Math::getNumber(value);
+          snapshot.maxUploadSessions = maxUploadSessions < 1 ? 1 : maxUploadSessions;
+          GD::bl->out.printDebug("Debug: maxUploadSessions set to " + std::to_string(snapshot.maxUploadSessions));
+        } else if (name == "uploadtimeout") {
+          auto uploadTimeout = BaseLib::Math::getNumber(value);
+          snapshot.uploadTimeout = uploadTimeout < 1 ? 1 : uploadTimeout;
+          GD::bl->out.printDebug("Debug: uploadTimeout set to " + std::to_string(snapshot.uploadTimeout));
         } else {
           GD::bl->out.printWarning("Warning: Setting not found: " + std::string(input));
         }
       }
     }
 
+    struct stat statStruct{};
+    if (fstat(fileno(fin), &statStruct) == 0) {
+      _inode = statStruct.st_ino;
+      _lastModified = (int64_t)statStruct.st_mtim.tv_sec * 1000000000 + statStruct.st_mtim.tv_nsec;
+    }
     fclose(fin);
-    _lastModified = GD::bl->io.getFileLastModifiedTime(filename);
+    snapshot.allowedServiceCommands.compile();
+    snapshot.controllableServices.compile();
+    snapshot.packagesWhitelist.compile();
+    snapshot.packagesBlacklist.compile();
+    snapshot.settingsWhitelist.compile();
+    publish(newSnapshot);
   }
   catch (const std::exception &ex) {
     GD::bl->out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
@@ -31,61 +31,145 @@
 #ifndef CONFIGSETTINGS_H_
 #define CONFIGSETTINGS_H_
 
+#include "SettingsWhitelist.h"
+#include "StringSet.h"
+
 #include <homegear-base/BaseLib.h>
 
+#include <atomic>
+#include <mutex>
+#include <thread>
+
 class Settings {
  public:
   Settings();
-  virtual ~Settings() {}
+  virtual ~Settings() { stopWatching(); }
   void load(std::string filename, std::string executablePath);
+
+  /**
+   * Loads the file passed to "load()" again.
+   */
+  void reload();
   bool changed();
 
-  std::string socketPath() { return _socketPath; }
-  std::string runAsUser() { return _runAsUser; }
-  std::string runAsGroup() { return _runAsGroup; }
-  int32_t debugLevel() { return _debugLevel; }
-  bool memoryDebugging() { return _memoryDebugging; }
-  bool enableCoreDumps() { return _enableCoreDumps; };
-  std::string workingDirectory() { return _workingDirectory; }
-  std::string logfilePath() { return _logfilePath; }
-  std::string homegearDataPath() { return _homegearDataPath; }
-  bool rootIsReadOnly() { return _rootIsReadOnly; }
-  uint32_t secureMemorySize() { return _secureMemorySize; }
-  std::string system() { return _system; }
-  std::string codename() { return _codename; }
-  int32_t maxCommandThreads() { return _maxCommandThreads; }
-  std::unordered_set<std::string> allowedServiceCommands() { return _allowedServiceCommands; }
-  std::unordered_set<std::string> controllableServices() { return _controllableServices; }
-  std::unordered_set<std::string> packagesWhitelist() { return _packagesWhitelist; }
-  std::unordered_set<std::string> packagesBlacklist() { return _packagesBlacklist; }
-  std::unordered_map<std::string, std::unordered_set<std::string>> &settingsWhitelist() { return _settingsWhitelist; }
-  std::string BackupScript() { return backup_script_; }
+  /**
+   * Watches the settings file with inotify and reloads it when it changed.
+   */
+  void startWatching();
+  void stopWatching();
+
+  /**
+   * Resource limits of a command cgroup. Negative values mean "don't set".
+   */
+  struct CgroupLimits {
+    int32_t cpuWeight = -1;
+    int64_t memoryMax = -1;
+    int32_t ioWeight = -1;
+  };
+
+  /**
+   * All settings of one load of management.conf. Snapshots are immutable once published.
+   */
+  struct Snapshot {
+    std::string socketPath;
+    std::string runAsUser;
+    std::string runAsGroup;
+    int32_t debugLevel = 3;
+    bool memoryDebugging = false;
+    bool enableCoreDumps = true;
+    std::string workingDirectory;
+    std::string logfilePath;
+    std::string homegearDataPath;
+    std::string system;
+    std::string codename;
+    bool rootIsReadOnly = false;
+    uint32_t readOnlyRemountDelay = 10;
+    uint32_t secureMemorySize = 65536;
+    int32_t maxCommandThreads = 30;
+    int32_t maxInteractiveCommands = 30;
+    int32_t maxServiceCommands = 4;
+    int32_t maxBulkCommands = 2;
+    uint32_t commandOutputBufferSize = 1048576;
+    uint32_t commandRetentionTime = 60;
+    uint32_t maxRetainedCommands = 100;
+    uint32_t maxRetainedCommandOutput = 8388608;
+    uint32_t commandOutputSpillSize = 65536;
+    bool enableCgroups = true;
+    std::string cgroupPath;
+    std::unordered_map<std::string, CgroupLimits> commandCgroups;
+    std::unordered_map<std::string, uint32_t> commandTimeouts;
+    uint32_t commandKillTimeout = 10;
+    StringSet allowedServiceCommands;
+    StringSet controllableServices;
+    StringSet packagesWhitelist;
+    StringSet packagesBlacklist;
+    SettingsWhitelist settingsWhitelist;
+    std::string backupScript;
+    std::vector<std::string> backupPaths;
+    uint32_t backupThreads = 0;
+    uint32_t certificateKeyPoolSize = 0;
+    std::string certificateKeyType = "rsa4096";
+    uint64_t maxUploadSize = 104857600;
+    uint32_t maxUploadSessions = 4;
+    uint32_t uploadTimeout = 300;
+  };
+  typedef std::shared_ptr<const Snapshot> PSnapshot;
+
+  /**
+   * Returns the current settings. Use this to read multiple settings which need to be consistent with each other.
+   */
+  PSnapshot snapshot() const { return std::atomic_load(&_snapshot); }
+
+  //The accessors return copies. Read containers through snapshot() and keep the snapshot while using them.
+  std::string socketPath() { return snapshot()->socketPath; }
+  std::string runAsUser() { return snapshot()->runAsUser; }
+  std::string runAsGroup() { return snapshot()->runAsGroup; }
+  int32_t debugLevel() { return snapshot()->debugLevel; }
+  bool memoryDebugging() { return snapshot()->memoryDebugging; }
+  bool enableCoreDumps() { return snapshot()->enableCoreDumps; }
+  std::string workingDirectory() { return snapshot()->workingDirectory; }
+  std::string logfilePath() { return snapshot()->logfilePath; }
+  std::string homegearDataPath() { return snapshot()->homegearDataPath; }
+  bool rootIsReadOnly() { return snapshot()->rootIsReadOnly; }
+  uint32_t readOnlyRemountDelay() { return snapshot()->readOnlyRemountDelay; }
+  uint32_t secureMemorySize() { return snapshot()->secureMemorySize; }
+  std::string system() { return snapshot()->system; }
+  std::string codename() { return snapshot()->codename; }
+  int32_t maxCommandThreads() { return snapshot()->maxCommandThreads; }
+  int32_t maxInteractiveCommands() { return snapshot()->maxInteractiveCommands; }
+  int32_t maxServiceCommands() { return snapshot()->maxServiceCommands; }
+  int32_t maxBulkCommands() { return snapshot()->maxBulkCommands; }
+  uint32_t commandOutputBufferSize() { return snapshot()->commandOutputBufferSize; }
+  uint32_t commandRetentionTime() { return snapshot()->commandRetentionTime; }
+  uint32_t maxRetainedCommands() { return snapshot()->maxRetainedCommands; }
+  uint32_t maxRetainedCommandOutput() { return snapshot()->maxRetainedCommandOutput; }
+  uint32_t commandOutputSpillSize() { return snapshot()->commandOutputSpillSize; }
+  bool enableCgroups() { return snapshot()->enableCgroups; }
+  std::string cgroupPath() { return snapshot()->cgroupPath; }
+  uint32_t commandKillTimeout() { return snapshot()->commandKillTimeout; }
+  std::string BackupScript() { return snapshot()->backupScript; }
+  std::vector<std::string> backupPaths() { return snapshot()->backupPaths; }
+  uint32_t backupThreads() { return snapshot()->backupThreads; }
+  uint32_t certificateKeyPoolSize() { return snapshot()->certificateKeyPoolSize; }
+  std::string certificateKeyType() { return snapshot()->certificateKeyType; }
+  uint64_t maxUploadSize() { return snapshot()->maxUploadSize; }
+  uint32_t maxUploadSessions() { return snapshot()->maxUploadSessions; }
+  uint32_t uploadTimeout() { return snapshot()->uploadTimeout; }
  private:
   std::string _executablePath;
   std::string _path;
-  int32_t _lastModified = -1;
+  ino_t _inode = 0;
+  int64_t _lastModified = -1;
+  bool _loaded = false;
+
+  PSnapshot _snapshot = std::make_shared<const Snapshot>();
+  std::mutex _loadMutex;
 
-  std::string _socketPath;
-  std::string _runAsUser;
-  std::string _runAsGroup;
-  int32_t _debugLevel = 3;
-  bool _memoryDebugging = false;
-  bool _enableCoreDumps = true;
-  std::string _workingDirectory;
-  std::string _logfilePath;
-  std::string _homegearDataPath;
-  std::string _system;
-  std::string _codename;
-  bool _rootIsReadOnly = false;
-  uint32_t _secureMemorySize = 65536;
-  int32_t _maxCommandThreads = 30;
-  std::unordered_set<std::string> _allowedServiceCommands;
-  std::unordered_set<std::string> _controllableServices;
-  std::unordered_set<std::string> _packagesWhitelist;
-  std::unordered_set<std::string> _packagesBlacklist;
-  std::unordered_map<std::string, std::unordered_set<std::string>> _settingsWhitelist;
-  std::string backup_script_;
+  std::atomic_bool _stopWatchThread{true};
+  std::thread _watchThread;
 
-  void reset();
+  void reset(Snapshot &snapshot);
+  void publish(const std::shared_ptr<Snapshot> &snapshot);
+  void watchThread();
 };
 #endif
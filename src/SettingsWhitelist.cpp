@@ -0,0 +1,182 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Homegear.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU Lesser General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+*/
+
+#include "SettingsWhitelist.h"
+
+#include <cctype>
+#include <cstring>
+
+void SettingsWhitelist::clear() {
+  _literals.clear();
+  _patterns.clear();
+  _patternIndex.clear();
+  _combinedRegex = std::regex();
+}
+
+bool SettingsWhitelist::add(const std::string &pattern, const std::vector<std::string> &settings) {
+  std::string literal;
+  if (getLiteral(pattern, literal)) {
+    auto &literalSettings = _literals[literal];
+    for (auto &setting: settings) {
+      literalSettings.add(setting);
+    }
+    return true;
+  }
+
+  auto patternIterator = _patternIndex.find(pattern);
+  if (patternIterator == _patternIndex.end()) {
+    //Validate the pattern on its own, so one invalid line doesn't break the combined expression.
+    try {
+      std::regex regex(pattern);
+    } catch (const std::regex_error &ex) {
+      return false;
+    }
+
+    patternIterator = _patternIndex.emplace(pattern, _patterns.size()).first;
+    _patterns.emplace_back();
+    _patterns.back().source = pattern;
+  }
+  auto &patternSettings = _patterns.at(patternIterator->second).settings;
+  for (auto &setting: settings) {
+    patternSettings.add(setting);
+  }
+  return true;
+}
+
+void SettingsWhitelist::compile() {
+  for (auto &literal: _literals) {
+    literal.second.compile();
+  }
+  for (auto &pattern: _patterns) {
+    pattern.settings.compile();
+  }
+
+  if (_patterns.empty()) {
+    _combinedRegex = std::regex();
+    return;
+  }
+
+  //"(pattern1)|(pattern2)|...". The capture group of a pattern tells which one matched.
+  std::string combinedPattern;
+  size_t captureGroup = 1;
+  for (auto &pattern: _patterns) {
+    pattern.separate = hasBackreference(pattern.source);
+    if (pattern.separate) {
+      pattern.regex = std::regex(pattern.source, std::regex::optimize);
+      continue;
+    }
+
+    if (!combinedPattern.empty()) combinedPattern.push_back('|');
+    combinedPattern.append("(" + pattern.source + ")");
+    pattern.captureGroup = captureGroup;
+    captureGroup += 1 + countCaptureGroups(pattern.source);
+  }
+  _combinedRegex = combinedPattern.empty() ? std::regex() : std::regex(combinedPattern, std::regex::optimize);
+}
+
+const SettingsWhitelist::Settings *SettingsWhitelist::find(const std::string &filename) const {
+  auto literalIterator = _literals.find(filename);
+  if (literalIterator != _literals.end()) return &literalIterator->second;
+
+  std::smatch match;
+  bool combinedMatchDone = false;
+  bool combinedMatched = false;
+  for (auto &pattern: _patterns) {
+    if (pattern.separate) {
+      if (std::regex_match(filename, pattern.regex)) return &pattern.settings;
+      continue;
+    }
+
+    if (!combinedMatchDone) {
+      combinedMatchDone = true;
+      combinedMatched = std::regex_match(filename, match, _combinedRegex);
+    }
+    if (combinedMatched && match[pattern.captureGroup].matched) return &pattern.settings;
+  }
+  return nullptr;
+}
+
+bool SettingsWhitelist::getLiteral(const std::string &pattern, std::string &literal) {
+  //Anchors are implied, as file names always need to match completely.
+  size_t start = 0;
+  size_t end = pattern.size();
+  if (start < end && pattern[start] == '^') start++;
+  if (end > start && pattern[end - 1] == '$' && (end - start < 2 || pattern[end - 2] != '\\')) end--;
+
+  literal.clear();
+  literal.reserve(end - start);
+  for (size_t i = start; i < end; i++) {
+    char c = pattern[i];
+    if (c == '\\') {
+      //Escaped punctuation is a literal character, everything else (e.g. "\w" or "\1") is not.
+      if (i + 1 >= end || std::isalnum((unsigned char)pattern[i + 1])) return false;
+      literal.push_back(pattern[++i]);
+    } else if (std::strchr(".[](){}*+?|^$", c)) return false;
+    else literal.push_back(c);
+  }
+  return !literal.empty();
+}
+
+size_t SettingsWhitelist::countCaptureGroups(const std::string &pattern) {
+  size_t count = 0;
+  bool inCharacterClass = false;
+  for (size_t i = 0; i < pattern.size(); i++) {
+    char c = pattern[i];
+    if (c == '\\') i++;
+    else if (inCharacterClass) {
+      if (c == ']') inCharacterClass = false;
+    } else if (c == '[') {
+      inCharacterClass = true;
+      //A "]" directly after "[" or "[^" is part of the class.
+      if (i + 1 < pattern.size() && pattern[i + 1] == '^') i++;
+      if (i + 1 < pattern.size() && pattern[i + 1] == ']') i++;
+    } else if (c == '(' && (i + 1 >= pattern.size() || pattern[i + 1] != '?')) count++;
+  }
+  return count;
+}
+
+bool SettingsWhitelist::hasBackreference(const std::string &pattern) {
+  bool inCharacterClass = false;
+  for (size_t i = 0; i < pattern.size(); i++) {
+    char c = pattern[i];
+    if (c == '\\') {
+      //Inside a character class "\1" is not a backreference.
+      if (!inCharacterClass && i + 1 < pattern.size() && pattern[i + 1] >= '1' && pattern[i + 1] <= '9') return true;
+      i++;
+    } else if (inCharacterClass) {
+      if (c == ']') inCharacterClass = false;
+    } else if (c == '[') {
+      inCharacterClass = true;
+      if (i + 1 < pattern.size() && pattern[i + 1] == '^') i++;
+      if (i + 1 < pattern.size() && pattern[i + 1] == ']') i++;
+    }
+  }
+  return false;
+}
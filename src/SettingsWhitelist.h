@@ -0,0 +1,99 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Homegear.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU Lesser General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+*/
+
+#ifndef SETTINGSWHITELIST_H_
+#define SETTINGSWHITELIST_H_
+
+#include "StringSet.h"
+
+#include <string>
+#include <vector>
+#include <regex>
+#include <unordered_map>
+
+/**
+ * Maps configuration file names to the settings which may be read and written in them (the "settingsWhitelist" lines
+ * in management.conf).
+ *
+ * File name patterns which only match a single file name (e.g. "^main\.conf$") are stored in a hash table. All other
+ * patterns are combined into a single regular expression with one capture group per pattern. Combining renumbers the
+ * capture groups, so patterns with backreferences (e.g. "\1") are matched on their own. All are built once by
+ * "compile()".
+ */
+class SettingsWhitelist {
+ public:
+  typedef StringSet Settings;
+
+  SettingsWhitelist() = default;
+  virtual ~SettingsWhitelist() = default;
+
+  void clear();
+
+  /**
+   * Adds settings for a file name pattern. Settings of patterns added multiple times are merged.
+   *
+   * @return Returns false when "pattern" is not a valid regular expression.
+   */
+  bool add(const std::string &pattern, const std::vector<std::string> &settings);
+
+  /**
+   * Builds the lookup structures. Needs to be called after all patterns were added.
+   */
+  void compile();
+
+  /**
+   * Returns the allowed settings for a file or nullptr when the file is not whitelisted. When multiple patterns match,
+   * literal file names win over regular expressions and earlier lines win over later ones.
+   */
+  const Settings *find(const std::string &filename) const;
+ private:
+  struct Pattern {
+    std::string source;
+    Settings settings;
+    size_t captureGroup = 0; //Capture group of the pattern in "_combinedRegex".
+    bool separate = false; //Matched with "regex" instead of "_combinedRegex".
+    std::regex regex;
+  };
+
+  std::unordered_map<std::string, Settings> _literals;
+  std::vector<Pattern> _patterns;
+  std::unordered_map<std::string, size_t> _patternIndex; //Pattern source => index in "_patterns".
+  std::regex _combinedRegex;
+
+  /**
+   * Returns true and the matched file name in "literal" when "pattern" only matches a single string.
+   */
+  static bool getLiteral(const std::string &pattern, std::string &literal);
+
+  static size_t countCaptureGroups(const std::string &pattern);
+  static bool hasBackreference(const std::string &pattern);
+};
+
+#endif
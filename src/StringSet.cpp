@@ -0,0 +1,80 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Homegear.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU Lesser General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+*/
+
+#include "StringSet.h"
+
+#include <algorithm>
+
+void StringSet::clear() {
+  _pending.clear();
+  _buffer.clear();
+  _entries.clear();
+}
+
+void StringSet::add(std::string_view element) {
+  _pending.emplace_back(element);
+}
+
+void StringSet::compile() {
+  //Elements of a previous compile are kept.
+  for (size_t i = 0; i < _entries.size(); i++) {
+    _pending.emplace_back(at(i));
+  }
+  std::sort(_pending.begin(), _pending.end());
+  _pending.erase(std::unique(_pending.begin(), _pending.end()), _pending.end());
+
+  size_t bufferSize = 0;
+  for (auto &element: _pending) {
+    bufferSize += element.size();
+  }
+
+  _buffer.clear();
+  _buffer.reserve(bufferSize);
+  _entries.clear();
+  _entries.reserve(_pending.size());
+  for (auto &element: _pending) {
+    Entry entry;
+    entry.offset = _buffer.size();
+    entry.size = element.size();
+    _entries.push_back(entry);
+    _buffer.append(element);
+  }
+
+  _pending.clear();
+  _pending.shrink_to_fit();
+}
+
+bool StringSet::contains(std::string_view element) const {
+  std::string_view buffer(_buffer);
+  auto entryIterator = std::lower_bound(_entries.begin(), _entries.end(), element, [&](const Entry &entry, std::string_view value) {
+    return buffer.substr(entry.offset, entry.size) < value;
+  });
+  return entryIterator != _entries.end() && buffer.substr(entryIterator->offset, entryIterator->size) == element;
+}
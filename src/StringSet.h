@@ -0,0 +1,69 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Homegear.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU Lesser General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+*/
+
+#ifndef STRINGSET_H_
+#define STRINGSET_H_
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Immutable set of strings for membership checks without allocations.
+ *
+ * Strings are collected with "add()". "compile()" sorts them and copies them into one contiguous buffer. Lookups are
+ * binary searches on "std::string_view". The set must not be changed after it was compiled.
+ */
+class StringSet {
+ public:
+  StringSet() = default;
+  virtual ~StringSet() = default;
+
+  void clear();
+  void add(std::string_view element);
+  void compile();
+
+  bool contains(std::string_view element) const;
+  size_t size() const { return _entries.size(); }
+  bool empty() const { return _entries.empty(); }
+  std::string_view at(size_t index) const { return std::string_view(_buffer).substr(_entries.at(index).offset, _entries.at(index).size); }
+ private:
+  struct Entry {
+    size_t offset = 0;
+    size_t size = 0;
+  };
+
+  std::vector<std::string> _pending;
+  //Offsets instead of string views, so copies of the set don't point into the buffer of the original.
+  std::string _buffer;
+  std::vector<Entry> _entries;
+};
+
+#endif
@@ -0,0 +1,136 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Homegear.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU Lesser General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+*/
+
+#include "SystemInfo.h"
+#include "GD.h"
+
+#include <sys/utsname.h>
+#include <sys/sysinfo.h>
+#include <unistd.h>
+
+void SystemInfo::load(DpkgDatabase &dpkgDatabase) {
+  try {
+    auto info = std::make_shared<Info>();
+
+    {
+      std::string content;
+      if (BaseLib::Io::fileExists("/etc/os-release")) content = BaseLib::Io::getFileContent("/etc/os-release");
+      else if (BaseLib::Io::fileExists("/usr/lib/os-release")) content = BaseLib::Io::getFileContent("/usr/lib/os-release");
+      else GD::out.printWarning("Warning: Could not find os-release file.");
+
+      auto osRelease = parseOsRelease(content);
+      info->system = BaseLib::HelperFunctions::toLower(osRelease["ID"]);
+      info->prettyName = osRelease["PRETTY_NAME"];
+      info->version = osRelease["VERSION_ID"];
+      info->codename = osRelease["VERSION_CODENAME"];
+      if (info->codename.empty()) info->codename = osRelease["UBUNTU_CODENAME"];
+      if (info->codename.empty()) {
+        //Older releases only have the code name in "VERSION", e.g. "9 (stretch)".
+        auto &version = osRelease["VERSION"];
+        auto start = version.find('(');
+        auto end = version.find(')', start);
+        if (start != std::string::npos && end != std::string::npos) info->codename = version.substr(start + 1, end - start - 1);
+      }
+      if (info->codename.empty()) info->codename = "n/a";
+    }
+
+    {
+      struct utsname unameInfo{};
+      if (uname(&unameInfo) == 0) {
+        info->kernelName = unameInfo.sysname;
+        info->kernelVersion = unameInfo.release;
+        info->machine = unameInfo.machine;
+      } else GD::out.printError("Error: Could not call uname: " + std::string(strerror(errno)));
+    }
+
+    {
+      //The native architecture of dpkg is the architecture of the dpkg package itself.
+      auto packages = dpkgDatabase.getInstalledPackages();
+      auto packageIterator = packages->find("dpkg");
+      if (packageIterator != packages->end() && !packageIterator->second.architecture.empty()) info->architecture = packageIterator->second.architecture;
+      else info->architecture = getArchitectureFromMachine(info->machine);
+    }
+
+    {
+      auto cpuCount = sysconf(_SC_NPROCESSORS_ONLN);
+      info->cpuCount = cpuCount > 0 ? (int32_t)cpuCount : 0;
+
+      struct sysinfo systemInformation{};
+      if (sysinfo(&systemInformation) == 0) {
+        info->totalMemory = (int64_t)systemInformation.totalram * systemInformation.mem_unit;
+        info->bootTime = BaseLib::HelperFunctions::getTimeSeconds() - systemInformation.uptime;
+      }
+    }
+
+    std::atomic_store(&_info, std::const_pointer_cast<const Info>(info));
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+}
+
+int64_t SystemInfo::getUptime() {
+  struct sysinfo systemInformation{};
+  if (sysinfo(&systemInformation) == -1) return 0;
+  return systemInformation.uptime;
+}
+
+std::unordered_map<std::string, std::string> SystemInfo::parseOsRelease(const std::string &content) {
+  std::unordered_map<std::string, std::string> result;
+  auto lines = BaseLib::HelperFunctions::splitAll(content, '\n');
+  for (auto &line: lines) {
+    BaseLib::HelperFunctions::trim(line);
+    if (line.empty() || line.front() == '#') continue;
+    auto pair = BaseLib::HelperFunctions::splitFirst(line, '=');
+    if (pair.first.empty()) continue;
+
+    //Values use shell syntax (see os-release(5)): Optionally quoted, with backslash escapes in double quotes.
+    std::string value;
+    value.reserve(pair.second.size());
+    char quote = 0;
+    for (size_t i = 0; i < pair.second.size(); i++) {
+      char c = pair.second[i];
+      if (quote == 0 && (c == '"' || c == '\'')) quote = c;
+      else if (quote != 0 && c == quote) quote = 0;
+      else if (quote != '\'' && c == '\\' && i + 1 < pair.second.size()) value.push_back(pair.second[++i]);
+      else value.push_back(c);
+    }
+    result[pair.first] = value;
+  }
+  return result;
+}
+
+std::string SystemInfo::getArchitectureFromMachine(const std::string &machine) {
+  if (machine == "x86_64") return "amd64";
+  if (machine == "aarch64") return "arm64";
+  if (machine.compare(0, 5, "armv7") == 0 || machine.compare(0, 5, "armv6") == 0) return "armhf";
+  if (machine.size() == 4 && machine.front() == 'i' && machine.compare(2, 2, "86") == 0) return "i386";
+  return machine;
+}
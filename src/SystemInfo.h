@@ -0,0 +1,83 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Homegear.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU Lesser General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+*/
+
+#ifndef SYSTEMINFO_H_
+#define SYSTEMINFO_H_
+
+#include "DpkgDatabase.h"
+
+#include <string>
+#include <memory>
+#include <unordered_map>
+
+/**
+ * Information about the system which doesn't change while we are running. It is read once on startup from
+ * /etc/os-release, the dpkg database and the kernel and read again after apt commands.
+ */
+class SystemInfo {
+ public:
+  struct Info {
+    std::string system; //"ID" in os-release, equals "lsb_release -i -s" in lower case.
+    std::string codename; //Equals "lsb_release -c -s".
+    std::string prettyName;
+    std::string version;
+    std::string architecture; //Equals "dpkg --print-architecture".
+    std::string kernelName;
+    std::string kernelVersion;
+    std::string machine;
+    int32_t cpuCount = 0;
+    int64_t totalMemory = 0; //In bytes.
+    int64_t bootTime = 0; //Unix time stamp in seconds.
+  };
+  typedef std::shared_ptr<const Info> PInfo;
+
+  SystemInfo() = default;
+  virtual ~SystemInfo() = default;
+
+  /**
+   * Returns the current snapshot. The returned object is immutable and stays valid when the information is reloaded.
+   */
+  PInfo get() const { return std::atomic_load(&_info); }
+
+  void load(DpkgDatabase &dpkgDatabase);
+
+  /**
+   * Returns the current uptime in seconds.
+   */
+  static int64_t getUptime();
+
+  static std::unordered_map<std::string, std::string> parseOsRelease(const std::string &content);
+ private:
+  PInfo _info = std::make_shared<const Info>();
+
+  static std::string getArchitectureFromMachine(const std::string &machine);
+};
+
+#endif
@@ -0,0 +1,289 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Homegear.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU Lesser General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+*/
+
+#include "UploadSessions.h"
+#include "GD.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+UploadSessions::UploadSessions(std::function<void(bool readOnly)> setRootReadOnly) : _setRootReadOnly(std::move(setRootReadOnly)) {
+}
+
+UploadSessions::~UploadSessions() {
+  std::lock_guard<std::mutex> sessionsGuard(_sessionsMutex);
+  for (auto &session: _sessions) {
+    std::lock_guard<std::mutex> sessionGuard(session.second->mutex);
+    close(*session.second);
+  }
+  _sessions.clear();
+}
+
+UploadSessions::PSession UploadSessions::getSession(const std::string &id) {
+  std::lock_guard<std::mutex> sessionsGuard(_sessionsMutex);
+  auto sessionIterator = _sessions.find(id);
+  if (sessionIterator == _sessions.end()) return PSession();
+  return sessionIterator->second;
+}
+
+UploadSessions::PSession UploadSessions::removeSession(const std::string &id) {
+  std::lock_guard<std::mutex> sessionsGuard(_sessionsMutex);
+  auto sessionIterator = _sessions.find(id);
+  if (sessionIterator == _sessions.end()) return PSession();
+  auto session = sessionIterator->second;
+  _sessions.erase(sessionIterator);
+  return session;
+}
+
+void UploadSessions::close(Session &session) {
+  if (session.fd != -1) {
+    ::close(session.fd);
+    session.fd = -1;
+    unlink(session.tempFilename.c_str());
+  }
+  if (session.hash) {
+    gnutls_hash_deinit(session.hash, nullptr);
+    session.hash = nullptr;
+  }
+}
+
+UploadSessions::Result UploadSessions::begin(const std::string &destination, mode_t mode, uint64_t maxSize, size_t maxSessions, bool expireAfterCommit, std::string &id) {
+  try {
+    auto session = std::make_shared<Session>();
+    session->destination = destination;
+    session->mode = mode;
+    session->expireAfterCommit = expireAfterCommit;
+    session->maxSize = maxSize;
+    session->lastActivity = BaseLib::HelperFunctions::getTimeSeconds();
+    if (gnutls_hash_init(&session->hash, GNUTLS_DIG_SHA256) != GNUTLS_E_SUCCESS) {
+      session->hash = nullptr;
+      return Result::error;
+    }
+
+    id = BaseLib::HelperFunctions::getHexString(BaseLib::HelperFunctions::getRandomBytes(16));
+    //In the destination's directory, so the rename on commit is atomic.
+    session->tempFilename = destination + ".upload-" + id;
+
+    //Every session keeps a file descriptor open and / writable. The session is added before its file is created, so
+    //concurrent calls can't exceed the limit. Until then it is treated as unknown.
+    {
+      std::lock_guard<std::mutex> sessionsGuard(_sessionsMutex);
+      if (_sessions.size() >= maxSessions) {
+        gnutls_hash_deinit(session->hash, nullptr);
+        session->hash = nullptr;
+        return Result::tooManySessions;
+      }
+      _sessions.emplace(id, session);
+    }
+
+    _setRootReadOnly(false);
+    bool opened = false;
+    {
+      std::lock_guard<std::mutex> sessionGuard(session->mutex);
+      //Not opened when the session was aborted in the meantime.
+      if (getSession(id)) {
+        session->fd = open(session->tempFilename.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR);
+        if (session->fd == -1) GD::out.printError("Error: Could not create " + session->tempFilename + ": " + std::string(strerror(errno)));
+      }
+      opened = session->fd != -1;
+      if (!opened) close(*session);
+    }
+    if (!opened) {
+      removeSession(id);
+      _setRootReadOnly(true);
+      return Result::error;
+    }
+    return Result::ok;
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return Result::error;
+}
+
+UploadSessions::Result UploadSessions::append(const std::string &id, uint64_t offset, const char *data, size_t dataSize, uint64_t &size) {
+  try {
+    auto session = getSession(id);
+    if (!session) return Result::sessionNotFound;
+
+    std::lock_guard<std::mutex> sessionGuard(session->mutex);
+    if (session->fd == -1) return Result::sessionNotFound;
+    session->lastActivity = BaseLib::HelperFunctions::getTimeSeconds();
+    size = session->size;
+    if (offset != session->size) return Result::invalidOffset;
+    if (session->size + dataSize > session->maxSize) return Result::tooLarge;
+
+    size_t bytesWritten = 0;
+    while (bytesWritten < dataSize) {
+      auto result = write(session->fd, data + bytesWritten, dataSize - bytesWritten);
+      if (result == -1) {
+        if (errno == EINTR) continue;
+        GD::out.printError("Error: Could not write " + session->tempFilename + ": " + std::string(strerror(errno)));
+        //The file now is in an unknown state.
+        if (ftruncate(session->fd, (off_t)session->size) == -1 || lseek(session->fd, (off_t)session->size, SEEK_SET) == -1) {
+          close(*session);
+          if (removeSession(id)) _setRootReadOnly(true);
+        }
+        return Result::error;
+      }
+      bytesWritten += (size_t)result;
+    }
+    gnutls_hash(session->hash, data, dataSize);
+    session->size += dataSize;
+    size = session->size;
+    return Result::ok;
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return Result::error;
+}
+
+UploadSessions::Result UploadSessions::commit(const std::string &id, const std::string &sha256, std::string &destination) {
+  try {
+    auto session = removeSession(id);
+    if (!session) return Result::sessionNotFound;
+
+    Result result = Result::ok;
+    {
+      std::lock_guard<std::mutex> sessionGuard(session->mutex);
+      destination = session->destination;
+      if (session->fd == -1) return Result::sessionNotFound;
+
+      std::vector<uint8_t> digest(32);
+      gnutls_hash_deinit(session->hash, digest.data());
+      session->hash = nullptr;
+
+      if (!sha256.empty() && BaseLib::HelperFunctions::toLower(BaseLib::HelperFunctions::getHexString(digest)) != BaseLib::HelperFunctions::toLower(std::string(sha256))) {
+        result = Result::checksumMismatch;
+      } else if (fchmod(session->fd, session->mode) == -1 || fsync(session->fd) == -1 || rename(session->tempFilename.c_str(), session->destination.c_str()) == -1) {
+        GD::out.printError("Error: Could not write " + session->destination + ": " + std::string(strerror(errno)));
+        result = Result::error;
+      } else {
+        ::close(session->fd);
+        session->fd = -1;
+        if (session->expireAfterCommit) {
+          std::lock_guard<std::mutex> sessionsGuard(_sessionsMutex);
+          _committedUploads[session->destination] = BaseLib::HelperFunctions::getTimeSeconds();
+        }
+      }
+      close(*session);
+    }
+
+    _setRootReadOnly(true);
+    return result;
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return Result::error;
+}
+
+UploadSessions::Result UploadSessions::abort(const std::string &id) {
+  try {
+    auto session = removeSession(id);
+    if (!session) return Result::sessionNotFound;
+
+    {
+      std::lock_guard<std::mutex> sessionGuard(session->mutex);
+      if (session->fd == -1) return Result::sessionNotFound;
+      close(*session);
+    }
+
+    _setRootReadOnly(true);
+    return Result::ok;
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+  return Result::error;
+}
+
+void UploadSessions::deleteCommittedUploads(const std::vector<std::string> &files) {
+  if (files.empty()) return;
+  _setRootReadOnly(false);
+  for (auto &file: files) {
+    //Doesn't exist any more when it was processed.
+    if (unlink(file.c_str()) == 0) GD::out.printInfo("Info: Deleted unused upload " + file + ".");
+  }
+  _setRootReadOnly(true);
+}
+
+void UploadSessions::abortAll() {
+  std::vector<std::string> ids;
+  std::vector<std::string> committedUploads;
+  {
+    std::lock_guard<std::mutex> sessionsGuard(_sessionsMutex);
+    for (auto &session: _sessions) {
+      ids.push_back(session.first);
+    }
+    for (auto &committedUpload: _committedUploads) {
+      committedUploads.push_back(committedUpload.first);
+    }
+    _committedUploads.clear();
+  }
+  for (auto &id: ids) {
+    abort(id);
+  }
+  deleteCommittedUploads(committedUploads);
+}
+
+void UploadSessions::removeExpired(uint32_t timeout) {
+  try {
+    std::vector<std::string> expiredSessions;
+    std::vector<std::string> expiredUploads;
+    auto now = BaseLib::HelperFunctions::getTimeSeconds();
+
+    {
+      std::lock_guard<std::mutex> sessionsGuard(_sessionsMutex);
+      for (auto &session: _sessions) {
+        //A session with an append in progress is not expired.
+        std::unique_lock<std::mutex> sessionGuard(session.second->mutex, std::try_to_lock);
+        if (sessionGuard.owns_lock() && now - session.second->lastActivity >= (int64_t)timeout) expiredSessions.push_back(session.first);
+      }
+      for (auto uploadIterator = _committedUploads.begin(); uploadIterator != _committedUploads.end();) {
+        if (now - uploadIterator->second >= (int64_t)timeout) {
+          expiredUploads.push_back(uploadIterator->first);
+          uploadIterator = _committedUploads.erase(uploadIterator);
+        } else ++uploadIterator;
+      }
+    }
+
+    for (auto &id: expiredSessions) {
+      GD::out.printInfo("Info: Upload " + id + " timed out.");
+      abort(id);
+    }
+    deleteCommittedUploads(expiredUploads);
+  }
+  catch (const std::exception &ex) {
+    GD::out.printEx(__FILE__, __LINE__, __PRETTY_FUNCTION__, ex.what());
+  }
+}
@@ -0,0 +1,143 @@
+/* Copyright 2013-2019 Homegear GmbH
+ *
+ * Homegear is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Homegear is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with Homegear.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU Lesser General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+*/
+
+#ifndef UPLOADSESSIONS_H_
+#define UPLOADSESSIONS_H_
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include <sys/types.h>
+
+#include <gnutls/gnutls.h>
+#include <gnutls/crypto.h>
+
+/**
+ * Uploads of large files in chunks. Chunks are written directly to a temporary file next to the destination, so only
+ * one chunk is kept in memory. On commit the SHA-256 checksum is verified and the file is renamed to the destination.
+ * The root file system is kept writable while a session is open.
+ */
+class UploadSessions {
+ public:
+  enum class Result {
+    ok,
+    sessionNotFound,
+    invalidOffset,
+    tooLarge,
+    checksumMismatch,
+    tooManySessions,
+    error
+  };
+
+  /**
+   * @param setRootReadOnly Called with "false" when a session is started and with "true" when it ends.
+   */
+  explicit UploadSessions(std::function<void(bool readOnly)> setRootReadOnly);
+  virtual ~UploadSessions();
+
+  /**
+   * Starts a session.
+   *
+   * @param destination The file the upload is renamed to on commit. Its directory needs to exist.
+   * @param mode The file mode of the destination.
+   * @param maxSize The maximum size of the upload in bytes.
+   * @param maxSessions The maximum number of open sessions.
+   * @param expireAfterCommit For uploads processed by a later call: The destination is deleted when it still exists
+   * "timeout" seconds (see removeExpired()) after the commit.
+   * @param[out] id Set to the ID of the new session.
+   */
+  Result begin(const std::string &destination, mode_t mode, uint64_t maxSize, size_t maxSessions, bool expireAfterCommit, std::string &id);
+
+  /**
+   * Appends a chunk. "offset" needs to be the number of bytes received so far, so a repeated chunk is not appended
+   * twice.
+   *
+   * @param[out] size Set to the number of bytes received so far.
+   */
+  Result append(const std::string &id, uint64_t offset, const char *data, size_t dataSize, uint64_t &size);
+
+  /**
+   * Verifies the checksum and renames the upload to its destination. The session ends, whatever the result.
+   *
+   * @param sha256 The expected SHA-256 checksum as hexadecimal string. Not verified when empty.
+   * @param[out] destination Set to the destination of the upload.
+   */
+  Result commit(const std::string &id, const std::string &sha256, std::string &destination);
+
+  /**
+   * Ends a session and deletes its temporary file.
+   */
+  Result abort(const std::string &id);
+
+  /**
+   * Aborts all sessions and deletes committed uploads with "expireAfterCommit" which were not processed yet.
+   */
+  void abortAll();
+
+  /**
+   * Aborts sessions without activity for "timeout" seconds and deletes uploads with "expireAfterCommit" committed more
+   * than "timeout" seconds ago.
+   */
+  void removeExpired(uint32_t timeout);
+ private:
+  struct Session {
+    std::mutex mutex;
+    std::string destination;
+    std::string tempFilename;
+    mode_t mode = 0644;
+    bool expireAfterCommit = false;
+    int fd = -1;
+    gnutls_hash_hd_t hash = nullptr;
+    uint64_t size = 0;
+    uint64_t maxSize = 0;
+    int64_t lastActivity = 0;
+  };
+  typedef std::shared_ptr<Session> PSession;
+
+  std::function<void(bool readOnly)> _setRootReadOnly;
+  std::mutex _sessionsMutex;
+  std::unordered_map<std::string, PSession> _sessions;
+  std::unordered_map<std::string, int64_t> _committedUploads; //Destination and commit time of uploads with "expireAfterCommit". Protected by _sessionsMutex.
+
+  PSession getSession(const std::string &id);
+  PSession removeSession(const std::string &id);
+
+  /**
+   * Closes and deletes the temporary file. Must be called with the session's mutex locked.
+   */
+  void close(Session &session);
+
+  void deleteCommittedUploads(const std::vector<std::string> &files);
+};
+
+#endif
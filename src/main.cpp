@@ -61,6 +61,7 @@ void terminateProgram(int signalNumber) {
   try {
     GD::out.printMessage("(Shutdown) => Stopping Homegear Management (Signal: " + std::to_string(signalNumber) + ")");
     GD::bl->shuttingDown = true;
+    GD::settings.stopWatching();
     GD::ipcClient->stop();
     GD::ipcClient.reset();
     BaseLib::ProcessManager::stopSignalHandler(GD::bl->threadManager);
@@ -115,6 +116,8 @@ void signalHandlerThread() {
       } else if (signalNumber == SIGHUP) {
         GD::out.printMessage("Info: SIGHUP received. Reloading...");
 
+        GD::settings.reload();
+
         if (!std::freopen((GD::settings.logfilePath() + "homegear-management.log").c_str(), "a", stdout)) {
           GD::out.printError("Error: Could not redirect output to new log file.");
         }
@@ -391,10 +394,13 @@ void startUp() {
       std::this_thread::sleep_for(std::chrono::milliseconds(10000));
     }
 
+    BaseLib::ProcessManager::startSignalHandler(GD::bl->threadManager); //Needs to be called before starting any threads
+
     GD::ipcClient.reset(new IpcClient(GD::settings.socketPath() + "homegearIPC.sock"));
     GD::ipcClient->start();
 
-    BaseLib::ProcessManager::startSignalHandler(GD::bl->threadManager); //Needs to be called before starting any threads
+    GD::settings.startWatching();
+
     GD::bl->threadManager.start(_signalHandlerThread, true, &signalHandlerThread);
 
     GD::out.printMessage("Startup complete.");